@@ -0,0 +1,1136 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/sys_heap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gopher_bench.h"
+#include "gopher_client.h"
+#include "gopher_image.h"
+#include "gopher_mem.h"
+#include "gopher_scale.h"
+
+LOG_MODULE_REGISTER(gopher_bench, LOG_LEVEL_ERR);
+
+#ifdef CONFIG_GOPHER_BENCH
+
+/* One benchmark: a latency sample per iteration plus totals */
+struct bench_row {
+    const char *name;
+    int count;
+    uint32_t us[GOPHER_BENCH_MAX_ITERATIONS];
+    uint64_t total_us;
+    size_t bytes;               /* Bytes processed over all iterations */
+    size_t heap_peak;           /* Peak system heap use above the start */
+};
+
+/* A generated test image */
+struct bench_image {
+    const char *name;
+    const char *selector;
+    uint8_t *data;
+    size_t len;
+};
+
+/* Response collected by the fetch sink */
+struct bench_buffer {
+    uint8_t *data;
+    size_t len;
+    size_t capacity;
+};
+
+/* Counts streamed bytes without keeping them */
+struct bench_counter {
+    size_t bytes;
+};
+
+/* Bit writers for the image encoders */
+struct bench_bits {
+    uint8_t *out;
+    size_t pos;
+    size_t block;               /* GIF: offset of the current sub-block length */
+    uint32_t acc;
+    int bits;
+};
+
+static struct bench_image bench_images[] = {
+    { "png", "/image/png" },
+    { "gif", "/image/gif" },
+    { "jpeg", "/image/jpeg" },
+};
+
+static struct gopher_client bench_client;
+static char bench_listing[GOPHER_BUFFER_SIZE];
+static struct bench_row bench_row;
+
+static K_THREAD_STACK_DEFINE(bench_server_stack, GOPHER_BENCH_SERVER_STACK_SIZE);
+static struct k_thread bench_server;
+static bool bench_server_started;
+
+/* The kernel heap behind k_malloc() */
+extern struct k_heap _system_heap;
+static size_t heap_baseline;
+
+#ifdef CONFIG_BOARD_NATIVE_SIM
+/* Simulated time stands still while code runs, so read the host clock
+ * (src/host/gopher_bench_host.c, built into the native simulator runner) */
+uint64_t gopher_bench_host_time_us(void);
+#endif
+
+/* Current time in microseconds */
+static uint64_t bench_time_us(void)
+{
+#if defined(CONFIG_BOARD_NATIVE_SIM)
+    return gopher_bench_host_time_us();
+#elif defined(CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER)
+    return k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+    return k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
+/* Synthetic picture: colour gradients with a checkerboard on top */
+static void bench_pixel(int x, int y, int width, int height, uint8_t rgb[3])
+{
+    rgb[0] = (uint8_t)(x * 255 / width);
+    rgb[1] = (uint8_t)(y * 255 / height);
+    rgb[2] = ((x / 16 + y / 16) & 1) ? 200 : 40;
+}
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v & 0xFFFF);
+}
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+/* Close a PNG chunk whose type starts at 'type' and data is 'len' bytes */
+static size_t png_chunk_end(uint8_t *out, size_t type, size_t len)
+{
+    put_be32(out + type - 4, len);
+    put_be32(out + type + 4 + len, crc32_ieee(out + type, 4 + len));
+    return type + 4 + len + 4;
+}
+
+/* Encode a truecolour PNG with stored (uncompressed) deflate blocks */
+static uint8_t *png_encode(int width, int height, size_t *len)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    size_t raw = height * (1 + 3 * width);
+    size_t blocks = raw / 65535 + 1;
+    size_t size = 8 + 25 + 12 + 2 + raw + 5 * blocks + 4 + 12;
+    uint8_t *out = gopher_mem_alloc(GOPHER_MEM_BENCH, size, 0);
+    uint32_t adler_a = 1, adler_b = 0;
+    size_t pos, idat, left;
+    int x = 0, y = 0;
+    
+    if (!out) {
+        return NULL;
+    }
+    
+    memcpy(out, signature, sizeof(signature));
+    
+    /* IHDR: 8 bits per channel, RGB, no interlace */
+    memcpy(out + 12, "IHDR", 4);
+    put_be32(out + 16, width);
+    put_be32(out + 20, height);
+    out[24] = 8;
+    out[25] = 2;
+    out[26] = 0;
+    out[27] = 0;
+    out[28] = 0;
+    pos = png_chunk_end(out, 12, 13);
+    
+    /* IDAT: zlib stream of stored blocks over the filtered rows */
+    idat = pos + 4;
+    memcpy(out + idat, "IDAT", 4);
+    pos = idat + 4;
+    out[pos++] = 0x78;
+    out[pos++] = 0x01;
+    
+    left = raw;
+    while (left > 0) {
+        uint16_t block = MIN(left, 65535);
+        
+        out[pos++] = (left == block) ? 1 : 0;
+        put_le16(out + pos, block);
+        put_le16(out + pos + 2, ~block);
+        pos += 4;
+        
+        for (int i = 0; i < block; i++) {
+            uint8_t byte;
+            
+            if (x == 0) {
+                byte = 0;       /* Filter type: none */
+            } else {
+                uint8_t rgb[3];
+                
+                bench_pixel((x - 1) / 3, y, width, height, rgb);
+                byte = rgb[(x - 1) % 3];
+            }
+            if (++x == 1 + 3 * width) {
+                x = 0;
+                y++;
+            }
+            
+            out[pos++] = byte;
+            adler_a = (adler_a + byte) % 65521;
+            adler_b = (adler_b + adler_a) % 65521;
+        }
+        left -= block;
+    }
+    put_be32(out + pos, (adler_b << 16) | adler_a);
+    pos += 4;
+    pos = png_chunk_end(out, idat, pos - idat - 4);
+    
+    memcpy(out + pos + 4, "IEND", 4);
+    *len = png_chunk_end(out, pos + 4, 0);
+    
+    return out;
+}
+
+/* Append a byte to the GIF image data, opening a new sub-block when full */
+static void gif_put_byte(struct bench_bits *w, uint8_t byte)
+{
+    if (w->out[w->block] == 255) {
+        w->block = w->pos++;
+        w->out[w->block] = 0;
+    }
+    w->out[w->pos++] = byte;
+    w->out[w->block]++;
+}
+
+static void gif_put_code(struct bench_bits *w, uint16_t code)
+{
+    w->acc |= (uint32_t)code << w->bits;
+    w->bits += 9;
+    while (w->bits >= 8) {
+        gif_put_byte(w, w->acc & 0xFF);
+        w->acc >>= 8;
+        w->bits -= 8;
+    }
+}
+
+/* Encode a GIF with a 3-3-2 palette. Every pixel is sent as a literal
+ * 9-bit code and the table is cleared before codes would grow. */
+static uint8_t *gif_encode(int width, int height, size_t *len)
+{
+    size_t pixels = width * height;
+    size_t data = ((pixels + pixels / 250 + 3) * 9 + 7) / 8;
+    size_t size = 13 + 768 + 10 + 1 + data + data / 255 + 1 + 2;
+    uint8_t *out = gopher_mem_alloc(GOPHER_MEM_BENCH, size, 0);
+    struct bench_bits w = { 0 };
+    int run = 0;
+    
+    if (!out) {
+        return NULL;
+    }
+    
+    memcpy(out, "GIF89a", 6);
+    put_le16(out + 6, width);
+    put_le16(out + 8, height);
+    out[10] = 0xF7;             /* Global colour table of 256 entries */
+    out[11] = 0;
+    out[12] = 0;
+    for (int i = 0; i < 256; i++) {
+        out[13 + 3 * i] = (i >> 5) * 255 / 7;
+        out[14 + 3 * i] = ((i >> 2) & 7) * 255 / 7;
+        out[15 + 3 * i] = (i & 3) * 255 / 3;
+    }
+    
+    w.out = out;
+    w.pos = 13 + 768;
+    out[w.pos++] = 0x2C;        /* Image descriptor, full frame */
+    put_le16(out + w.pos, 0);
+    put_le16(out + w.pos + 2, 0);
+    put_le16(out + w.pos + 4, width);
+    put_le16(out + w.pos + 6, height);
+    out[w.pos + 8] = 0;
+    w.pos += 9;
+    out[w.pos++] = 8;           /* LZW minimum code size */
+    w.block = w.pos++;
+    out[w.block] = 0;
+    
+    gif_put_code(&w, 256);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t rgb[3];
+            
+            if (run == 250) {
+                gif_put_code(&w, 256);
+                run = 0;
+            }
+            bench_pixel(x, y, width, height, rgb);
+            gif_put_code(&w, (rgb[0] & 0xE0) | ((rgb[1] >> 3) & 0x1C) | (rgb[2] >> 6));
+            run++;
+        }
+    }
+    gif_put_code(&w, 257);
+    if (w.bits > 0) {
+        gif_put_byte(&w, w.acc & 0xFF);
+    }
+    
+    /* An empty sub-block ends the image data */
+    if (out[w.block] != 0) {
+        out[w.pos++] = 0;
+    }
+    out[w.pos++] = 0x3B;
+    *len = w.pos;
+    
+    return out;
+}
+
+static void jpeg_put_bits(struct bench_bits *w, uint32_t value, int count)
+{
+    w->acc = (w->acc << count) | value;
+    w->bits += count;
+    while (w->bits >= 8) {
+        uint8_t byte = (w->acc >> (w->bits - 8)) & 0xFF;
+        
+        w->out[w->pos++] = byte;
+        if (byte == 0xFF) {
+            w->out[w->pos++] = 0;
+        }
+        w->bits -= 8;
+        w->acc &= (1 << w->bits) - 1;
+    }
+}
+
+/* Encode the DC coefficient difference of a block followed by end-of-block */
+static void jpeg_put_block(struct bench_bits *w, int diff)
+{
+    int magnitude = diff < 0 ? -diff : diff;
+    int category = 0;
+    
+    while (magnitude >> category) {
+        category++;
+    }
+    
+    /* The DC table gives category n the 4-bit code n */
+    jpeg_put_bits(w, category, 4);
+    if (category > 0) {
+        jpeg_put_bits(w, diff < 0 ? diff + (1 << category) - 1 : diff, category);
+    }
+    
+    /* The AC table holds only end-of-block, as the 1-bit code 0 */
+    jpeg_put_bits(w, 0, 1);
+}
+
+/* Encode a baseline YCbCr JPEG of flat 8x8 blocks: every block carries its
+ * DC coefficient only, so the decoder still runs the full Huffman, IDCT and
+ * colour conversion path */
+static uint8_t *jpeg_encode(int width, int height, size_t *len)
+{
+    static const uint8_t sof[] = {
+        0xFF, 0xC0, 0, 17, 8, 0, 0, 0, 0, 3,
+        1, 0x11, 0, 2, 0x11, 0, 3, 0x11, 0,
+    };
+    static const uint8_t dht[] = {
+        0xFF, 0xC4, 0, 49,
+        0x00, 0, 0, 0, 12, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        0x10, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0x00,
+    };
+    static const uint8_t sos[] = {
+        0xFF, 0xDA, 0, 12, 3, 1, 0x00, 2, 0x00, 3, 0x00, 0, 63, 0,
+    };
+    int blocks_x = width / 8;
+    int blocks_y = height / 8;
+    size_t size = 256 + blocks_x * blocks_y * 3 * 4;
+    uint8_t *out = gopher_mem_alloc(GOPHER_MEM_BENCH, size, 0);
+    struct bench_bits w = { 0 };
+    int pred[3] = { 0 };
+    
+    if (!out) {
+        return NULL;
+    }
+    
+    w.out = out;
+    out[w.pos++] = 0xFF;
+    out[w.pos++] = 0xD8;
+    
+    /* One quantisation table of 8s: a DC coefficient of v decodes to v + 128 */
+    out[w.pos++] = 0xFF;
+    out[w.pos++] = 0xDB;
+    put_be16(out + w.pos, 67);
+    out[w.pos + 2] = 0;
+    memset(out + w.pos + 3, 8, 64);
+    w.pos += 67;
+    
+    memcpy(out + w.pos, sof, sizeof(sof));
+    put_be16(out + w.pos + 5, blocks_y * 8);
+    put_be16(out + w.pos + 7, blocks_x * 8);
+    w.pos += sizeof(sof);
+    memcpy(out + w.pos, dht, sizeof(dht));
+    w.pos += sizeof(dht);
+    memcpy(out + w.pos, sos, sizeof(sos));
+    w.pos += sizeof(sos);
+    
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            uint8_t rgb[3];
+            int ycc[3];
+            
+            bench_pixel(bx * 8 + 4, by * 8 + 4, blocks_x * 8, blocks_y * 8, rgb);
+            ycc[0] = (19595 * rgb[0] + 38470 * rgb[1] + 7471 * rgb[2]) >> 16;
+            ycc[1] = 128 + ((-11059 * rgb[0] - 21709 * rgb[1] + 32768 * rgb[2]) >> 16);
+            ycc[2] = 128 + ((32768 * rgb[0] - 27439 * rgb[1] - 5329 * rgb[2]) >> 16);
+            
+            for (int c = 0; c < 3; c++) {
+                int dc = ycc[c] - 128;
+                
+                jpeg_put_block(&w, dc - pred[c]);
+                pred[c] = dc;
+            }
+        }
+    }
+    
+    /* Pad the last byte with 1 bits */
+    if (w.bits > 0) {
+        jpeg_put_bits(&w, (1 << (8 - w.bits)) - 1, 8 - w.bits);
+    }
+    out[w.pos++] = 0xFF;
+    out[w.pos++] = 0xD9;
+    *len = w.pos;
+    
+    return out;
+}
+
+/* Generate the test images once */
+static int bench_corpus_init(void)
+{
+    if (bench_images[0].data) {
+        return 0;
+    }
+    
+    bench_images[0].data = png_encode(GOPHER_BENCH_IMAGE_WIDTH, GOPHER_BENCH_IMAGE_HEIGHT,
+                                      &bench_images[0].len);
+    bench_images[1].data = gif_encode(GOPHER_BENCH_IMAGE_WIDTH, GOPHER_BENCH_IMAGE_HEIGHT,
+                                      &bench_images[1].len);
+    bench_images[2].data = jpeg_encode(GOPHER_BENCH_JPEG_WIDTH, GOPHER_BENCH_JPEG_HEIGHT,
+                                       &bench_images[2].len);
+    
+    for (int i = 0; i < ARRAY_SIZE(bench_images); i++) {
+        if (!bench_images[i].data) {
+            for (int j = 0; j < ARRAY_SIZE(bench_images); j++) {
+                gopher_mem_free(bench_images[j].data);
+                bench_images[j].data = NULL;
+            }
+            return -ENOMEM;
+        }
+    }
+    
+    return 0;
+}
+
+/* Send all of a buffer */
+static int bench_send(int sock, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    
+    while (len > 0) {
+        ssize_t sent = zsock_send(sock, p, len, 0);
+        
+        if (sent < 0) {
+            return -errno;
+        }
+        p += sent;
+        len -= sent;
+    }
+    
+    return 0;
+}
+
+/* Serve a menu of 'count' items: text files with a directory every tenth */
+static void bench_serve_menu(int sock, int count)
+{
+    char line[128];
+    
+    count = CLAMP(count, 0, GOPHER_MAX_DIR_ITEMS);
+    
+    for (int i = 0; i < count; i++) {
+        bool dir = (i % 10 == 9);
+        int len = snprintf(line, sizeof(line), "%cSynthetic item %d of %d\t%s\t%s\t%d\r\n",
+                           dir ? GOPHER_TYPE_DIRECTORY : GOPHER_TYPE_TEXT, i + 1, count,
+                           dir ? "/menu/25" : "/text/4", GOPHER_BENCH_HOST,
+                           GOPHER_BENCH_PORT);
+        
+        if (bench_send(sock, line, len) < 0) {
+            return;
+        }
+    }
+    bench_send(sock, ".\r\n", 3);
+}
+
+/* Serve 'kb' kilobytes of text in 64-byte lines */
+static void bench_serve_text(int sock, int kb)
+{
+    static const char text[] =
+        "The quick brown fox jumps over the lazy dog, again and again..\r\n";
+    char buf[1024];
+    
+    BUILD_ASSERT(sizeof(text) - 1 == 64);
+    
+    for (int i = 0; i < sizeof(buf); i += 64) {
+        memcpy(buf + i, text, 64);
+    }
+    for (int i = 0; i < kb; i++) {
+        if (bench_send(sock, buf, sizeof(buf)) < 0) {
+            return;
+        }
+    }
+    bench_send(sock, ".\r\n", 3);
+}
+
+/* Answer one request */
+static void bench_serve(int sock)
+{
+    static const char unknown[] = "3Unknown selector\t\terror.host\t1\r\n.\r\n";
+    char selector[GOPHER_MAX_SELECTOR_LEN + 3];
+    size_t len = 0;
+    
+    /* Read the selector line */
+    selector[0] = '\0';
+    while (len < sizeof(selector) - 1 && !strchr(selector, '\n')) {
+        ssize_t n = zsock_recv(sock, selector + len, sizeof(selector) - 1 - len, 0);
+        
+        if (n <= 0) {
+            return;
+        }
+        len += n;
+        selector[len] = '\0';
+    }
+    selector[strcspn(selector, "\r\n")] = '\0';
+    
+    if (strncmp(selector, "/menu/", 6) == 0) {
+        bench_serve_menu(sock, atoi(selector + 6));
+        return;
+    }
+    if (strncmp(selector, "/text/", 6) == 0) {
+        bench_serve_text(sock, atoi(selector + 6));
+        return;
+    }
+    for (int i = 0; i < ARRAY_SIZE(bench_images); i++) {
+        if (strcmp(selector, bench_images[i].selector) == 0) {
+            bench_send(sock, bench_images[i].data, bench_images[i].len);
+            return;
+        }
+    }
+    
+    bench_send(sock, unknown, sizeof(unknown) - 1);
+}
+
+static void bench_server_thread(void *p1, void *p2, void *p3)
+{
+    int listener = (int)(intptr_t)p1;
+    
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+    
+    while (1) {
+        int sock = zsock_accept(listener, NULL, NULL);
+        
+        if (sock < 0) {
+            LOG_ERR("Accept failed: %d", errno);
+            k_msleep(100);
+            continue;
+        }
+        
+        bench_serve(sock);
+        zsock_close(sock);
+    }
+}
+
+/* Start the loopback server on first use */
+static int bench_server_start(void)
+{
+    struct sockaddr_in addr = { 0 };
+    int opt = 1;
+    int sock;
+    
+    if (bench_server_started) {
+        return 0;
+    }
+    
+    sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -errno;
+    }
+    zsock_setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(GOPHER_BENCH_PORT);
+    zsock_inet_pton(AF_INET, GOPHER_BENCH_HOST, &addr.sin_addr);
+    
+    if (zsock_bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        zsock_listen(sock, 4) < 0) {
+        int ret = -errno;
+        
+        zsock_close(sock);
+        return ret;
+    }
+    
+    k_thread_create(&bench_server, bench_server_stack,
+                    K_THREAD_STACK_SIZEOF(bench_server_stack),
+                    bench_server_thread, (void *)(intptr_t)sock, NULL, NULL,
+                    GOPHER_BENCH_SERVER_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&bench_server, "gopher_bench");
+    bench_server_started = true;
+    
+    return 0;
+}
+
+static int bench_buffer_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    struct bench_buffer *buf = user_data;
+    
+    if (buf->len + len > buf->capacity) {
+        return -ENOMEM;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    
+    return 0;
+}
+
+static int bench_counter_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    struct bench_counter *counter = user_data;
+    
+    ARG_UNUSED(data);
+    counter->bytes += len;
+    
+    return 0;
+}
+
+static void row_begin(struct bench_row *row, const char *name)
+{
+    struct sys_memory_stats stats;
+    
+    memset(row, 0, sizeof(*row));
+    row->name = name;
+    
+    sys_heap_runtime_stats_reset_max(&_system_heap.heap);
+    sys_heap_runtime_stats_get(&_system_heap.heap, &stats);
+    heap_baseline = stats.allocated_bytes;
+}
+
+/* Record one iteration that started at 'start' and processed 'bytes' */
+static void row_add(struct bench_row *row, uint64_t start, size_t bytes)
+{
+    uint64_t elapsed = bench_time_us() - start;
+    
+    row->us[row->count++] = (uint32_t)MIN(elapsed, UINT32_MAX);
+    row->total_us += elapsed;
+    row->bytes += bytes;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+    
+    return (x > y) - (x < y);
+}
+
+static void row_print(const struct shell *shell, struct bench_row *row)
+{
+    struct sys_memory_stats stats;
+    uint32_t *us = row->us;
+    int n = row->count;
+    uint32_t rate;
+    
+    if (n == 0) {
+        shell_print(shell, "%-12s failed", row->name);
+        return;
+    }
+    
+    sys_heap_runtime_stats_get(&_system_heap.heap, &stats);
+    row->heap_peak = stats.max_allocated_bytes > heap_baseline ?
+                     stats.max_allocated_bytes - heap_baseline : 0;
+    
+    qsort(us, n, sizeof(us[0]), compare_u32);
+    rate = row->total_us ? (uint32_t)(row->bytes * 1000000ULL / 1024 / row->total_us) : 0;
+    
+    shell_print(shell, "%-12s %4d %9u %9u %9u %9u %9u %9zu",
+                row->name, n, us[(n - 1) * 50 / 100], us[(n - 1) * 90 / 100],
+                us[(n - 1) * 99 / 100], us[n - 1], rate, row->heap_peak);
+}
+
+static void bench_menu(const struct shell *shell, int iterations)
+{
+    struct bench_row *row = &bench_row;
+    char selector[16];
+    int received = 0;
+    
+    snprintf(selector, sizeof(selector), "/menu/%d", GOPHER_BENCH_MENU_ITEMS);
+    
+    row_begin(row, "menu.fetch");
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        
+        received = gopher_send_selector(&bench_client, selector, bench_listing,
+                                        sizeof(bench_listing));
+        if (received <= 0) {
+            shell_error(shell, "Menu fetch failed: %d", received);
+            break;
+        }
+        row_add(row, start, received);
+    }
+    row_print(shell, row);
+    
+    if (received <= 0) {
+        return;
+    }
+    
+    row_begin(row, "menu.parse");
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        int items = gopher_parse_directory(&bench_client, bench_listing);
+        
+        if (items != GOPHER_BENCH_MENU_ITEMS) {
+            shell_error(shell, "Parsed %d of %d menu items", items, GOPHER_BENCH_MENU_ITEMS);
+            break;
+        }
+        row_add(row, start, received);
+    }
+    row_print(shell, row);
+}
+
+static void bench_text(const struct shell *shell, int iterations)
+{
+    struct bench_row *row = &bench_row;
+    char selector[16];
+    
+    snprintf(selector, sizeof(selector), "/text/%d", GOPHER_BENCH_TEXT_KB);
+    
+    row_begin(row, "text.fetch");
+    for (int i = 0; i < iterations; i++) {
+        struct bench_counter counter = { 0 };
+        uint64_t start = bench_time_us();
+        int ret = gopher_fetch(&bench_client, selector, bench_counter_sink, &counter);
+        
+        if (ret < 0) {
+            shell_error(shell, "Text fetch failed: %d", ret);
+            break;
+        }
+        row_add(row, start, counter.bytes);
+    }
+    row_print(shell, row);
+}
+
+/* Column headings of the result table */
+static void print_header(const struct shell *shell)
+{
+    shell_print(shell, "%-12s %4s %9s %9s %9s %9s %9s %9s",
+                "benchmark", "n", "p50 us", "p90 us", "p99 us", "max us", "KB/s", "heap B");
+}
+
+/* Render an image in each colour mode; throughput is terminal output here,
+ * and the frame size is reported to compare the modes' serial cost */
+static void bench_color_modes(const struct shell *shell, uint8_t *data, size_t len,
+                              int iterations)
+{
+    static const struct {
+        const char *name;
+        int mode;
+        bool half_blocks;
+        int dither;
+    } modes[] = {
+        { "color.8", GOPHER_COLOR_MODE_8, false, GOPHER_DITHER_FLOYD_STEINBERG },
+        { "color.256", GOPHER_COLOR_MODE_256, false, GOPHER_DITHER_FLOYD_STEINBERG },
+        { "color.true", GOPHER_COLOR_MODE_TRUE, false, GOPHER_DITHER_FLOYD_STEINBERG },
+        { "blocks.8", GOPHER_COLOR_MODE_8, true, GOPHER_DITHER_FLOYD_STEINBERG },
+        { "blocks.256", GOPHER_COLOR_MODE_256, true, GOPHER_DITHER_FLOYD_STEINBERG },
+        { "dither.atk", GOPHER_COLOR_MODE_8, false, GOPHER_DITHER_ATKINSON },
+        { "dither.sl", GOPHER_COLOR_MODE_8, false, GOPHER_DITHER_SIERRA_LITE },
+        { "dither.bayer", GOPHER_COLOR_MODE_8, false, GOPHER_DITHER_BAYER },
+    };
+    struct bench_row *row = &bench_row;
+    
+    for (int m = 0; m < ARRAY_SIZE(modes); m++) {
+        ascii_art_config_t config = {
+            .use_color = true,
+            .use_dithering = true,
+            .use_extended_chars = modes[m].half_blocks,
+            .color_mode = modes[m].mode,
+            .dither = modes[m].dither,
+            .brightness = 1.0f,
+            .contrast = 1.0f,
+        };
+        int frame = 0;
+        
+        row_begin(row, modes[m].name);
+        for (int i = 0; i < iterations; i++) {
+            uint64_t start = bench_time_us();
+            
+            frame = gopher_render_image(shell, data, len, &config);
+            if (frame < 0) {
+                shell_error(shell, "Rendering in %s failed: %d", modes[m].name, frame);
+                break;
+            }
+            row_add(row, start, frame);
+        }
+        
+        print_header(shell);
+        row_print(shell, row);
+        shell_print(shell, "%-12s %d bytes per frame", modes[m].name, MAX(frame, 0));
+    }
+}
+
+static void bench_image(const struct shell *shell, const struct bench_image *image,
+                        int iterations)
+{
+    struct bench_row *row = &bench_row;
+    struct bench_buffer buf = { 0 };
+    char name[16];
+    
+    buf.capacity = image->len;
+    buf.data = gopher_mem_alloc(GOPHER_MEM_BENCH, buf.capacity, 0);
+    if (!buf.data) {
+        shell_error(shell, "No memory for the %s image", image->name);
+        return;
+    }
+    
+    snprintf(name, sizeof(name), "%s.fetch", image->name);
+    row_begin(row, name);
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        int ret;
+        
+        buf.len = 0;
+        ret = gopher_fetch(&bench_client, image->selector, bench_buffer_sink, &buf);
+        if (ret < 0 || buf.len != image->len) {
+            shell_error(shell, "Image fetch failed: %d", ret);
+            break;
+        }
+        row_add(row, start, buf.len);
+    }
+    row_print(shell, row);
+    
+    if (buf.len != image->len) {
+        gopher_mem_free(buf.data);
+        return;
+    }
+    
+    snprintf(name, sizeof(name), "%s.detect", image->name);
+    row_begin(row, name);
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        
+        if (!gopher_is_image(buf.data, buf.len)) {
+            shell_error(shell, "The %s image was not detected", image->name);
+            break;
+        }
+        row_add(row, start, buf.len);
+    }
+    row_print(shell, row);
+    
+    snprintf(name, sizeof(name), "%s.render", image->name);
+    row_begin(row, name);
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        int ret = gopher_render_image(shell, buf.data, buf.len, NULL);
+        
+        if (ret < 0) {
+            shell_error(shell, "Rendering the %s image failed: %d", image->name, ret);
+            break;
+        }
+        row_add(row, start, buf.len);
+    }
+    
+    /* The rendered images scroll the header away, repeat it */
+    print_header(shell);
+    row_print(shell, row);
+    
+    if (strcmp(image->name, "jpeg") == 0) {
+        bench_color_modes(shell, buf.data, buf.len, iterations);
+    }
+    
+    gopher_mem_free(buf.data);
+}
+
+/* The area averager that gopher_scale.c replaced, kept so scale.area can
+ * be compared with it: every source pixel goes whole into the output pixel
+ * it falls in, found by walking an error term */
+struct bench_prev_scaler {
+    int src_w, src_h;
+    int dst_w, dst_h;
+    int dst_y;                  /* Output row being accumulated */
+    int y_err;                  /* Error term of the row mapping */
+    int rows;                   /* Source rows summed into the current output row */
+    uint32_t *acc;              /* R, G and B sums of each output pixel in the row */
+    uint32_t *cols;             /* Source columns per output column */
+    uint8_t *out;               /* Result, dst_w x dst_h RGB pixels */
+};
+
+static void prev_scaler_free(struct bench_prev_scaler *scaler)
+{
+    gopher_mem_free(scaler->acc);
+    gopher_mem_free(scaler->cols);
+    gopher_mem_free(scaler->out);
+}
+
+static int prev_scaler_init(struct bench_prev_scaler *scaler, int src_w, int src_h,
+                            int dst_w, int dst_h)
+{
+    int err = 0;
+    int dx = 0;
+    
+    memset(scaler, 0, sizeof(*scaler));
+    scaler->src_w = src_w;
+    scaler->src_h = src_h;
+    scaler->dst_w = dst_w;
+    scaler->dst_h = dst_h;
+    
+    scaler->acc = gopher_mem_alloc(GOPHER_MEM_BENCH, dst_w * 3 * sizeof(uint32_t), GOPHER_MEM_HOT);
+    scaler->cols = gopher_mem_alloc(GOPHER_MEM_BENCH, dst_w * sizeof(uint32_t), GOPHER_MEM_HOT);
+    scaler->out = gopher_mem_alloc(GOPHER_MEM_BENCH, dst_w * dst_h * 3, 0);
+    if (!scaler->acc || !scaler->cols || !scaler->out) {
+        prev_scaler_free(scaler);
+        return -ENOMEM;
+    }
+    
+    memset(scaler->acc, 0, dst_w * 3 * sizeof(uint32_t));
+    memset(scaler->cols, 0, dst_w * sizeof(uint32_t));
+    
+    /* Count the source columns falling into each output column, with the
+       same walk as prev_scaler_row() */
+    for (int x = 0; x < src_w; x++) {
+        scaler->cols[dx]++;
+        err += dst_w;
+        if (err >= src_w) {
+            err -= src_w;
+            dx++;
+        }
+    }
+    
+    return 0;
+}
+
+static void prev_scaler_row(struct bench_prev_scaler *scaler, const uint8_t *row, int width)
+{
+    uint32_t *acc = scaler->acc;
+    int err = 0;
+    int dx = 0;
+    
+    if (scaler->dst_y >= scaler->dst_h || width != scaler->src_w) {
+        return;
+    }
+    
+    for (int x = 0; x < width; x++) {
+        acc[dx * 3] += row[0];
+        acc[dx * 3 + 1] += row[1];
+        acc[dx * 3 + 2] += row[2];
+        row += 3;
+        
+        err += scaler->dst_w;
+        if (err >= scaler->src_w) {
+            err -= scaler->src_w;
+            dx++;
+        }
+    }
+    scaler->rows++;
+    
+    scaler->y_err += scaler->dst_h;
+    if (scaler->y_err >= scaler->src_h) {
+        uint8_t *out = &scaler->out[scaler->dst_y * scaler->dst_w * 3];
+        
+        scaler->y_err -= scaler->src_h;
+        for (int x = 0; x < scaler->dst_w * 3; x++) {
+            uint32_t count = scaler->cols[x / 3] * scaler->rows;
+            
+            out[x] = (acc[x] + count / 2) / count;
+        }
+        
+        memset(acc, 0, scaler->dst_w * 3 * sizeof(uint32_t));
+        scaler->rows = 0;
+        scaler->dst_y++;
+    }
+}
+
+/* Downscale a synthetic picture to the terminal size, the way decoded rows
+ * are fed to it by gopher_render_image(), with the current scaler and with
+ * the one it replaced */
+static void bench_scale(const struct shell *shell, int iterations)
+{
+    struct bench_row *row = &bench_row;
+    int width = GOPHER_BENCH_SCALE_WIDTH;
+    int height = GOPHER_BENCH_SCALE_HEIGHT;
+    uint8_t *rows;
+    
+    /* Two rows, one per checkerboard phase, stand in for the whole picture */
+    rows = gopher_mem_alloc(GOPHER_MEM_BENCH, width * 3 * 2, GOPHER_MEM_HOT);
+    if (!rows) {
+        shell_error(shell, "No memory for the scaler rows");
+        return;
+    }
+    for (int y = 0; y < 2; y++) {
+        for (int x = 0; x < width; x++) {
+            bench_pixel(x, y * 16, width, height, &rows[(y * width + x) * 3]);
+        }
+    }
+    
+    row_begin(row, "scale.area");
+    for (int i = 0; i < iterations; i++) {
+        struct gopher_scaler scaler;
+        uint64_t start = bench_time_us();
+        
+        if (gopher_scaler_init(&scaler, width, height, 40, 30, NULL, NULL) < 0) {
+            shell_error(shell, "No memory for the scaler");
+            break;
+        }
+        for (int y = 0; y < height; y++) {
+            gopher_scaler_row(&scaler, y, &rows[((y / 16) & 1) * width * 3], width);
+        }
+        gopher_scaler_free(&scaler);
+        row_add(row, start, width * height * 3);
+    }
+    row_print(shell, row);
+    
+    row_begin(row, "scale.prev");
+    for (int i = 0; i < iterations; i++) {
+        struct bench_prev_scaler scaler;
+        uint64_t start = bench_time_us();
+        
+        if (prev_scaler_init(&scaler, width, height, 40, 30) < 0) {
+            shell_error(shell, "No memory for the scaler");
+            break;
+        }
+        for (int y = 0; y < height; y++) {
+            prev_scaler_row(&scaler, &rows[((y / 16) & 1) * width * 3], width);
+        }
+        prev_scaler_free(&scaler);
+        row_add(row, start, width * height * 3);
+    }
+    row_print(shell, row);
+    
+    gopher_mem_free(rows);
+}
+
+/* Written with results nothing else reads */
+static volatile uint32_t bench_sink;
+
+/* Match the pixels of a synthetic picture to the terminal palette */
+static void bench_palette(const struct shell *shell, int iterations)
+{
+    struct bench_row *row = &bench_row;
+    int width = GOPHER_BENCH_SCALE_WIDTH;
+    int height = GOPHER_BENCH_SCALE_HEIGHT;
+    uint32_t histogram[8] = { 0 };
+    
+    row_begin(row, "palette.map");
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = bench_time_us();
+        
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint8_t rgb[3];
+                
+                bench_pixel(x, y, width, height, rgb);
+                histogram[gopher_image_nearest_color(rgb[0], rgb[1], rgb[2]) & 7]++;
+            }
+        }
+        row_add(row, start, width * height * 3);
+    }
+    row_print(shell, row);
+    
+    /* A store the compiler has to keep, so the lookups the count depends
+       on cannot be optimised away */
+    bench_sink = histogram[0];
+}
+
+/* Print how much of a thread's stack has ever been used */
+static void print_stack(const struct shell *shell, const char *name, struct k_thread *thread)
+{
+    size_t unused;
+    
+    if (k_thread_stack_space_get(thread, &unused) == 0) {
+        shell_print(shell, "Stack %-12s %zu of %zu bytes used", name,
+                    thread->stack_info.size - unused, thread->stack_info.size);
+    }
+}
+
+int gopher_bench_run(const struct shell *shell, const char *suite, int iterations)
+{
+    bool all = (strcmp(suite, "all") == 0);
+    int ret;
+    
+    if (!all && strcmp(suite, "menu") != 0 && strcmp(suite, "text") != 0 &&
+        strcmp(suite, "image") != 0) {
+        shell_error(shell, "Unknown benchmark suite: %s (menu, text, image or all)", suite);
+        return -EINVAL;
+    }
+    if (iterations < 1 || iterations > GOPHER_BENCH_MAX_ITERATIONS) {
+        shell_error(shell, "Iterations must be between 1 and %d", GOPHER_BENCH_MAX_ITERATIONS);
+        return -EINVAL;
+    }
+    
+    ret = bench_corpus_init();
+    if (ret < 0) {
+        shell_error(shell, "Failed to generate the test images: %d", ret);
+        return ret;
+    }
+    
+    ret = bench_server_start();
+    if (ret < 0) {
+        shell_error(shell, "Failed to start the benchmark server: %d", ret);
+        return ret;
+    }
+    
+    gopher_client_init(&bench_client);
+    ret = gopher_connect(&bench_client, GOPHER_BENCH_HOST, GOPHER_BENCH_PORT);
+    if (ret < 0) {
+        shell_error(shell, "Failed to reach the benchmark server: %d", ret);
+        return ret;
+    }
+    
+    shell_print(shell, "Benchmarks against %s:%d, %d iterations",
+                GOPHER_BENCH_HOST, GOPHER_BENCH_PORT, iterations);
+    print_header(shell);
+    
+    if (all || strcmp(suite, "menu") == 0) {
+        bench_menu(shell, iterations);
+    }
+    if (all || strcmp(suite, "text") == 0) {
+        bench_text(shell, iterations);
+    }
+    if (all || strcmp(suite, "image") == 0) {
+        bench_scale(shell, iterations);
+        bench_palette(shell, iterations);
+        for (int i = 0; i < ARRAY_SIZE(bench_images); i++) {
+            bench_image(shell, &bench_images[i], iterations);
+        }
+    }
+    
+    print_stack(shell, "shell", k_current_get());
+    print_stack(shell, "server", &bench_server);
+    
+    gopher_disconnect(&bench_client);
+    
+    return 0;
+}
+
+#endif /* CONFIG_GOPHER_BENCH */
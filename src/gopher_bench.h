@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_BENCH_H_
+#define GOPHER_BENCH_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+/* Address and port of the built-in benchmark server */
+#define GOPHER_BENCH_HOST "127.0.0.1"
+#define GOPHER_BENCH_PORT 7070
+
+/* Iterations per benchmark unless given on the command line */
+#define GOPHER_BENCH_ITERATIONS 10
+
+/* Upper bound of iterations, every latency is kept for the percentiles */
+#define GOPHER_BENCH_MAX_ITERATIONS 100
+
+/* Stack size and priority of the benchmark server */
+#define GOPHER_BENCH_SERVER_STACK_SIZE 4096
+#define GOPHER_BENCH_SERVER_PRIORITY K_PRIO_PREEMPT(8)
+
+/* Synthetic corpus: menu length, text size and test image dimensions */
+#define GOPHER_BENCH_MENU_ITEMS 250
+#define GOPHER_BENCH_TEXT_KB 256
+#define GOPHER_BENCH_IMAGE_WIDTH 160
+#define GOPHER_BENCH_IMAGE_HEIGHT 120
+#define GOPHER_BENCH_JPEG_WIDTH 320
+#define GOPHER_BENCH_JPEG_HEIGHT 240
+
+/* Downscaler benchmark: a 4000x3000 photo after 1/8 JPEG reduction */
+#define GOPHER_BENCH_SCALE_WIDTH 500
+#define GOPHER_BENCH_SCALE_HEIGHT 375
+
+/**
+ * @brief Run benchmarks against the built-in loopback server
+ *
+ * The server is started on first use and serves synthetic menus, text and
+ * PNG, GIF and JPEG images generated at startup. Each benchmark reports
+ * latency percentiles, throughput and the peak system heap use, followed by
+ * the stack high-water marks of the threads involved. The image suite also
+ * times the downscaler on its own. Runs on the calling
+ * thread; the fetch engine should be idle.
+ *
+ * @param shell Shell to print the results on
+ * @param suite "menu", "text", "image" or "all"
+ * @param iterations Iterations per benchmark (1 to GOPHER_BENCH_MAX_ITERATIONS)
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_bench_run(const struct shell *shell, const char *suite, int iterations);
+
+#endif /* GOPHER_BENCH_H_ */
@@ -0,0 +1,579 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/sys/sys_heap.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+#include <errno.h>
+#include "gopher_cache.h"
+#include "gopher_cache_fs.h"
+#include "gopher_mem.h"
+
+LOG_MODULE_REGISTER(gopher_cache, LOG_LEVEL_ERR);
+
+/* Start size of a document block, grown by doubling */
+#define CACHE_WRITER_INITIAL_SIZE 2048
+
+/* A cache block holds the key strings followed by the response */
+struct cache_block {
+    uint16_t key_len;           /* hostname\0selector\0, padded to 4 bytes */
+    char key[];
+};
+
+/* Parsed form of a menu, followed by hosts[], entries[] and the arena */
+struct cache_menu {
+    uint16_t item_count;
+    uint16_t arena_used;
+    uint8_t host_count;
+};
+
+struct cache_slot {
+    struct cache_block *block;  /* NULL if the slot is free */
+    uint32_t hash;              /* Selector hash */
+    uint16_t port;
+    uint8_t kind;
+    size_t size;                /* Bytes of the block */
+    int64_t fetched_at;
+    int64_t last_used;
+};
+
+static struct cache_slot cache_slots[GOPHER_CACHE_MAX_ENTRIES];
+static struct gopher_cache_stats cache_stats;
+static struct sys_heap cache_heap;
+static void *cache_mem;
+static K_MUTEX_DEFINE(cache_lock);
+
+/* Hash a selector (32-bit FNV-1a) */
+uint32_t gopher_cache_hash(const char *selector)
+{
+    uint32_t hash = 2166136261u;
+    
+    if (selector == NULL) {
+        selector = "";
+    }
+    
+    while (*selector != '\0') {
+        hash ^= (uint8_t)*selector++;
+        hash *= 16777619u;
+    }
+    
+    return hash;
+}
+
+/* Set up the cache heap on first use. Must be called with cache_lock held. */
+static bool cache_ready(void)
+{
+    if (cache_mem != NULL) {
+        return true;
+    }
+    
+    /* Responses are copied in and out whole, PSRAM is good enough */
+    cache_mem = gopher_mem_alloc(GOPHER_MEM_CACHE, GOPHER_CACHE_SIZE, GOPHER_MEM_BULK);
+    if (cache_mem == NULL) {
+        LOG_ERR("No memory for the response cache");
+        return false;
+    }
+    
+    sys_heap_init(&cache_heap, cache_mem, GOPHER_CACHE_SIZE);
+    cache_stats.size = GOPHER_CACHE_SIZE;
+    
+    return true;
+}
+
+static void slot_free(struct cache_slot *slot)
+{
+    sys_heap_free(&cache_heap, slot->block);
+    cache_stats.used -= slot->size;
+    cache_stats.entries--;
+    slot->block = NULL;
+}
+
+/* Drop the least recently used entry. Returns false if the cache is empty. */
+static bool evict_lru(void)
+{
+    struct cache_slot *oldest = NULL;
+    
+    for (int i = 0; i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+        if (cache_slots[i].block != NULL &&
+            (oldest == NULL || cache_slots[i].last_used < oldest->last_used)) {
+            oldest = &cache_slots[i];
+        }
+    }
+    
+    if (oldest == NULL) {
+        return false;
+    }
+    
+    slot_free(oldest);
+    cache_stats.evictions++;
+    return true;
+}
+
+/* Allocate from the cache heap, evicting entries until the block fits */
+static void *cache_alloc(size_t size)
+{
+    void *mem;
+    
+    while ((mem = sys_heap_alloc(&cache_heap, size)) == NULL) {
+        if (!evict_lru()) {
+            return NULL;
+        }
+    }
+    
+    return mem;
+}
+
+static size_t key_size(const char *hostname, const char *selector)
+{
+    return ROUND_UP(strlen(hostname) + strlen(selector) + 2, 4);
+}
+
+/* Write the key of a block, returning the offset of the response data */
+static size_t block_init(struct cache_block *block, const char *hostname,
+                         const char *selector)
+{
+    size_t host_len = strlen(hostname) + 1;
+    
+    block->key_len = key_size(hostname, selector);
+    memcpy(block->key, hostname, host_len);
+    strcpy(block->key + host_len, selector);
+    
+    return sizeof(*block) + block->key_len;
+}
+
+static void *block_data(struct cache_block *block)
+{
+    return (uint8_t *)block + sizeof(*block) + block->key_len;
+}
+
+/* Find the entry for a response. Must be called with cache_lock held. */
+static struct cache_slot *slot_find(const char *hostname, uint16_t port,
+                                    const char *selector, uint32_t hash)
+{
+    for (int i = 0; i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+        struct cache_slot *slot = &cache_slots[i];
+        
+        if (slot->block == NULL || slot->hash != hash || slot->port != port) {
+            continue;
+        }
+        
+        const char *key = slot->block->key;
+        if (strcmp(key, hostname) == 0 && strcmp(key + strlen(key) + 1, selector) == 0) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+/* Add a filled block to the cache, replacing an older copy of the response.
+ * Must be called with cache_lock held. */
+static struct cache_slot *slot_insert(struct cache_block *block, size_t size, uint16_t port, uint8_t kind)
+{
+    const char *hostname = block->key;
+    const char *selector = hostname + strlen(hostname) + 1;
+    uint32_t hash = gopher_cache_hash(selector);
+    struct cache_slot *slot = slot_find(hostname, port, selector, hash);
+    
+    if (slot != NULL) {
+        slot_free(slot);
+    }
+    
+    for (int i = 0; slot == NULL && i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+        if (cache_slots[i].block == NULL) {
+            slot = &cache_slots[i];
+        }
+    }
+    
+    if (slot == NULL) {
+        /* Every slot is in use, the least recently used one goes */
+        evict_lru();
+        for (int i = 0; slot == NULL && i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+            if (cache_slots[i].block == NULL) {
+                slot = &cache_slots[i];
+            }
+        }
+    }
+    
+    slot->block = block;
+    slot->hash = hash;
+    slot->port = port;
+    slot->kind = kind;
+    slot->size = size;
+    slot->fetched_at = k_uptime_get();
+    slot->last_used = slot->fetched_at;
+    
+    cache_stats.used += size;
+    cache_stats.entries++;
+    
+    return slot;
+}
+
+/* Write a newly cached response through to the persistent cache */
+static void slot_persist(const struct cache_slot *slot)
+{
+    const char *hostname = slot->block->key;
+    const uint8_t *data = block_data(slot->block);
+    
+    gopher_fs_cache_store(hostname, slot->port, hostname + strlen(hostname) + 1, slot->kind,
+                          data, slot->size - (data - (const uint8_t *)slot->block));
+}
+
+/* Bring a persisted response into the RAM cache. Must be called with
+ * cache_lock held. Returns NULL if there is no usable copy. */
+static struct cache_slot *slot_load(const char *hostname, uint16_t port,
+                                    const char *selector, bool offline)
+{
+    struct gopher_fs_cache_info info;
+    struct cache_block *block;
+    struct cache_slot *slot;
+    size_t size;
+    
+    if (gopher_fs_cache_find(hostname, port, selector, &info) != 0 ||
+        (!offline && info.age_ms > GOPHER_CACHE_TTL_MS)) {
+        return NULL;
+    }
+    
+    size = sizeof(*block) + key_size(hostname, selector) + info.size;
+    if (size > GOPHER_CACHE_MAX_ENTRY_SIZE || !cache_ready() ||
+        (block = cache_alloc(size)) == NULL) {
+        return NULL;
+    }
+    
+    block_init(block, hostname, selector);
+    if (gopher_fs_cache_read(hostname, port, selector, block_data(block), info.size) != 0) {
+        sys_heap_free(&cache_heap, block);
+        return NULL;
+    }
+    
+    slot = slot_insert(block, size, port, info.kind);
+    slot->fetched_at -= info.age_ms;
+    cache_stats.fs_hits++;
+    
+    return slot;
+}
+
+/* Restore a cached menu into the client's listing */
+static void menu_restore(struct gopher_client *client, struct cache_block *block)
+{
+    const struct cache_menu *cm = block_data(block);
+    const uint8_t *p = (const uint8_t *)(cm + 1);
+    struct gopher_menu *menu = &client->menu;
+    
+    memcpy(menu->hosts, p, cm->host_count * sizeof(menu->hosts[0]));
+    p += cm->host_count * sizeof(menu->hosts[0]);
+    memcpy(menu->entries, p, cm->item_count * sizeof(menu->entries[0]));
+    p += cm->item_count * sizeof(menu->entries[0]);
+    memcpy(menu->arena, p, cm->arena_used);
+    
+    menu->host_count = cm->host_count;
+    menu->arena_used = cm->arena_used;
+    menu->truncated = false;
+    client->item_count = cm->item_count;
+}
+
+/* Look up a response for the client's current server */
+int gopher_cache_lookup(struct gopher_client *client, const char *selector, bool offline,
+                        gopher_sink_t sink, void *user_data)
+{
+    struct cache_slot *slot;
+    int64_t now = k_uptime_get();
+    int ret;
+    
+    if (client == NULL) {
+        return -EINVAL;
+    }
+    
+    if (selector == NULL) {
+        selector = "";
+    }
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    slot = slot_find(client->hostname, client->port, selector, gopher_cache_hash(selector));
+    if (slot != NULL && !offline && now - slot->fetched_at > GOPHER_CACHE_TTL_MS) {
+        /* Too old to be trusted, fetch it again */
+        slot_free(slot);
+        slot = NULL;
+    }
+    
+    if (slot == NULL) {
+        slot = slot_load(client->hostname, client->port, selector, offline);
+    }
+    
+    if (slot == NULL || (slot->kind == GOPHER_CACHE_DOCUMENT && sink == NULL)) {
+        cache_stats.misses++;
+        k_mutex_unlock(&cache_lock);
+        return -ENOENT;
+    }
+    
+    slot->last_used = now;
+    cache_stats.hits++;
+    ret = slot->kind;
+    
+    if (slot->kind == GOPHER_CACHE_MENU) {
+        menu_restore(client, slot->block);
+    } else {
+        /* Replay in receive-sized chunks, the sink sees no difference */
+        const uint8_t *data = block_data(slot->block);
+        size_t len = slot->size - (data - (const uint8_t *)slot->block);
+        
+        for (size_t off = 0; off < len; off += GOPHER_RECV_CHUNK_SIZE) {
+            int err = sink(data + off, MIN(len - off, GOPHER_RECV_CHUNK_SIZE), user_data);
+            if (err != 0) {
+                ret = (err < 0) ? err : ret;
+                break;
+            }
+        }
+    }
+    
+    k_mutex_unlock(&cache_lock);
+    
+    return ret;
+}
+
+/* Check whether a fresh response is cached, without using it */
+bool gopher_cache_contains(const char *hostname, uint16_t port, const char *selector)
+{
+    struct cache_slot *slot;
+    bool found;
+    
+    if (selector == NULL) {
+        selector = "";
+    }
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    slot = slot_find(hostname, port, selector, gopher_cache_hash(selector));
+    found = (slot != NULL && k_uptime_get() - slot->fetched_at <= GOPHER_CACHE_TTL_MS);
+    k_mutex_unlock(&cache_lock);
+    
+    return found;
+}
+
+/* Store the client's current listing as the response to a selector */
+int gopher_cache_store_menu(const struct gopher_client *client, const char *selector)
+{
+    const struct gopher_menu *menu;
+    struct cache_block *block;
+    struct cache_menu *cm;
+    size_t hosts_size, entries_size, size;
+    uint8_t *p;
+    
+    if (client == NULL || client->item_count == 0) {
+        return -EINVAL;
+    }
+    
+    if (selector == NULL) {
+        selector = "";
+    }
+    
+    menu = &client->menu;
+    hosts_size = menu->host_count * sizeof(menu->hosts[0]);
+    entries_size = client->item_count * sizeof(menu->entries[0]);
+    
+    /* Only the used part of the listing is kept */
+    size = sizeof(*block) + key_size(client->hostname, selector) +
+           sizeof(*cm) + hosts_size + entries_size + menu->arena_used;
+    if (size > GOPHER_CACHE_MAX_ENTRY_SIZE) {
+        return -ENOMEM;
+    }
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    if (!cache_ready() || (block = cache_alloc(size)) == NULL) {
+        k_mutex_unlock(&cache_lock);
+        return -ENOMEM;
+    }
+    
+    cm = (struct cache_menu *)((uint8_t *)block + block_init(block, client->hostname, selector));
+    cm->item_count = client->item_count;
+    cm->arena_used = menu->arena_used;
+    cm->host_count = menu->host_count;
+    
+    p = (uint8_t *)(cm + 1);
+    memcpy(p, menu->hosts, hosts_size);
+    p += hosts_size;
+    memcpy(p, menu->entries, entries_size);
+    p += entries_size;
+    memcpy(p, menu->arena, menu->arena_used);
+    
+    slot_persist(slot_insert(block, size, client->port, GOPHER_CACHE_MENU));
+    
+    k_mutex_unlock(&cache_lock);
+    
+    return 0;
+}
+
+/* Start collecting a document for the cache */
+int gopher_cache_writer_begin(struct gopher_cache_writer *writer,
+                              const struct gopher_client *client, const char *selector)
+{
+    size_t size;
+    
+    if (writer == NULL || client == NULL) {
+        return -EINVAL;
+    }
+    
+    if (selector == NULL) {
+        selector = "";
+    }
+    
+    writer->block = NULL;
+    writer->len = 0;
+    writer->capacity = 0;
+    
+    size = sizeof(struct cache_block) + key_size(client->hostname, selector);
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    if (cache_ready()) {
+        writer->capacity = MAX(size, CACHE_WRITER_INITIAL_SIZE);
+        writer->block = cache_alloc(writer->capacity);
+    }
+    
+    if (writer->block == NULL) {
+        k_mutex_unlock(&cache_lock);
+        return -ENOMEM;
+    }
+    
+    writer->len = block_init(writer->block, client->hostname, selector);
+    writer->port = client->port;
+    
+    k_mutex_unlock(&cache_lock);
+    
+    return 0;
+}
+
+/* Append received data to a document being collected */
+void gopher_cache_writer_append(struct gopher_cache_writer *writer,
+                                const uint8_t *data, size_t len)
+{
+    if (writer == NULL || writer->block == NULL) {
+        return;
+    }
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    if (writer->len + len > writer->capacity) {
+        size_t capacity = writer->capacity;
+        void *block;
+        
+        while (capacity < writer->len + len) {
+            capacity *= 2;
+        }
+        capacity = MIN(capacity, GOPHER_CACHE_MAX_ENTRY_SIZE);
+        
+        /* Too large for the cache, the document is still displayed */
+        if (capacity < writer->len + len) {
+            sys_heap_free(&cache_heap, writer->block);
+            writer->block = NULL;
+            k_mutex_unlock(&cache_lock);
+            return;
+        }
+        
+        while ((block = sys_heap_realloc(&cache_heap, writer->block, capacity)) == NULL) {
+            if (!evict_lru()) {
+                break;
+            }
+        }
+        
+        if (block == NULL) {
+            sys_heap_free(&cache_heap, writer->block);
+            writer->block = NULL;
+            k_mutex_unlock(&cache_lock);
+            return;
+        }
+        
+        writer->block = block;
+        writer->capacity = capacity;
+    }
+    
+    memcpy((uint8_t *)writer->block + writer->len, data, len);
+    writer->len += len;
+    
+    k_mutex_unlock(&cache_lock);
+}
+
+/* Finish a document, adding it to the cache or discarding it */
+int gopher_cache_writer_end(struct gopher_cache_writer *writer, bool commit)
+{
+    struct cache_block *block;
+    
+    if (writer == NULL || writer->block == NULL) {
+        return -ENOMEM;
+    }
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    block = writer->block;
+    writer->block = NULL;
+    
+    if (!commit) {
+        sys_heap_free(&cache_heap, block);
+        k_mutex_unlock(&cache_lock);
+        return -ECANCELED;
+    }
+    
+    /* Give back the unused tail of the block */
+    if (writer->len < writer->capacity) {
+        struct cache_block *shrunk = sys_heap_realloc(&cache_heap, block, writer->len);
+        if (shrunk != NULL) {
+            block = shrunk;
+        }
+    }
+    
+    slot_persist(slot_insert(block, writer->len, writer->port, GOPHER_CACHE_DOCUMENT));
+    
+    k_mutex_unlock(&cache_lock);
+    
+    return 0;
+}
+
+/* Drop all cached responses */
+void gopher_cache_flush(void)
+{
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    gopher_fs_cache_flush();
+    
+    for (int i = 0; i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+        if (cache_slots[i].block != NULL) {
+            slot_free(&cache_slots[i]);
+        }
+    }
+    
+    k_mutex_unlock(&cache_lock);
+}
+
+/* Read the cache counters */
+void gopher_cache_get_stats(struct gopher_cache_stats *stats)
+{
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    *stats = cache_stats;
+    k_mutex_unlock(&cache_lock);
+}
+
+/* Iterate over cached responses */
+void gopher_cache_foreach(gopher_cache_entry_cb_t cb, void *user_data)
+{
+    int64_t now = k_uptime_get();
+    
+    k_mutex_lock(&cache_lock, K_FOREVER);
+    
+    for (int i = 0; i < GOPHER_CACHE_MAX_ENTRIES; i++) {
+        const struct cache_slot *slot = &cache_slots[i];
+        
+        if (slot->block == NULL) {
+            continue;
+        }
+        
+        const char *hostname = slot->block->key;
+        cb(hostname, slot->port, hostname + strlen(hostname) + 1, slot->kind,
+           slot->size, now - slot->fetched_at, user_data);
+    }
+    
+    k_mutex_unlock(&cache_lock);
+}
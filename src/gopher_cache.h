@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_CACHE_H_
+#define GOPHER_CACHE_H_
+
+#include <zephyr/kernel.h>
+#include "gopher_client.h"
+
+/* Byte budget of the response cache, taken from PSRAM when available */
+#ifdef CONFIG_ESP_SPIRAM
+#define GOPHER_CACHE_SIZE (512 * 1024)
+#else
+#define GOPHER_CACHE_SIZE (24 * 1024)
+#endif
+
+/* Largest single response kept in the cache */
+#define GOPHER_CACHE_MAX_ENTRY_SIZE (GOPHER_CACHE_SIZE / 4)
+
+/* Maximum number of cached responses */
+#define GOPHER_CACHE_MAX_ENTRIES 32
+
+/* Cached responses older than this are fetched again */
+#define GOPHER_CACHE_TTL_MS (15 * 60 * 1000)
+
+/* Kind of a cached response */
+enum gopher_cache_kind {
+    GOPHER_CACHE_NONE = 0,
+    GOPHER_CACHE_MENU,          /* Parsed directory listing */
+    GOPHER_CACHE_DOCUMENT,      /* Raw response bytes */
+};
+
+/* Cache counters, as reported by 'gopher cache' */
+struct gopher_cache_stats {
+    uint32_t hits;
+    uint32_t fs_hits;           /* Hits loaded from the persistent cache */
+    uint32_t misses;
+    uint32_t evictions;
+    uint16_t entries;
+    size_t used;                /* Bytes held by cached responses */
+    size_t size;                /* Byte budget, 0 until first use */
+};
+
+/* Collects a streamed document for the cache */
+struct gopher_cache_writer {
+    void *block;                /* Cache block being filled, NULL if given up */
+    size_t len;                 /* Bytes used in the block, key included */
+    size_t capacity;
+    uint16_t port;
+};
+
+/**
+ * @brief Callback invoked for each cached response
+ *
+ * @param hostname Server hostname
+ * @param port Server port
+ * @param selector Selector of the response
+ * @param kind GOPHER_CACHE_MENU or GOPHER_CACHE_DOCUMENT
+ * @param size Bytes used by the entry
+ * @param age_ms Time since the response was fetched
+ * @param user_data Opaque pointer passed to gopher_cache_foreach()
+ */
+typedef void (*gopher_cache_entry_cb_t)(const char *hostname, uint16_t port,
+                                        const char *selector, enum gopher_cache_kind kind,
+                                        size_t size, int64_t age_ms, void *user_data);
+
+/**
+ * @brief Hash a selector for cache lookups (32-bit FNV-1a)
+ *
+ * @param selector Selector string (NULL for the root)
+ * @return Hash of the selector
+ */
+uint32_t gopher_cache_hash(const char *selector);
+
+/**
+ * @brief Look up a response for the client's current server
+ *
+ * A cached menu is restored into the client's listing, so neither the
+ * network nor the parser is involved. A cached document is replayed
+ * through the sink in GOPHER_RECV_CHUNK_SIZE chunks, as gopher_fetch()
+ * would deliver it. Responses missing from RAM are looked up in the
+ * persistent cache, when there is one.
+ *
+ * @param client Pointer to the client structure
+ * @param selector Selector string (NULL for the root)
+ * @param offline Accept copies older than GOPHER_CACHE_TTL_MS, for when
+ *                the server cannot be reached
+ * @param sink Callback receiving a cached document (may be NULL)
+ * @param user_data Opaque pointer passed to the sink
+ * @return GOPHER_CACHE_MENU or GOPHER_CACHE_DOCUMENT on a hit,
+ *         -ENOENT on a miss, negative errno returned by the sink
+ */
+int gopher_cache_lookup(struct gopher_client *client, const char *selector, bool offline,
+                        gopher_sink_t sink, void *user_data);
+
+/**
+ * @brief Check whether a fresh response is cached, without using it
+ *
+ * Only the RAM cache is checked, and the hit/miss counters are not updated.
+ *
+ * @param hostname Server hostname
+ * @param port Server port
+ * @param selector Selector string (NULL for the root)
+ * @return true if the response is cached and younger than GOPHER_CACHE_TTL_MS
+ */
+bool gopher_cache_contains(const char *hostname, uint16_t port, const char *selector);
+
+/**
+ * @brief Store the client's current listing as the response to a selector
+ *
+ * @param client Pointer to the client structure
+ * @param selector Selector string (NULL for the root)
+ * @return 0 on success, -ENOMEM if the listing does not fit the cache
+ */
+int gopher_cache_store_menu(const struct gopher_client *client, const char *selector);
+
+/**
+ * @brief Start collecting a document for the cache
+ *
+ * @param writer Writer state
+ * @param client Pointer to the client structure, giving the server
+ * @param selector Selector string (NULL for the root)
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_cache_writer_begin(struct gopher_cache_writer *writer,
+                              const struct gopher_client *client, const char *selector);
+
+/**
+ * @brief Append received data to a document being collected
+ *
+ * Documents growing past GOPHER_CACHE_MAX_ENTRY_SIZE are given up silently.
+ *
+ * @param writer Writer state
+ * @param data Received bytes
+ * @param len Number of bytes in data
+ */
+void gopher_cache_writer_append(struct gopher_cache_writer *writer,
+                                const uint8_t *data, size_t len);
+
+/**
+ * @brief Finish a document, adding it to the cache or discarding it
+ *
+ * @param writer Writer state
+ * @param commit true to add the document, false to discard it
+ * @return 0 if the document was added, negative errno otherwise
+ */
+int gopher_cache_writer_end(struct gopher_cache_writer *writer, bool commit);
+
+/**
+ * @brief Drop all cached responses, persisted ones included
+ */
+void gopher_cache_flush(void);
+
+/**
+ * @brief Read the cache counters
+ *
+ * @param stats Filled with the current counters
+ */
+void gopher_cache_get_stats(struct gopher_cache_stats *stats);
+
+/**
+ * @brief Iterate over cached responses
+ *
+ * @param cb Callback invoked for each entry
+ * @param user_data Opaque pointer passed to the callback
+ */
+void gopher_cache_foreach(gopher_cache_entry_cb_t cb, void *user_data);
+
+#endif /* GOPHER_CACHE_H_ */
@@ -0,0 +1,519 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "gopher_cache.h"
+#include "gopher_cache_fs.h"
+
+LOG_MODULE_REGISTER(gopher_cache_fs, LOG_LEVEL_ERR);
+
+#ifdef CONFIG_FILE_SYSTEM_LITTLEFS
+
+#include <zephyr/fs/fs.h>
+#include <zephyr/fs/littlefs.h>
+#include <zephyr/storage/flash_map.h>
+
+/* Longest record path: directory, 8 hex digits and a suffix */
+#define FS_CACHE_PATH_LEN (sizeof(GOPHER_FS_CACHE_DIR) + 16)
+
+/* File holding the device clock, in seconds */
+#define FS_CACHE_CLOCK_FILE GOPHER_FS_CACHE_DIR "/clock"
+
+FS_LITTLEFS_DECLARE_DEFAULT_CONFIG(fs_cache_storage);
+
+static struct fs_mount_t fs_cache_mnt = {
+    .type = FS_LITTLEFS,
+    .fs_data = &fs_cache_storage,
+    .storage_dev = (void *)FIXED_PARTITION_ID(storage_partition),
+    .mnt_point = GOPHER_FS_CACHE_MNT,
+};
+
+/* What is known about each record file, loaded when the partition is mounted */
+struct fs_cache_entry {
+    uint32_t key;               /* File name, 0 if the slot is free */
+    uint32_t size;              /* Bytes of the file */
+    uint32_t fetched_at;
+};
+
+static struct fs_cache_entry fs_cache_index[GOPHER_FS_CACHE_MAX_ENTRIES];
+static uint32_t fs_clock_base;
+static uint32_t fs_clock_saved;       /* Device time last written to the clock file */
+static int fs_cache_state = -EAGAIN;  /* 0 once mounted, negative errno on failure */
+static K_MUTEX_DEFINE(fs_cache_lock);
+
+/* Hash identifying a response across servers, used as its file name */
+static uint32_t record_key(const char *hostname, uint16_t port, const char *selector)
+{
+    char prefix[GOPHER_MAX_HOSTNAME_LEN + 8];
+    uint32_t hash;
+    
+    snprintf(prefix, sizeof(prefix), "%s:%u:", hostname, port);
+    hash = gopher_cache_hash(prefix);
+    
+    /* Continue the FNV-1a hash over the selector */
+    while (*selector != '\0') {
+        hash ^= (uint8_t)*selector++;
+        hash *= 16777619u;
+    }
+    
+    /* 0 marks a free index slot */
+    return hash ? hash : 1;
+}
+
+static void record_path(char *path, uint32_t key)
+{
+    snprintf(path, FS_CACHE_PATH_LEN, GOPHER_FS_CACHE_DIR "/%08x", key);
+}
+
+/* Device seconds: uptime accumulated over all boots */
+static uint32_t device_time(void)
+{
+    return fs_clock_base + (uint32_t)(k_uptime_get() / 1000);
+}
+
+/* Save the clock once it has moved on far enough, not on every store, to
+ * spare the flash */
+static void save_device_time(void)
+{
+    struct fs_file_t file;
+    uint32_t now = device_time();
+    
+    if (now - fs_clock_saved < GOPHER_FS_CACHE_CLOCK_SAVE_S) {
+        return;
+    }
+    fs_clock_saved = now;
+    
+    fs_file_t_init(&file);
+    if (fs_open(&file, FS_CACHE_CLOCK_FILE, FS_O_CREATE | FS_O_WRITE) == 0) {
+        fs_write(&file, &now, sizeof(now));
+        fs_close(&file);
+    }
+}
+
+/* Read and check a record header. Returns 0 if the file is a valid record. */
+static int read_header(struct fs_file_t *file, struct gopher_fs_record *rec)
+{
+    ssize_t ret = fs_read(file, rec, sizeof(*rec));
+    
+    if (ret != sizeof(*rec)) {
+        return (ret < 0) ? (int)ret : -EIO;
+    }
+    
+    if (rec->magic != GOPHER_FS_CACHE_MAGIC || rec->version != GOPHER_FS_CACHE_VERSION) {
+        return -EBADMSG;
+    }
+    
+    return 0;
+}
+
+/* Build the index from the record files on the partition */
+static void load_index(void)
+{
+    struct fs_dir_t dir;
+    struct fs_dirent entry;
+    char path[FS_CACHE_PATH_LEN];
+    int count = 0;
+    
+    fs_dir_t_init(&dir);
+    if (fs_opendir(&dir, GOPHER_FS_CACHE_DIR) != 0) {
+        return;
+    }
+    
+    while (fs_readdir(&dir, &entry) == 0 && entry.name[0] != '\0') {
+        struct gopher_fs_record rec;
+        struct fs_file_t file;
+        char *end;
+        uint32_t key = strtoul(entry.name, &end, 16);
+        
+        if (entry.type != FS_DIR_ENTRY_FILE || key == 0 || (*end != '\0' && *end != '.')) {
+            continue;
+        }
+        
+        snprintf(path, sizeof(path), GOPHER_FS_CACHE_DIR "/%s", entry.name);
+        
+        /* Left behind by a store that was interrupted */
+        if (*end == '.') {
+            fs_unlink(path);
+            continue;
+        }
+        
+        fs_file_t_init(&file);
+        if (fs_open(&file, path, FS_O_READ) != 0) {
+            continue;
+        }
+        
+        int ret = read_header(&file, &rec);
+        fs_close(&file);
+        
+        /* Stale or foreign files only waste space */
+        if (ret != 0 || count == GOPHER_FS_CACHE_MAX_ENTRIES) {
+            fs_unlink(path);
+            continue;
+        }
+        
+        fs_cache_index[count].key = key;
+        fs_cache_index[count].size = entry.size;
+        fs_cache_index[count].fetched_at = rec.fetched_at;
+        count++;
+    }
+    
+    fs_closedir(&dir);
+    
+    LOG_INF("Persistent cache holds %d responses", count);
+}
+
+/* Mount the partition on first use. Must be called with fs_cache_lock held. */
+static int fs_cache_ready(void)
+{
+    struct fs_file_t file;
+    struct fs_dirent entry;
+    int ret;
+    
+    if (fs_cache_state != -EAGAIN) {
+        return fs_cache_state;
+    }
+    
+    ret = fs_mount(&fs_cache_mnt);
+    if (ret != 0 && ret != -EBUSY) {
+        LOG_ERR("Failed to mount %s: %d", GOPHER_FS_CACHE_MNT, ret);
+        fs_cache_state = ret;
+        return ret;
+    }
+    
+    if (fs_stat(GOPHER_FS_CACHE_DIR, &entry) != 0) {
+        fs_mkdir(GOPHER_FS_CACHE_DIR);
+    }
+    
+    fs_file_t_init(&file);
+    if (fs_open(&file, FS_CACHE_CLOCK_FILE, FS_O_READ) == 0) {
+        if (fs_read(&file, &fs_clock_base, sizeof(fs_clock_base)) != sizeof(fs_clock_base)) {
+            fs_clock_base = 0;
+        }
+        fs_close(&file);
+    }
+    
+    load_index();
+    
+    /* Records stored since the clock was last saved are newer than it */
+    for (int i = 0; i < GOPHER_FS_CACHE_MAX_ENTRIES; i++) {
+        if (fs_cache_index[i].key != 0) {
+            fs_clock_base = MAX(fs_clock_base, fs_cache_index[i].fetched_at);
+        }
+    }
+    fs_clock_saved = device_time();
+    
+    fs_cache_state = 0;
+    return 0;
+}
+
+static struct fs_cache_entry *index_find(uint32_t key)
+{
+    for (int i = 0; i < GOPHER_FS_CACHE_MAX_ENTRIES; i++) {
+        if (fs_cache_index[i].key == key) {
+            return &fs_cache_index[i];
+        }
+    }
+    
+    return NULL;
+}
+
+static void index_remove(struct fs_cache_entry *entry)
+{
+    char path[FS_CACHE_PATH_LEN];
+    
+    record_path(path, entry->key);
+    fs_unlink(path);
+    entry->key = 0;
+}
+
+/* Open a record and check that it is the requested response. On success
+ * the file is positioned at the response data. */
+static int open_record(struct fs_file_t *file, const char *hostname, uint16_t port,
+                       const char *selector, struct gopher_fs_record *rec)
+{
+    char path[FS_CACHE_PATH_LEN];
+    char name[GOPHER_MAX_SELECTOR_LEN];
+    uint32_t key = record_key(hostname, port, selector);
+    int ret;
+    
+    if (index_find(key) == NULL) {
+        return -ENOENT;
+    }
+    
+    record_path(path, key);
+    fs_file_t_init(file);
+    ret = fs_open(file, path, FS_O_READ);
+    if (ret != 0) {
+        return ret;
+    }
+    
+    ret = read_header(file, rec);
+    
+    /* A different response with the same hash is a miss */
+    if (ret == 0 && (rec->port != port || rec->host_len != strlen(hostname) ||
+                     rec->selector_len != strlen(selector) ||
+                     rec->selector_hash != gopher_cache_hash(selector))) {
+        ret = -ENOENT;
+    }
+    
+    if (ret == 0 && (fs_read(file, name, rec->host_len) != rec->host_len ||
+                     memcmp(name, hostname, rec->host_len) != 0)) {
+        ret = -ENOENT;
+    }
+    
+    if (ret == 0 && (rec->selector_len > sizeof(name) ||
+                     fs_read(file, name, rec->selector_len) != rec->selector_len ||
+                     memcmp(name, selector, rec->selector_len) != 0)) {
+        ret = -ENOENT;
+    }
+    
+    if (ret != 0) {
+        fs_close(file);
+    }
+    
+    return ret;
+}
+
+int gopher_fs_cache_find(const char *hostname, uint16_t port, const char *selector,
+                         struct gopher_fs_cache_info *info)
+{
+    struct fs_file_t file;
+    struct gopher_fs_record rec;
+    int ret;
+    
+    k_mutex_lock(&fs_cache_lock, K_FOREVER);
+    
+    ret = fs_cache_ready();
+    if (ret == 0) {
+        ret = open_record(&file, hostname, port, selector, &rec);
+    }
+    
+    if (ret == 0) {
+        fs_close(&file);
+        info->kind = rec.kind;
+        info->size = rec.size;
+        info->age_ms = (int64_t)(device_time() - rec.fetched_at) * 1000;
+    }
+    
+    k_mutex_unlock(&fs_cache_lock);
+    
+    return ret;
+}
+
+int gopher_fs_cache_read(const char *hostname, uint16_t port, const char *selector,
+                         void *buf, size_t len)
+{
+    struct fs_file_t file;
+    struct gopher_fs_record rec;
+    int ret;
+    
+    k_mutex_lock(&fs_cache_lock, K_FOREVER);
+    
+    ret = fs_cache_ready();
+    if (ret == 0) {
+        ret = open_record(&file, hostname, port, selector, &rec);
+    }
+    
+    if (ret == 0) {
+        if (rec.size != len || fs_read(&file, buf, len) != (ssize_t)len) {
+            ret = -EIO;
+        }
+        fs_close(&file);
+    }
+    
+    k_mutex_unlock(&fs_cache_lock);
+    
+    return ret;
+}
+
+/* Delete the oldest records until a record of the given size fits */
+static void make_room(size_t size)
+{
+    while (true) {
+        struct fs_cache_entry *oldest = NULL;
+        size_t used = 0;
+        int count = 0;
+        
+        for (int i = 0; i < GOPHER_FS_CACHE_MAX_ENTRIES; i++) {
+            struct fs_cache_entry *entry = &fs_cache_index[i];
+            
+            if (entry->key == 0) {
+                continue;
+            }
+            
+            used += entry->size;
+            count++;
+            if (oldest == NULL || entry->fetched_at < oldest->fetched_at) {
+                oldest = entry;
+            }
+        }
+        
+        if (oldest == NULL ||
+            (used + size <= GOPHER_FS_CACHE_SIZE && count < GOPHER_FS_CACHE_MAX_ENTRIES)) {
+            return;
+        }
+        
+        index_remove(oldest);
+    }
+}
+
+int gopher_fs_cache_store(const char *hostname, uint16_t port, const char *selector,
+                          uint8_t kind, const void *data, size_t len)
+{
+    struct gopher_fs_record rec = {
+        .magic = GOPHER_FS_CACHE_MAGIC,
+        .version = GOPHER_FS_CACHE_VERSION,
+        .kind = kind,
+        .port = port,
+        .selector_hash = gopher_cache_hash(selector),
+        .size = len,
+        .host_len = strlen(hostname),
+        .selector_len = strlen(selector),
+    };
+    struct fs_cache_entry *entry;
+    struct fs_file_t file;
+    char path[FS_CACHE_PATH_LEN];
+    char tmp_path[FS_CACHE_PATH_LEN];
+    uint32_t key = record_key(hostname, port, selector);
+    size_t size = sizeof(rec) + rec.host_len + rec.selector_len + len;
+    int ret;
+    
+    if (size > GOPHER_FS_CACHE_SIZE) {
+        return -EFBIG;
+    }
+    
+    k_mutex_lock(&fs_cache_lock, K_FOREVER);
+    
+    ret = fs_cache_ready();
+    if (ret != 0) {
+        k_mutex_unlock(&fs_cache_lock);
+        return ret;
+    }
+    
+    /* The old copy is replaced, its space counts as free */
+    entry = index_find(key);
+    if (entry != NULL) {
+        entry->key = 0;
+    }
+    make_room(size);
+    
+    rec.fetched_at = device_time();
+    
+    /* Written under a temporary name, so a power cut never leaves a torn record */
+    record_path(path, key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    
+    fs_file_t_init(&file);
+    ret = fs_open(&file, tmp_path, FS_O_CREATE | FS_O_WRITE | FS_O_TRUNC);
+    if (ret == 0) {
+        if (fs_write(&file, &rec, sizeof(rec)) != sizeof(rec) ||
+            fs_write(&file, hostname, rec.host_len) != rec.host_len ||
+            fs_write(&file, selector, rec.selector_len) != rec.selector_len ||
+            fs_write(&file, data, len) != (ssize_t)len) {
+            ret = -ENOSPC;
+        }
+        fs_close(&file);
+    }
+    
+    if (ret == 0) {
+        ret = fs_rename(tmp_path, path);
+    }
+    
+    if (ret != 0) {
+        LOG_WRN("Failed to persist %s:%u%s: %d", hostname, port, selector, ret);
+        fs_unlink(tmp_path);
+        fs_unlink(path);
+        k_mutex_unlock(&fs_cache_lock);
+        return ret;
+    }
+    
+    entry = index_find(0);
+    entry->key = key;
+    entry->size = size;
+    entry->fetched_at = rec.fetched_at;
+    
+    save_device_time();
+    
+    k_mutex_unlock(&fs_cache_lock);
+    
+    return 0;
+}
+
+void gopher_fs_cache_flush(void)
+{
+    k_mutex_lock(&fs_cache_lock, K_FOREVER);
+    
+    if (fs_cache_ready() == 0) {
+        for (int i = 0; i < GOPHER_FS_CACHE_MAX_ENTRIES; i++) {
+            if (fs_cache_index[i].key != 0) {
+                index_remove(&fs_cache_index[i]);
+            }
+        }
+    }
+    
+    k_mutex_unlock(&fs_cache_lock);
+}
+
+int gopher_fs_cache_usage(int *entries, size_t *used)
+{
+    int ret;
+    
+    *entries = 0;
+    *used = 0;
+    
+    k_mutex_lock(&fs_cache_lock, K_FOREVER);
+    
+    ret = fs_cache_ready();
+    for (int i = 0; ret == 0 && i < GOPHER_FS_CACHE_MAX_ENTRIES; i++) {
+        if (fs_cache_index[i].key != 0) {
+            (*entries)++;
+            *used += fs_cache_index[i].size;
+        }
+    }
+    
+    k_mutex_unlock(&fs_cache_lock);
+    
+    return ret;
+}
+
+#else /* !CONFIG_FILE_SYSTEM_LITTLEFS */
+
+/* Without a filesystem only the RAM cache is used */
+
+int gopher_fs_cache_find(const char *hostname, uint16_t port, const char *selector,
+                         struct gopher_fs_cache_info *info)
+{
+    return -ENOTSUP;
+}
+
+int gopher_fs_cache_read(const char *hostname, uint16_t port, const char *selector,
+                         void *buf, size_t len)
+{
+    return -ENOTSUP;
+}
+
+int gopher_fs_cache_store(const char *hostname, uint16_t port, const char *selector,
+                          uint8_t kind, const void *data, size_t len)
+{
+    return -ENOTSUP;
+}
+
+void gopher_fs_cache_flush(void)
+{
+}
+
+int gopher_fs_cache_usage(int *entries, size_t *used)
+{
+    *entries = 0;
+    *used = 0;
+    return -ENOTSUP;
+}
+
+#endif /* CONFIG_FILE_SYSTEM_LITTLEFS */
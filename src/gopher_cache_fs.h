@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_CACHE_FS_H_
+#define GOPHER_CACHE_FS_H_
+
+#include <zephyr/kernel.h>
+
+/* Mount point of the LittleFS storage partition */
+#define GOPHER_FS_CACHE_MNT "/lfs"
+
+/* Directory holding one file per cached response */
+#define GOPHER_FS_CACHE_DIR GOPHER_FS_CACHE_MNT "/gopher"
+
+/* Byte budget of the persistent cache */
+#define GOPHER_FS_CACHE_SIZE (256 * 1024)
+
+/* Maximum number of persisted responses */
+#define GOPHER_FS_CACHE_MAX_ENTRIES 64
+
+/* The device clock is saved once it has moved on this far, in seconds */
+#define GOPHER_FS_CACHE_CLOCK_SAVE_S 600
+
+/* Identifies a record file, "GPHC" */
+#define GOPHER_FS_CACHE_MAGIC 0x43485047
+#define GOPHER_FS_CACHE_VERSION 1
+
+/*
+ * On-disk record: this header, then the hostname and the selector (not
+ * terminated), then the response data in the form the RAM cache keeps it.
+ *
+ * Times are device seconds: uptime accumulated over all boots, so ages
+ * survive a reboot without a real-time clock (the time spent powered off is
+ * not counted). The clock is saved every GOPHER_FS_CACHE_CLOCK_SAVE_S at
+ * most, and resumes from the newest record if that is later.
+ */
+struct gopher_fs_record {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t kind;               /* enum gopher_cache_kind */
+    uint16_t port;
+    uint32_t selector_hash;     /* gopher_cache_hash() of the selector */
+    uint32_t size;              /* Bytes of response data */
+    uint32_t fetched_at;        /* Device seconds */
+    uint8_t host_len;
+    uint8_t reserved;
+    uint16_t selector_len;
+} __packed;
+
+/* A persisted response found by gopher_fs_cache_find() */
+struct gopher_fs_cache_info {
+    uint8_t kind;
+    size_t size;                /* Bytes of response data */
+    int64_t age_ms;
+};
+
+/**
+ * @brief Look up a persisted response
+ *
+ * @param hostname Server hostname
+ * @param port Server port
+ * @param selector Selector string
+ * @param info Filled with the kind, size and age of the response
+ * @return 0 if found, -ENOENT if not, -ENOTSUP without LittleFS support,
+ *         other negative errno on filesystem errors
+ */
+int gopher_fs_cache_find(const char *hostname, uint16_t port, const char *selector,
+                         struct gopher_fs_cache_info *info);
+
+/**
+ * @brief Read the data of a persisted response
+ *
+ * @param hostname Server hostname
+ * @param port Server port
+ * @param selector Selector string
+ * @param buf Buffer receiving the data
+ * @param len Size of the data, as reported by gopher_fs_cache_find()
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_fs_cache_read(const char *hostname, uint16_t port, const char *selector,
+                         void *buf, size_t len);
+
+/**
+ * @brief Persist a response, replacing an older copy
+ *
+ * The least recently fetched records are deleted to stay within
+ * GOPHER_FS_CACHE_SIZE and GOPHER_FS_CACHE_MAX_ENTRIES.
+ *
+ * @param hostname Server hostname
+ * @param port Server port
+ * @param selector Selector string
+ * @param kind enum gopher_cache_kind of the data
+ * @param data Response data
+ * @param len Number of bytes in data
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_fs_cache_store(const char *hostname, uint16_t port, const char *selector,
+                          uint8_t kind, const void *data, size_t len);
+
+/**
+ * @brief Delete all persisted responses
+ */
+void gopher_fs_cache_flush(void);
+
+/**
+ * @brief Read the persistent cache usage
+ *
+ * @param entries Set to the number of persisted responses
+ * @param used Set to the bytes used by them, headers included
+ * @return 0 on success, -ENOTSUP without LittleFS support, other negative
+ *         errno if the partition could not be mounted
+ */
+int gopher_fs_cache_usage(int *entries, size_t *used);
+
+#endif /* GOPHER_CACHE_FS_H_ */
@@ -10,6 +10,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
 #include "gopher_client.h"
 
 LOG_MODULE_REGISTER(gopher_client, LOG_LEVEL_ERR);
@@ -20,542 +22,1282 @@ int gopher_client_init(struct gopher_client *client)
     if (client == NULL) {
         return -EINVAL;
     }
-
+    
     memset(client, 0, sizeof(struct gopher_client));
     client->port = GOPHER_DEFAULT_PORT;
     client->connected = false;
     client->item_count = 0;
     client->history_pos = 0;
     client->history_count = 0;
-
+    client->conn.warm.state = GOPHER_CONN_NONE;
+    
     return 0;
 }
 
-/* Connect to a Gopher server - simplified memory safe version */
-int gopher_connect(struct gopher_client *client, const char *hostname, uint16_t port)
+/* Find the capability record of a server, optionally creating it by
+ * evicting the least recently used record */
+static struct gopher_server_caps *server_caps(struct gopher_client *client,
+                                              const char *hostname, uint16_t port,
+                                              bool create)
 {
-    /* Critical safety check */
-    if (client == NULL || hostname == NULL) {
-        return -EINVAL;
-    }
-    
-    /* Safety: completely reset client state */
-    memset(client, 0, sizeof(struct gopher_client));
+    struct gopher_server_caps *oldest = &client->conn.servers[0];
     
-    /* Set port */
-    client->port = (port == 0) ? GOPHER_DEFAULT_PORT : port;
+    for (int i = 0; i < GOPHER_MAX_SERVER_CAPS; i++) {
+        struct gopher_server_caps *caps = &client->conn.servers[i];
+        
+        if (caps->port == port && strcmp(caps->hostname, hostname) == 0) {
+            return caps;
+        }
+        if (caps->last_used < oldest->last_used) {
+            oldest = caps;
+        }
+    }
     
-    /* Store hostname with safe strncpy */
-    strncpy(client->hostname, hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
-    client->hostname[GOPHER_MAX_HOSTNAME_LEN - 1] = '\0';
+    if (!create) {
+        return NULL;
+    }
     
-    /* Set connected flag */
-    client->connected = true;
+    memset(oldest, 0, sizeof(*oldest));
+    strncpy(oldest->hostname, hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
+    oldest->port = port;
     
-    return 0;
+    return oldest;
 }
 
-/* Send a selector string to the server and receive the response */
-int gopher_send_selector(struct gopher_client *client, const char *selector, 
-                         char *buffer, size_t buffer_size)
+/* Resolved-address cache entry */
+enum dns_entry_state {
+    DNS_ENTRY_EMPTY = 0,
+    DNS_ENTRY_PENDING,   /* Queued for background resolution */
+    DNS_ENTRY_VALID,     /* Address resolved */
+    DNS_ENTRY_FAILED,    /* Negative entry, resolution failed */
+};
+
+struct dns_cache_entry {
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];
+    enum dns_entry_state state;
+    struct in_addr addr;
+    int status;
+    int64_t expires;
+    int64_t last_used;
+};
+
+static struct dns_cache_entry dns_cache[GOPHER_DNS_CACHE_SIZE];
+static K_MUTEX_DEFINE(dns_lock);
+
+/* Background resolver for hostnames of a freshly parsed menu */
+static K_THREAD_STACK_DEFINE(dns_stack, GOPHER_DNS_STACK_SIZE);
+static struct k_work_q dns_work_q;
+static struct k_work dns_prefetch_work;
+static bool dns_work_q_started;
+
+/* Find the cache entry for a hostname, or the slot to reuse for it.
+ * Must be called with dns_lock held. */
+static struct dns_cache_entry *dns_find(const char *hostname, bool *found)
 {
-    int ret = 0;
-    int sock = -1;
-    int total_received = 0;
-    struct sockaddr_in server;
-    char port_str[8];
-    
-    /* Safety checks - fail fast */
-    if (client == NULL || buffer == NULL || buffer_size == 0) {
-        return -EINVAL;
-    }
+    struct dns_cache_entry *victim = NULL;
     
-    if (!client->connected || client->hostname[0] == '\0') {
-        return -ENOTCONN;
+    for (int i = 0; i < GOPHER_DNS_CACHE_SIZE; i++) {
+        struct dns_cache_entry *entry = &dns_cache[i];
+        
+        if (entry->state != DNS_ENTRY_EMPTY && strcmp(entry->hostname, hostname) == 0) {
+            *found = true;
+            return entry;
+        }
+        
+        /* Prefer empty slots, then the least recently used settled entry */
+        if (entry->state == DNS_ENTRY_EMPTY) {
+            if (victim == NULL || victim->state != DNS_ENTRY_EMPTY) {
+                victim = entry;
+            }
+        } else if (entry->state != DNS_ENTRY_PENDING &&
+                   (victim == NULL ||
+                    (victim->state != DNS_ENTRY_EMPTY && entry->last_used < victim->last_used))) {
+            victim = entry;
+        }
     }
     
-    /* Clear buffer completely */
-    memset(buffer, 0, buffer_size);
+    *found = false;
+    return victim;
+}
+
+/* Store a resolution result in the cache */
+static void dns_store(const char *hostname, const struct in_addr *addr, int status)
+{
+    struct dns_cache_entry *entry;
+    bool found;
+    int64_t now = k_uptime_get();
     
-    /* Set up server address structure */
-    memset(&server, 0, sizeof(server));
-    server.sin_family = AF_INET;
-    server.sin_port = htons(client->port);
+    k_mutex_lock(&dns_lock, K_FOREVER);
     
-    /* Convert port to string for getaddrinfo */
-    snprintf(port_str, sizeof(port_str), "%u", client->port);
+    entry = dns_find(hostname, &found);
+    if (entry != NULL) {
+        if (!found) {
+            strncpy(entry->hostname, hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
+            entry->hostname[GOPHER_MAX_HOSTNAME_LEN - 1] = '\0';
+            entry->last_used = now;
+        }
+        
+        entry->status = status;
+        if (status == 0) {
+            entry->state = DNS_ENTRY_VALID;
+            entry->addr = *addr;
+            entry->expires = now + GOPHER_DNS_TTL_MS;
+        } else {
+            entry->state = DNS_ENTRY_FAILED;
+            entry->expires = now + GOPHER_DNS_NEGATIVE_TTL_MS;
+        }
+    }
     
-    /* Try hostname resolution with getaddrinfo */
+    k_mutex_unlock(&dns_lock);
+}
+
+/* Resolve a hostname with the system resolver, bypassing the cache */
+static int dns_lookup(const char *hostname, struct in_addr *addr)
+{
     struct zsock_addrinfo hints, *result;
+    
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     
-    /* First try direct IP address parsing */
-    if (zsock_inet_pton(AF_INET, client->hostname, &server.sin_addr) != 1) {
-        /* Not an IP address, try DNS resolution */
-        int err = zsock_getaddrinfo(client->hostname, NULL, &hints, &result);
-        if (err != 0) {
-            return -EHOSTUNREACH;
-        }
-        
-        /* Copy the resolved address */
-        memcpy(&server.sin_addr, 
-               &((struct sockaddr_in *)result->ai_addr)->sin_addr,
-               sizeof(struct in_addr));
-               
-        zsock_freeaddrinfo(result);
+    int err = zsock_getaddrinfo(hostname, NULL, &hints, &result);
+    if (err != 0) {
+        return -EHOSTUNREACH;
     }
     
-    /* Create socket */
-    sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (sock < 0) {
-        return -ESOCKTNOSUPPORT;
-    }
+    /* Copy the resolved address */
+    memcpy(addr, &((struct sockaddr_in *)result->ai_addr)->sin_addr, sizeof(struct in_addr));
     
-    /* Set reasonable timeouts */
-    struct timeval timeout;
-    timeout.tv_sec = 5;
-    timeout.tv_usec = 0;
+    zsock_freeaddrinfo(result);
     
-    zsock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    zsock_setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return 0;
+}
+
+/* Resolve a hostname, using the cache when possible */
+int gopher_dns_resolve(const char *hostname, struct in_addr *addr)
+{
+    struct dns_cache_entry *entry;
+    bool found;
+    int ret;
     
-    /* Connect to server */
-    int err = zsock_connect(sock, (struct sockaddr *)&server, sizeof(server));
-    if (err < 0) {
-        zsock_close(sock);
-        return -errno;  /* Return the actual error code */
+    if (hostname == NULL || addr == NULL) {
+        return -EINVAL;
+    }
+    
+    /* Literal IP addresses need no lookup */
+    if (zsock_inet_pton(AF_INET, hostname, addr) == 1) {
+        return 0;
     }
     
-    /* Prepare request */
-    char request[128];
-    memset(request, 0, sizeof(request));
+    k_mutex_lock(&dns_lock, K_FOREVER);
     
-    if (selector == NULL) {
-        /* Empty selector */
-        strcpy(request, "\r\n");
-    } else {
-        /* Add selector with CRLF */
-        size_t req_len = strlen(selector);
-        if (req_len > sizeof(request) - 3) {
-            req_len = sizeof(request) - 3;
+    entry = dns_find(hostname, &found);
+    if (found && (entry->state == DNS_ENTRY_VALID || entry->state == DNS_ENTRY_FAILED) &&
+        k_uptime_get() < entry->expires) {
+        entry->last_used = k_uptime_get();
+        ret = entry->status;
+        if (ret == 0) {
+            *addr = entry->addr;
         }
-        
-        memcpy(request, selector, req_len);
-        request[req_len] = '\r';
-        request[req_len+1] = '\n';
-        request[req_len+2] = '\0';
+        k_mutex_unlock(&dns_lock);
+        return ret;
     }
     
-    /* Send request */
-    err = zsock_send(sock, request, strlen(request), 0);
-    if (err < 0) {
-        zsock_close(sock);
-        return -errno;  /* Return the actual error code */
+    k_mutex_unlock(&dns_lock);
+    
+    /* Miss, expired or still queued for prefetch: resolve now */
+    ret = dns_lookup(hostname, addr);
+    dns_store(hostname, addr, ret);
+    
+    return ret;
+}
+
+/* Drop all cached resolutions */
+void gopher_dns_flush(void)
+{
+    k_mutex_lock(&dns_lock, K_FOREVER);
+    
+    for (int i = 0; i < GOPHER_DNS_CACHE_SIZE; i++) {
+        /* Pending entries stay so the background resolver can still fill them */
+        if (dns_cache[i].state != DNS_ENTRY_PENDING) {
+            dns_cache[i].state = DNS_ENTRY_EMPTY;
+        }
     }
     
-    /* Receive response */
-    char recv_buffer[128];
-    int bytes_read;
+    k_mutex_unlock(&dns_lock);
+}
+
+/* Report every cache entry through a callback */
+void gopher_dns_foreach(gopher_dns_entry_cb_t cb, void *user_data)
+{
+    int64_t now = k_uptime_get();
+    
+    k_mutex_lock(&dns_lock, K_FOREVER);
     
-    /* Receive data in smaller chunks to reduce stack usage */
-    int recv_attempts = 0;
-    while (recv_attempts < 3) { /* Try a few times */
-        memset(recv_buffer, 0, sizeof(recv_buffer));
-        bytes_read = zsock_recv(sock, recv_buffer, sizeof(recv_buffer) - 1, 0);
+    for (int i = 0; i < GOPHER_DNS_CACHE_SIZE; i++) {
+        const struct dns_cache_entry *entry = &dns_cache[i];
         
-        if (bytes_read < 0) {
-            recv_attempts++;
-            k_sleep(K_MSEC(500)); /* Wait a bit before retrying */
+        if (entry->state == DNS_ENTRY_EMPTY) {
             continue;
-        } else if (bytes_read == 0) {
-            /* Connection closed by server */
-            break;
         }
         
-        /* Don't overflow the buffer */
-        if (total_received + bytes_read >= buffer_size) {
-            bytes_read = buffer_size - total_received - 1;
-            if (bytes_read <= 0) {
+        cb(entry->hostname,
+           entry->state == DNS_ENTRY_VALID ? &entry->addr : NULL,
+           entry->state == DNS_ENTRY_PENDING ? -EINPROGRESS : entry->status,
+           entry->state == DNS_ENTRY_PENDING ? 0 : MAX(entry->expires - now, 0),
+           user_data);
+    }
+    
+    k_mutex_unlock(&dns_lock);
+}
+
+/* Work handler resolving all entries queued by gopher_dns_prefetch() */
+static void dns_prefetch_handler(struct k_work *work)
+{
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];
+    struct in_addr addr;
+    
+    ARG_UNUSED(work);
+    
+    while (true) {
+        bool queued = false;
+        
+        k_mutex_lock(&dns_lock, K_FOREVER);
+        for (int i = 0; i < GOPHER_DNS_CACHE_SIZE; i++) {
+            if (dns_cache[i].state == DNS_ENTRY_PENDING) {
+                strcpy(hostname, dns_cache[i].hostname);
+                queued = true;
                 break;
             }
         }
+        k_mutex_unlock(&dns_lock);
         
-        /* Copy data to output buffer */
-        memcpy(buffer + total_received, recv_buffer, bytes_read);
-        total_received += bytes_read;
-        buffer[total_received] = '\0';
-        
-        /* Check if we've filled the buffer */
-        if (total_received >= buffer_size - 1) {
+        if (!queued) {
             break;
         }
         
-        /* If we received data, reset retry counter */
-        recv_attempts = 0;
+        /* The lookup blocks, so it runs without the lock held */
+        int ret = dns_lookup(hostname, &addr);
+        dns_store(hostname, &addr, ret);
+    }
+}
+
+/* Queue every distinct hostname of the current listing for background resolution */
+int gopher_dns_prefetch(const struct gopher_client *client)
+{
+    const struct gopher_menu *menu;
+    struct in_addr addr;
+    int queued = 0;
+    
+    if (client == NULL) {
+        return -EINVAL;
     }
     
-    /* Close the socket when done */
-    zsock_close(sock);
+    menu = &client->menu;
     
-    /* Update history if we got data */
-    if (total_received > 0) {
-        /* Add to history */
-        if (client->history_count < 10) {
-            client->history_count++;
+    k_mutex_lock(&dns_lock, K_FOREVER);
+    
+    if (!dns_work_q_started) {
+        k_work_queue_init(&dns_work_q);
+        k_work_queue_start(&dns_work_q, dns_stack, K_THREAD_STACK_SIZEOF(dns_stack),
+                           GOPHER_DNS_PRIORITY, NULL);
+        k_work_init(&dns_prefetch_work, dns_prefetch_handler);
+        dns_work_q_started = true;
+    }
+    
+    /* Interned hostnames are exactly the distinct hosts of the listing */
+    for (int i = 0; i < menu->host_count; i++) {
+        const char *hostname = &menu->arena[menu->hosts[i]];
+        struct dns_cache_entry *entry;
+        bool found;
+        
+        if (zsock_inet_pton(AF_INET, hostname, &addr) == 1) {
+            continue;
         }
         
-        /* Move to the next position */
-        client->history_pos = (client->history_pos + 1) % 10;
+        entry = dns_find(hostname, &found);
+        if (entry == NULL) {
+            /* Every slot is waiting for the resolver already */
+            break;
+        }
         
-        /* Store selector */
-        if (selector != NULL) {
-            memset(client->history[client->history_pos], 0, GOPHER_MAX_SELECTOR_LEN);
-            strncpy(client->history[client->history_pos], selector, GOPHER_MAX_SELECTOR_LEN - 1);
-        } else {
-            client->history[client->history_pos][0] = '\0';
+        if (found && (entry->state == DNS_ENTRY_PENDING || k_uptime_get() < entry->expires)) {
+            continue;
         }
+        
+        strncpy(entry->hostname, hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
+        entry->hostname[GOPHER_MAX_HOSTNAME_LEN - 1] = '\0';
+        entry->state = DNS_ENTRY_PENDING;
+        entry->last_used = k_uptime_get();
+        queued++;
     }
     
-    return total_received;
+    k_mutex_unlock(&dns_lock);
+    
+    if (queued > 0) {
+        k_work_submit_to_queue(&dns_work_q, &dns_prefetch_work);
+    }
+    
+    return queued;
 }
 
-/* Basic history update function - can be used for direct history management */
-int gopher_update_history(struct gopher_client *client, const char *selector)
+/* Resolve the current server into an IPv4 socket address */
+static int resolve_server(struct gopher_client *client, struct sockaddr_in *server)
 {
-    if (client == NULL) {
-        return -EINVAL;
+    /* Set up server address structure */
+    memset(server, 0, sizeof(*server));
+    server->sin_family = AF_INET;
+    server->sin_port = htons(client->port);
+    
+    return gopher_dns_resolve(client->hostname, &server->sin_addr);
+}
+
+/* Create a socket and start a non-blocking connect to the server.
+ * Returns the socket on success, negative errno otherwise. */
+static int start_connect(const struct sockaddr_in *server)
+{
+    int sock;
+    int flags;
+    
+    /* Create socket */
+    sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -ESOCKTNOSUPPORT;
     }
     
-    /* Update history */
-    if (client->history_count < 10) {
-        client->history_count++;
+    /* Set reasonable timeouts */
+    struct timeval timeout;
+    timeout.tv_sec = GOPHER_IO_TIMEOUT_MS / 1000;
+    timeout.tv_usec = 0;
+    
+    zsock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    zsock_setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    
+    /* Connect in the background, finish_connect() waits for completion */
+    flags = zsock_fcntl(sock, F_GETFL, 0);
+    zsock_fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    
+    if (zsock_connect(sock, (const struct sockaddr *)server, sizeof(*server)) < 0 &&
+        errno != EINPROGRESS) {
+        int err = -errno;
+        
+        zsock_close(sock);
+        return err;
     }
     
-    /* Move to next position */
-    client->history_pos = (client->history_pos + 1) % 10;
+    return sock;
+}
+
+/* Wait until a socket is ready for the given poll events, in short slices so
+ * that gopher_cancel() takes effect quickly. Returns 0 when ready,
+ * -ETIMEDOUT, -ECANCELED or another negative errno. */
+static int wait_socket(struct gopher_client *client, int sock, short events, int timeout_ms)
+{
+    struct zsock_pollfd pfd = { .fd = sock, .events = events };
+    int64_t deadline = k_uptime_get() + timeout_ms;
     
-    /* Store selector */
-    memset(client->history[client->history_pos], 0, GOPHER_MAX_SELECTOR_LEN);
-    if (selector != NULL) {
-        strncpy(client->history[client->history_pos], selector, GOPHER_MAX_SELECTOR_LEN - 1);
+    while (true) {
+        if (atomic_get(&client->cancel)) {
+            return -ECANCELED;
+        }
+        
+        int ret = zsock_poll(&pfd, 1, GOPHER_POLL_INTERVAL_MS);
+        if (ret < 0) {
+            return -errno;
+        }
+        if (ret > 0) {
+            return 0;
+        }
+        
+        if (k_uptime_get() >= deadline) {
+            return -ETIMEDOUT;
+        }
+    }
+}
+
+/* Wait for a connect started by start_connect() and switch the socket back
+ * to blocking mode. Returns 0 on success, negative errno otherwise. */
+static int finish_connect(struct gopher_client *client, int sock, int timeout_ms)
+{
+    int sock_err = 0;
+    socklen_t optlen = sizeof(sock_err);
+    int flags;
+    
+    int ret = wait_socket(client, sock, ZSOCK_POLLOUT, timeout_ms);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    if (zsock_getsockopt(sock, SOL_SOCKET, SO_ERROR, &sock_err, &optlen) < 0) {
+        return -errno;
     }
+    if (sock_err != 0) {
+        return -sock_err;
+    }
+    
+    flags = zsock_fcntl(sock, F_GETFL, 0);
+    zsock_fcntl(sock, F_SETFL, flags & ~O_NONBLOCK);
     
     return 0;
 }
 
-/* Parse a directory listing with improved safety */
-int gopher_parse_directory(struct gopher_client *client, const char *buffer)
+/* Close the pre-opened connection, if any */
+static void warm_close(struct gopher_client *client)
 {
-    int count = 0;
-    const char *line_start;
-    const char *line_end;
-    const char *field_start;
-    const char *field_end;
-    const char *buffer_end;
-    size_t buffer_len;
+    struct gopher_conn *warm = &client->conn.warm;
     
-    /* Critical safety check */
-    if (client == NULL || buffer == NULL) {
-        return -EINVAL;
+    if (warm->state != GOPHER_CONN_NONE) {
+        zsock_close(warm->sock);
+        warm->state = GOPHER_CONN_NONE;
     }
+}
+
+/* Pre-open a connection to the current server so the next request can skip
+ * connection setup, unless the server is known to drop idle connections */
+static void warm_start(struct gopher_client *client, const struct sockaddr_in *server)
+{
+    struct gopher_conn *warm = &client->conn.warm;
+    struct gopher_server_caps *caps;
+    int sock;
     
-    /* Get buffer length for bounds checking */
-    buffer_len = strlen(buffer);
-    if (buffer_len == 0) {
-        return 0;
+    if (warm->state != GOPHER_CONN_NONE) {
+        return;
     }
     
-    /* Calculate buffer end pointer for bounds checking */
-    buffer_end = buffer + buffer_len;
+    caps = server_caps(client, client->hostname, client->port, false);
+    if (caps != NULL && caps->warm_disabled) {
+        return;
+    }
     
-    /* Start with clean slate */
-    client->item_count = 0;
+    sock = start_connect(server);
+    if (sock < 0) {
+        return;
+    }
     
-    /* More safety: clear all items first with memset */
-    memset(client->items, 0, sizeof(client->items));
-    
-    /* Initialize line_start to avoid potential NULL pointer */
-    line_start = buffer;
-    
-    /* Check if this is a text file or a directory listing */
-    /* If the first character isn't a valid Gopher item type followed by a display string and a tab,
-       it's probably a text file, not a directory listing */
-    bool is_dir_listing = false;
-    
-    /* First check if buffer has at least one character */
-    if (buffer_len > 0) {
-        char first_char = buffer[0];
-        /* Check if the first character is a valid item type according to RFC 1436 */
-        if (first_char == GOPHER_TYPE_TEXT ||
-            first_char == GOPHER_TYPE_DIRECTORY ||
-            first_char == GOPHER_TYPE_CSO ||
-            first_char == GOPHER_TYPE_ERROR ||
-            first_char == GOPHER_TYPE_BINHEX ||
-            first_char == GOPHER_TYPE_DOS ||
-            first_char == GOPHER_TYPE_UUENCODED ||
-            first_char == GOPHER_TYPE_SEARCH ||
-            first_char == GOPHER_TYPE_TELNET ||
-            first_char == GOPHER_TYPE_BINARY ||
-            first_char == GOPHER_TYPE_REDUNDANT ||
-            first_char == GOPHER_TYPE_TN3270 ||
-            first_char == GOPHER_TYPE_GIF ||
-            first_char == GOPHER_TYPE_IMAGE ||
-            first_char == 'i') {
-            /* Look for a tab character which separates fields in the first line */
-            if (strchr(buffer, '\t') != NULL) {
-                is_dir_listing = true;
-            }
-        }
+    warm->sock = sock;
+    warm->state = GOPHER_CONN_CONNECTING;
+    warm->port = client->port;
+    warm->opened_at = k_uptime_get();
+    strcpy(warm->hostname, client->hostname);
+}
+
+/* Take the pre-opened connection if it is for the current server and still
+ * usable. Returns the socket, or negative errno if there is none. */
+static int warm_take(struct gopher_client *client)
+{
+    struct gopher_conn *warm = &client->conn.warm;
+    struct zsock_pollfd pfd;
+    int sock = warm->sock;
+    
+    if (warm->state == GOPHER_CONN_NONE) {
+        return -ENOTCONN;
     }
     
-    /* If this doesn't look like a directory listing, return 0 to indicate 
-       it should be treated as a text file */
-    if (!is_dir_listing) {
-        return 0;
+    if (warm->port != client->port || strcmp(warm->hostname, client->hostname) != 0 ||
+        k_uptime_get() - warm->opened_at > GOPHER_WARM_CONN_MAX_AGE_MS) {
+        warm_close(client);
+        return -ENOTCONN;
     }
     
-    /* Parse directory listing */
+    warm->state = GOPHER_CONN_NONE;
     
-    /* Process each line with careful bounds checking */
-    while (line_start < buffer_end && count < GOPHER_MAX_DIR_ITEMS) {
-        /* Verify line_start is within bounds */
-        if (line_start < buffer || line_start >= buffer_end) {
-            break;
-        }
-        
-        /* Skip empty lines or if we've reached the end */
-        if (*line_start == '\0') {
-            break;
-        }
-        
-        /* Find end of line with bounds checking */
-        line_end = buffer_end;  /* Default to end of buffer */
-        const char *crlf = memmem(line_start, buffer_end - line_start, "\r\n", 2);
-        if (crlf != NULL && crlf < buffer_end) {
-            line_end = crlf;
-        } else {
-            /* No CRLF found, this is the last line */
-            line_end = buffer_end;
-            /* If we're at the end of buffer without CRLF, we can still process this line */
-        }
-        
-        /* Check if this is the terminating period */
-        if (line_start[0] == '.' && line_end == line_start + 1) {
-            break;
-        }
-        
-        /* Extra safety: check if we have at least one character in the line */
-        if (line_end <= line_start) {
-            /* Empty line, move to next */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
-                break;
-            }
-            continue;
-        }
-        
-        /* Get item type (first character) with bounds check */
-        client->items[count].type = line_start[0];
-        
-        /* Skip type character */
-        field_start = line_start + 1;
-        if (field_start >= buffer_end) {
-            break;  /* Unexpected end of buffer */
-        }
-        
-        /* Get display string (first field) */
-        field_end = memchr(field_start, '\t', line_end - field_start);
-        if (!field_end || field_end > line_end) {
-            /* For info items (type 'i'), we can tolerate missing tabs 
-               This makes the client more compatible with non-standard servers */
-            if (client->items[count].type == 'i') {
-                /* Use the whole line as the display string */
-                size_t len = line_end - field_start;
-                if (len >= GOPHER_MAX_SELECTOR_LEN) {
-                    len = GOPHER_MAX_SELECTOR_LEN - 1;
-                }
-                
-                /* Safer strncpy instead of memcpy */
-                memset(client->items[count].display_string, 0, GOPHER_MAX_SELECTOR_LEN);
-                if (len > 0) {
-                    strncpy(client->items[count].display_string, field_start, len);
-                }
-                client->items[count].display_string[len] = '\0';
-                
-                /* Use empty values for other fields */
-                client->items[count].selector[0] = '\0';
-                /* Make sure hostname doesn't exceed buffer */
-                strncpy(client->items[count].hostname, client->hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
-                client->items[count].hostname[GOPHER_MAX_HOSTNAME_LEN - 1] = '\0';
-                client->items[count].port = client->port;
-                
-                /* Increment count and move to next line */
-                count++;
-                if (line_end + 2 <= buffer_end) {
-                    line_start = line_end + 2;
-                } else {
-                    /* We've reached the end */
-                    break;
-                }
-                continue;
-            } else {
-                /* Invalid format for non-info items, skip this line */
-                if (line_end + 2 <= buffer_end) {
-                    line_start = line_end + 2;
-                } else {
-                    /* We've reached the end */
-                    break;
-                }
-                continue;
-            }
-        }
-        
-        /* Copy display string */
-        size_t len = field_end - field_start;
-        if (len >= GOPHER_MAX_SELECTOR_LEN) {
-            len = GOPHER_MAX_SELECTOR_LEN - 1;
-        }
-        
-        /* Safer strncpy instead of memcpy */
-        memset(client->items[count].display_string, 0, GOPHER_MAX_SELECTOR_LEN);
-        if (len > 0) {
-            strncpy(client->items[count].display_string, field_start, len);
-        }
-        client->items[count].display_string[len] = '\0';
-        
-        /* Move to selector field */
-        field_start = field_end + 1;
-        if (field_start >= buffer_end || field_start >= line_end) {
-            /* Premature end of line, skip to next */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
-                break;
-            }
-            continue;
-        }
-        
-        /* Get selector (second field) */
-        field_end = memchr(field_start, '\t', line_end - field_start);
-        if (!field_end || field_end > line_end) {
-            /* Invalid format, skip this line */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
-                break;
-            }
-            continue;
-        }
-        
-        /* Copy selector */
-        len = field_end - field_start;
-        if (len >= GOPHER_MAX_SELECTOR_LEN) {
-            len = GOPHER_MAX_SELECTOR_LEN - 1;
-        }
-        
-        /* Safer strncpy instead of memcpy */
-        memset(client->items[count].selector, 0, GOPHER_MAX_SELECTOR_LEN);
-        if (len > 0) {
-            strncpy(client->items[count].selector, field_start, len);
-        }
-        client->items[count].selector[len] = '\0';
-        
-        /* Move to hostname field */
-        field_start = field_end + 1;
-        if (field_start >= buffer_end || field_start >= line_end) {
-            /* Premature end of line, skip to next */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
-                break;
-            }
-            continue;
-        }
-        
-        /* Get hostname (third field) */
-        field_end = memchr(field_start, '\t', line_end - field_start);
-        if (!field_end || field_end > line_end) {
-            /* Invalid format, skip this line */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
-                break;
-            }
-            continue;
+    /* A readable or hung up socket means the server already dropped it */
+    pfd.fd = sock;
+    pfd.events = ZSOCK_POLLIN;
+    pfd.revents = 0;
+    if (zsock_poll(&pfd, 1, 0) > 0) {
+        zsock_close(sock);
+        return -ECONNRESET;
+    }
+    
+    if (finish_connect(client, sock, GOPHER_IO_TIMEOUT_MS) < 0) {
+        zsock_close(sock);
+        return -ECONNRESET;
+    }
+    
+    return sock;
+}
+
+/* Update a server's warm connection record after a request on a pre-opened
+ * connection: servers that drop them repeatedly are no longer pre-opened */
+static void warm_result(struct gopher_client *client, bool usable)
+{
+    struct gopher_server_caps *caps;
+    
+    caps = server_caps(client, client->hostname, client->port, true);
+    if (usable) {
+        caps->warm_hits++;
+        caps->warm_misses = 0;
+    } else if (++caps->warm_misses >= GOPHER_WARM_CONN_MAX_MISSES) {
+        caps->warm_disabled = true;
+    }
+}
+
+/* Tell whether a request on a pre-opened connection failed because the
+ * server had already dropped it: a close without data, or a reset when
+ * sending or receiving. A timeout is not, another try would wait again. */
+static bool warm_dropped(int ret)
+{
+    return ret == 0 || ret == -ECONNRESET || ret == -EPIPE;
+}
+
+/* Connect to a Gopher server: resolve it and pre-open the first connection */
+int gopher_connect(struct gopher_client *client, const char *hostname, uint16_t port)
+{
+    struct gopher_conn_mgr conn;
+    atomic_val_t cancel;
+    struct sockaddr_in server;
+    int ret;
+    
+    /* Critical safety check */
+    if (client == NULL || hostname == NULL) {
+        return -EINVAL;
+    }
+    
+    /* Drop any connection to the previous server */
+    warm_close(client);
+    
+    /* Safety: completely reset client state, only connection records and
+       a pending cancellation survive */
+    memcpy(&conn, &client->conn, sizeof(conn));
+    cancel = atomic_get(&client->cancel);
+    memset(client, 0, sizeof(struct gopher_client));
+    memcpy(&client->conn, &conn, sizeof(conn));
+    atomic_set(&client->cancel, cancel);
+    
+    /* Set port */
+    client->port = (port == 0) ? GOPHER_DEFAULT_PORT : port;
+    
+    /* Store hostname with safe strncpy */
+    strncpy(client->hostname, hostname, GOPHER_MAX_HOSTNAME_LEN - 1);
+    client->hostname[GOPHER_MAX_HOSTNAME_LEN - 1] = '\0';
+    
+    ret = resolve_server(client, &server);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    /* Set connected flag */
+    client->connected = true;
+    
+    /* The handshake runs while the caller prepares the first request */
+    warm_start(client, &server);
+    
+    return 0;
+}
+
+/* Close any pre-opened connection and mark the client disconnected */
+void gopher_disconnect(struct gopher_client *client)
+{
+    if (client == NULL) {
+        return;
+    }
+    
+    warm_close(client);
+    client->connected = false;
+}
+
+/* Record a successfully fetched selector in the navigation history */
+static void record_history(struct gopher_client *client, const char *selector)
+{
+    /* Add to history */
+    if (client->history_count < 10) {
+        client->history_count++;
+    }
+    
+    /* Move to the next position */
+    client->history_pos = (client->history_pos + 1) % 10;
+    
+    /* Store selector */
+    if (selector != NULL) {
+        memset(client->history[client->history_pos], 0, GOPHER_MAX_SELECTOR_LEN);
+        strncpy(client->history[client->history_pos], selector, GOPHER_MAX_SELECTOR_LEN - 1);
+    } else {
+        client->history[client->history_pos][0] = '\0';
+    }
+}
+
+/* Get a connection to the server and send the selector line, using the
+ * pre-opened connection unless fresh is set. Returns the socket on success,
+ * negative errno otherwise; *warm tells whether a pre-opened one was used. */
+static int open_request(struct gopher_client *client, const char *selector,
+                        bool fresh, bool *warm)
+{
+    struct sockaddr_in server;
+    struct gopher_server_caps *caps;
+    int sock = -ENOTCONN;
+    int err;
+    
+    if (!client->connected || client->hostname[0] == '\0') {
+        return -ENOTCONN;
+    }
+    
+    err = resolve_server(client, &server);
+    if (err < 0) {
+        return err;
+    }
+    
+    if (!fresh) {
+        sock = warm_take(client);
+    }
+    *warm = (sock >= 0);
+    
+    if (sock < 0) {
+        /* No usable pre-opened connection, connect now */
+        int64_t start = k_uptime_get();
+        
+        warm_close(client);
+        sock = start_connect(&server);
+        if (sock < 0) {
+            return sock;
         }
         
-        /* Copy hostname */
-        len = field_end - field_start;
-        if (len >= GOPHER_MAX_HOSTNAME_LEN) {
-            len = GOPHER_MAX_HOSTNAME_LEN - 1;
+        err = finish_connect(client, sock, GOPHER_IO_TIMEOUT_MS);
+        if (err < 0) {
+            zsock_close(sock);
+            return err;
         }
         
-        /* Safer strncpy instead of memcpy */
-        memset(client->items[count].hostname, 0, GOPHER_MAX_HOSTNAME_LEN);
-        if (len > 0) {
-            strncpy(client->items[count].hostname, field_start, len);
+        /* Keep a smoothed connection setup time per server */
+        caps = server_caps(client, client->hostname, client->port, true);
+        uint32_t connect_ms = (uint32_t)MIN(k_uptime_get() - start, UINT16_MAX);
+        caps->connect_ms = caps->connect_ms ? (caps->connect_ms * 3 + connect_ms) / 4 : connect_ms;
+    }
+    
+    caps = server_caps(client, client->hostname, client->port, true);
+    caps->last_used = k_uptime_get();
+    
+    /* Prepare request: selector (which may carry a search query) plus CRLF */
+    char request[GOPHER_MAX_SELECTOR_LEN + 3];
+    size_t req_len = 0;
+    
+    if (selector != NULL) {
+        req_len = strlen(selector);
+        if (req_len > sizeof(request) - 3) {
+            req_len = sizeof(request) - 3;
+        }
+        memcpy(request, selector, req_len);
+    }
+    request[req_len++] = '\r';
+    request[req_len++] = '\n';
+    
+    /* Send request */
+    err = zsock_send(sock, request, req_len, 0);
+    if (err < 0) {
+        err = -errno;
+        zsock_close(sock);
+        if (*warm && warm_dropped(err)) {
+            /* Dropped while it waited, send on a fresh connection */
+            warm_result(client, false);
+            return open_request(client, selector, true, warm);
+        }
+        return err;
+    }
+    
+    /* Gopher closes the connection after each response, so open the next
+       one now and let its handshake overlap with receiving this response */
+    warm_start(client, &server);
+    
+    return sock;
+}
+
+/* Receive into dst once data is available. Returns bytes read, 0 when the
+ * server closed the connection, or negative errno (-ETIMEDOUT when the
+ * server stays silent, -ECANCELED after gopher_cancel()). */
+static int recv_poll(struct gopher_client *client, int sock, void *dst, size_t len)
+{
+    while (true) {
+        int ret = wait_socket(client, sock, ZSOCK_POLLIN, GOPHER_RECV_IDLE_TIMEOUT_MS);
+        if (ret < 0) {
+            return ret;
         }
-        client->items[count].hostname[len] = '\0';
         
-        /* Move to port field */
-        field_start = field_end + 1;
-        if (field_start >= buffer_end || field_start >= line_end) {
-            /* Premature end of line, skip to next */
-            if (line_end + 2 <= buffer_end) {
-                line_start = line_end + 2;
-            } else {
-                /* We've reached the end */
+        ret = zsock_recv(sock, dst, len, ZSOCK_MSG_DONTWAIT);
+        if (ret >= 0) {
+            return ret;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -errno;
+        }
+    }
+}
+
+/* Send a selector string to the server and receive the response */
+int gopher_send_selector(struct gopher_client *client, const char *selector, 
+                         char *buffer, size_t buffer_size)
+{
+    int sock;
+    int ret = 0;
+    int total_received = 0;
+    bool warm;
+    bool fresh = false;
+    
+    /* Safety checks - fail fast */
+    if (client == NULL || buffer == NULL || buffer_size == 0) {
+        return -EINVAL;
+    }
+    
+    buffer[0] = '\0';
+    
+    do {
+        sock = open_request(client, selector, fresh, &warm);
+        if (sock < 0) {
+            return sock;
+        }
+        ret = 0;
+        
+        /* Receive straight into the caller's buffer, keeping room for the NUL */
+        while (total_received < buffer_size - 1) {
+            int bytes_read = recv_poll(client, sock, buffer + total_received,
+                                       buffer_size - 1 - total_received);
+            if (bytes_read <= 0) {
+                /* Only the server closing the connection ends a response;
+                   a stall or error, even after some data, leaves the
+                   buffer holding part of it */
+                ret = bytes_read;
                 break;
             }
-            continue;
+            
+            total_received += bytes_read;
         }
         
-        /* Get port (fourth field) - safely convert to integer */
-        /* First create a null-terminated temporary buffer for the port string */
-        char port_str[16] = {0};
-        len = MIN(line_end - field_start, sizeof(port_str) - 1);
+        /* Close the socket when done */
+        zsock_close(sock);
+        
+        /* A pre-opened connection closed or reset without yielding
+           anything was dropped by the server before our request, try once
+           more on a fresh one */
+        if (warm) {
+            warm_result(client, total_received > 0);
+        }
+        fresh = true;
+    } while (warm && total_received == 0 && warm_dropped(ret));
+    
+    buffer[total_received] = '\0';
+    
+    if (ret < 0) {
+        return ret;
+    }
+    
+    if (total_received >= buffer_size - 1) {
+        LOG_WRN("Response truncated at %zu bytes, use gopher_fetch() for large items",
+                buffer_size - 1);
+    }
+    
+    /* Update history if we got data */
+    if (total_received > 0) {
+        record_history(client, selector);
+    }
+    
+    return total_received;
+}
+
+/* Stream the response for a selector through a sink callback, optionally
+ * recording the selector in the navigation history */
+static int fetch(struct gopher_client *client, const char *selector,
+                 gopher_sink_t sink, void *user_data, bool record)
+{
+    int sock;
+    int ret = 0;
+    size_t total_received = 0;
+    bool warm;
+    bool fresh = false;
+    uint8_t chunk[GOPHER_RECV_CHUNK_SIZE];
+    
+    if (client == NULL || sink == NULL) {
+        return -EINVAL;
+    }
+    
+    do {
+        sock = open_request(client, selector, fresh, &warm);
+        if (sock < 0) {
+            return sock;
+        }
+        ret = 0;
         
-        /* Extract port string with bounds checking */
-        if (len > 0) {
-            strncpy(port_str, field_start, len);
-            port_str[len] = '\0';
+        /* Hand each received chunk to the sink as-is, there is no size ceiling */
+        while (true) {
+            int bytes_read = recv_poll(client, sock, chunk, sizeof(chunk));
+            if (bytes_read <= 0) {
+                /* Only the server closing the connection ends a response;
+                   a stall or error, even after some data, means the sink
+                   saw part of it */
+                ret = bytes_read;
+                break;
+            }
+            
+            total_received += bytes_read;
             
-            /* Convert to integer with error handling */
-            long port_val = strtol(port_str, NULL, 10);
-            if (port_val <= 0 || port_val > UINT16_MAX) {
-                /* Invalid port, use default */
-                client->items[count].port = GOPHER_DEFAULT_PORT;
-            } else {
-                client->items[count].port = (uint16_t)port_val;
+            ret = sink(chunk, bytes_read, user_data);
+            if (ret != 0) {
+                /* Positive means the sink has seen enough, negative is an error */
+                break;
             }
-        } else {
-            /* No port specified, use default */
-            client->items[count].port = GOPHER_DEFAULT_PORT;
         }
         
-        /* Check for Gopher+ attributes - we'll ignore them for now */
+        zsock_close(sock);
         
-        /* Increment count and move to next line */
-        count++;
-        if (line_end + 2 <= buffer_end) {
-            line_start = line_end + 2;
-        } else {
-            /* We've reached the end */
+        /* Nothing reached the sink yet, so a pre-opened connection the
+           server had dropped can be retried transparently on a fresh one */
+        if (warm) {
+            warm_result(client, total_received > 0);
+        }
+        fresh = true;
+    } while (warm && total_received == 0 && warm_dropped(ret));
+    
+    if (ret < 0) {
+        return ret;
+    }
+    
+    if (record && total_received > 0) {
+        record_history(client, selector);
+    }
+    
+    return (int)MIN(total_received, INT_MAX);
+}
+
+int gopher_fetch(struct gopher_client *client, const char *selector,
+                 gopher_sink_t sink, void *user_data)
+{
+    return fetch(client, selector, sink, user_data, true);
+}
+
+int gopher_fetch_background(struct gopher_client *client, const char *selector,
+                            gopher_sink_t sink, void *user_data)
+{
+    return fetch(client, selector, sink, user_data, false);
+}
+
+void gopher_cancel(struct gopher_client *client)
+{
+    if (client != NULL) {
+        atomic_set(&client->cancel, 1);
+    }
+}
+
+void gopher_cancel_clear(struct gopher_client *client)
+{
+    if (client != NULL) {
+        atomic_clear(&client->cancel);
+    }
+}
+
+/* Basic history update function - can be used for direct history management */
+int gopher_update_history(struct gopher_client *client, const char *selector)
+{
+    if (client == NULL) {
+        return -EINVAL;
+    }
+    
+    record_history(client, selector);
+    
+    return 0;
+}
+
+/* Check if a character is a valid item type according to RFC 1436 */
+static bool is_item_type(char c)
+{
+    return c == GOPHER_TYPE_TEXT ||
+           c == GOPHER_TYPE_DIRECTORY ||
+           c == GOPHER_TYPE_CSO ||
+           c == GOPHER_TYPE_ERROR ||
+           c == GOPHER_TYPE_BINHEX ||
+           c == GOPHER_TYPE_DOS ||
+           c == GOPHER_TYPE_UUENCODED ||
+           c == GOPHER_TYPE_SEARCH ||
+           c == GOPHER_TYPE_TELNET ||
+           c == GOPHER_TYPE_BINARY ||
+           c == GOPHER_TYPE_REDUNDANT ||
+           c == GOPHER_TYPE_TN3270 ||
+           c == GOPHER_TYPE_GIF ||
+           c == GOPHER_TYPE_IMAGE ||
+           c == 'i';
+}
+
+/* Reset a menu to an empty listing */
+static void menu_reset(struct gopher_menu *menu)
+{
+    /* Offset 0 holds the empty string shared by all empty fields */
+    menu->arena[0] = '\0';
+    menu->arena_used = 1;
+    menu->host_count = 0;
+    menu->truncated = false;
+}
+
+/* Append a string to the menu arena, truncated to max_len - 1 characters.
+ * Returns the arena offset, or -ENOMEM if the arena is full. */
+static int arena_add(struct gopher_menu *menu, const char *str, size_t len, size_t max_len)
+{
+    size_t offset = menu->arena_used;
+    
+    if (len == 0) {
+        return 0;
+    }
+    
+    if (len >= max_len) {
+        len = max_len - 1;
+    }
+    
+    if (offset + len + 1 > GOPHER_MENU_ARENA_SIZE) {
+        return -ENOMEM;
+    }
+    
+    memcpy(&menu->arena[offset], str, len);
+    menu->arena[offset + len] = '\0';
+    menu->arena_used = offset + len + 1;
+    
+    return offset;
+}
+
+/* Intern a hostname so that items on the same server share one copy.
+ * Returns the arena offset, or -ENOMEM if the arena is full. */
+static int intern_host(struct gopher_menu *menu, const char *host, size_t len)
+{
+    int offset;
+    
+    if (len >= GOPHER_MAX_HOSTNAME_LEN) {
+        len = GOPHER_MAX_HOSTNAME_LEN - 1;
+    }
+    
+    for (int i = 0; i < menu->host_count; i++) {
+        const char *known = &menu->arena[menu->hosts[i]];
+        
+        if (strncmp(known, host, len) == 0 && known[len] == '\0') {
+            return menu->hosts[i];
+        }
+    }
+    
+    offset = arena_add(menu, host, len, GOPHER_MAX_HOSTNAME_LEN);
+    
+    /* Remember it if there is room, otherwise the string is simply not shared */
+    if (offset > 0 && menu->host_count < GOPHER_MAX_MENU_HOSTS) {
+        menu->hosts[menu->host_count++] = offset;
+    }
+    
+    return offset;
+}
+
+/* Store a parsed item in the client's menu. Returns false if the menu is full;
+ * once an item has not fit, no later one is stored either, so the items kept
+ * are numbered as the server sent them. */
+static bool menu_add(struct gopher_client *client, char type,
+                     const char *display, size_t display_len,
+                     const char *selector, size_t selector_len,
+                     const char *host, size_t host_len, uint16_t port)
+{
+    struct gopher_menu *menu = &client->menu;
+    struct gopher_menu_entry *entry;
+    size_t arena_mark = menu->arena_used;
+    uint8_t host_mark = menu->host_count;
+    int display_off, selector_off, host_off;
+    
+    if (menu->truncated) {
+        return false;
+    }
+    
+    if (client->item_count >= GOPHER_MAX_DIR_ITEMS) {
+        LOG_WRN("Listing cut short at %d items", client->item_count);
+        menu->truncated = true;
+        return false;
+    }
+    
+    display_off = arena_add(menu, display, display_len, GOPHER_MAX_SELECTOR_LEN);
+    selector_off = arena_add(menu, selector, selector_len, GOPHER_MAX_SELECTOR_LEN);
+    host_off = intern_host(menu, host, host_len);
+    
+    if (display_off < 0 || selector_off < 0 || host_off < 0) {
+        /* Out of arena space, drop the partially stored item */
+        menu->arena_used = arena_mark;
+        menu->host_count = host_mark;
+        LOG_WRN("Listing cut short at %d items, no room for their text", client->item_count);
+        menu->truncated = true;
+        return false;
+    }
+    
+    entry = &menu->entries[client->item_count];
+    entry->type = type;
+    entry->display_off = display_off;
+    entry->selector_off = selector_off;
+    entry->host_off = host_off;
+    entry->port = port;
+    
+    return true;
+}
+
+/* Parse one complete menu line (without line terminator) into the next item slot.
+ * Returns true if an item was stored. */
+static bool parse_menu_line(struct gopher_dir_parser *parser, const char *line, size_t len)
+{
+    struct gopher_client *client = parser->client;
+    const char *line_end = line + len;
+    const char *field_start;
+    const char *field_end;
+    const char *display, *selector, *host;
+    size_t display_len, selector_len, host_len;
+    char type;
+    uint16_t port;
+    
+    /* Skip empty lines */
+    if (len == 0) {
+        return false;
+    }
+    
+    type = line[0];
+    
+    /* Get display string (first field) */
+    field_start = line + 1;
+    field_end = memchr(field_start, '\t', line_end - field_start);
+    if (field_end == NULL) {
+        /* For info items (type 'i'), we can tolerate missing tabs 
+           This makes the client more compatible with non-standard servers */
+        if (type != 'i') {
+            /* Invalid format for non-info items, skip this line */
+            return false;
+        }
+        
+        /* Use the whole line as the display string and empty values for other fields */
+        return menu_add(client, type, field_start, line_end - field_start, "", 0,
+                        client->hostname, strlen(client->hostname), client->port);
+    }
+    display = field_start;
+    display_len = field_end - field_start;
+    
+    /* Get selector (second field) */
+    field_start = field_end + 1;
+    field_end = memchr(field_start, '\t', line_end - field_start);
+    if (field_end == NULL) {
+        return false;
+    }
+    selector = field_start;
+    selector_len = field_end - field_start;
+    
+    /* Get hostname (third field) */
+    field_start = field_end + 1;
+    field_end = memchr(field_start, '\t', line_end - field_start);
+    if (field_end == NULL) {
+        return false;
+    }
+    host = field_start;
+    host_len = field_end - field_start;
+    
+    /* Get port (fourth field), any Gopher+ attributes after it are ignored */
+    char port_str[16];
+    size_t port_len = MIN((size_t)(line_end - field_end - 1), sizeof(port_str) - 1);
+    
+    memcpy(port_str, field_end + 1, port_len);
+    port_str[port_len] = '\0';
+    
+    long port_val = strtol(port_str, NULL, 10);
+    if (port_val <= 0 || port_val > UINT16_MAX) {
+        /* Missing or invalid port, use default */
+        port = GOPHER_DEFAULT_PORT;
+    } else {
+        port = (uint16_t)port_val;
+    }
+    
+    return menu_add(client, type, display, display_len, selector, selector_len,
+                    host, host_len, port);
+}
+
+/* Longest part kept of each field of a menu line: the type and display
+ * string, the selector, the hostname and the port */
+static const size_t line_field_max[] = {
+    GOPHER_MAX_SELECTOR_LEN,
+    GOPHER_MAX_SELECTOR_LEN - 1,
+    GOPHER_MAX_HOSTNAME_LEN - 1,
+    GOPHER_MAX_PORT_FIELD_LEN,
+};
+
+/* Add part of a line to the one being collected, cutting fields short
+ * where they do not fit an item */
+static void collect_line(struct gopher_dir_parser *parser, const uint8_t *data, size_t len)
+{
+    const uint8_t *end = data + len;
+    
+    while (data < end) {
+        const uint8_t *tab = memchr(data, '\t', end - data);
+        const uint8_t *field_end = tab ? tab : end;
+        size_t room = 0;
+        size_t n;
+        
+        if (parser->field < ARRAY_SIZE(line_field_max)) {
+            room = line_field_max[parser->field] - parser->field_len;
+        }
+        n = MIN((size_t)(field_end - data), room);
+        memcpy(parser->line + parser->line_len, data, n);
+        parser->line_len += n;
+        parser->field_len += n;
+        data = field_end;
+        
+        if (tab != NULL) {
+            /* The tab after the port only leads to Gopher+ fields */
+            if (parser->field < ARRAY_SIZE(line_field_max) - 1) {
+                parser->line[parser->line_len++] = '\t';
+            }
+            parser->field++;
+            parser->field_len = 0;
+            data++;
+        }
+    }
+}
+
+/* Handle a complete line assembled by the parser */
+static void finish_line(struct gopher_dir_parser *parser)
+{
+    const char *line = parser->line;
+    size_t len = parser->line_len;
+    
+    parser->line_len = 0;
+    parser->field = 0;
+    parser->field_len = 0;
+    
+    /* Tolerate CRLF as well as bare LF line endings */
+    if (len > 0 && line[len - 1] == '\r') {
+        len--;
+    }
+    
+    /* The first line decides whether this is a directory listing at all: it needs
+       a valid item type and tab separated fields, or any text starting with
+       an item type would be taken for one */
+    if (parser->first_line) {
+        parser->first_line = false;
+        if (len == 0 || memchr(line, '\t', len) == NULL) {
+            parser->state = GOPHER_DIR_NOT_MENU;
+            return;
+        }
+    }
+    
+    /* Check if this is the terminating period */
+    if (len == 1 && line[0] == '.') {
+        parser->state = GOPHER_DIR_DONE;
+        return;
+    }
+    
+    if (parse_menu_line(parser, line, len)) {
+        struct gopher_client *client = parser->client;
+        int index = client->item_count++;
+        
+        if (parser->on_item != NULL) {
+            struct gopher_item item;
+            
+            gopher_get_item(client, index, &item);
+            parser->on_item(&item, index, parser->user_data);
+        }
+    }
+}
+
+/* Start an incremental parse of a directory listing */
+void gopher_dir_parser_init(struct gopher_dir_parser *parser, struct gopher_client *client,
+                            gopher_item_cb_t on_item, void *user_data)
+{
+    parser->client = client;
+    parser->on_item = on_item;
+    parser->user_data = user_data;
+    parser->state = GOPHER_DIR_DETECT;
+    parser->first_line = true;
+    parser->line_len = 0;
+    parser->field = 0;
+    parser->field_len = 0;
+    
+    /* Start with clean slate, the previous listing is discarded */
+    client->item_count = 0;
+    menu_reset(&client->menu);
+}
+
+/* Feed a chunk of response data to the parser */
+int gopher_dir_parser_feed(struct gopher_dir_parser *parser, const uint8_t *data, size_t len)
+{
+    const uint8_t *end = data + len;
+    
+    while (data < end) {
+        switch (parser->state) {
+        case GOPHER_DIR_DETECT:
+            /* If the first character isn't a valid Gopher item type,
+               it's probably a text file, not a directory listing */
+            if (!is_item_type((char)*data)) {
+                parser->state = GOPHER_DIR_NOT_MENU;
+                break;
+            }
+            parser->state = GOPHER_DIR_LINE;
+            break;
+            
+        case GOPHER_DIR_LINE: {
+            /* Collect up to the end of line, or the whole chunk if the line continues */
+            const uint8_t *eol = memchr(data, '\n', end - data);
+            const uint8_t *stop = eol ? eol : end;
+                
+            collect_line(parser, data, stop - data);
+            data = stop;
+                
+            if (eol != NULL) {
+                data++;
+                finish_line(parser);
+            }
             break;
         }
+            
+        case GOPHER_DIR_DONE:
+        case GOPHER_DIR_NOT_MENU:
+        default:
+            /* Nothing more to parse */
+            return parser->client->item_count;
+        }
+    }
+    
+    return parser->client->item_count;
+}
+
+/* Flush a final unterminated line and finish the parse */
+int gopher_dir_parser_finish(struct gopher_dir_parser *parser)
+{
+    if (parser->state == GOPHER_DIR_LINE && parser->line_len > 0) {
+        finish_line(parser);
+    }
+    
+    if (parser->state == GOPHER_DIR_NOT_MENU || parser->state == GOPHER_DIR_DETECT) {
+        /* Not a directory listing, it should be treated as a text file */
+        parser->client->item_count = 0;
+        return 0;
     }
     
-    client->item_count = count;
-    /* Directory parsing complete */
-    return count;
+    /* The state stays short of GOPHER_DIR_DONE without the terminating
+       period, telling a cut off listing from a whole one */
+    return parser->client->item_count;
+}
+
+/* Parse a complete directory listing held in a buffer */
+int gopher_parse_directory(struct gopher_client *client, const char *buffer)
+{
+    struct gopher_dir_parser parser;
+    
+    /* Critical safety check */
+    if (client == NULL || buffer == NULL) {
+        return -EINVAL;
+    }
+    
+    gopher_dir_parser_init(&parser, client, NULL, NULL);
+    gopher_dir_parser_feed(&parser, (const uint8_t *)buffer, strlen(buffer));
+    
+    return gopher_dir_parser_finish(&parser);
+}
+
+/* Get a view of a directory item */
+int gopher_get_item(const struct gopher_client *client, int index, struct gopher_item *item)
+{
+    const struct gopher_menu_entry *entry;
+    
+    if (client == NULL || item == NULL || index < 0 || index >= client->item_count) {
+        return -EINVAL;
+    }
+    
+    entry = &client->menu.entries[index];
+    item->type = entry->type;
+    item->display_string = &client->menu.arena[entry->display_off];
+    item->selector = &client->menu.arena[entry->selector_off];
+    item->hostname = &client->menu.arena[entry->host_off];
+    item->port = entry->port;
+    
+    return 0;
 }
 
 /* Get string representation of item type */
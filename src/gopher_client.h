@@ -7,9 +7,16 @@
 #define GOPHER_CLIENT_H_
 
 #include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
 
 /* Maximum number of items in a directory listing */
-#define GOPHER_MAX_DIR_ITEMS 64
+#define GOPHER_MAX_DIR_ITEMS 1024
+
+/* Size of the string arena holding the text of a directory listing */
+#define GOPHER_MENU_ARENA_SIZE 26624
+
+/* Number of distinct hostnames interned per directory listing */
+#define GOPHER_MAX_MENU_HOSTS 16
 
 /* Maximum length of selector strings */
 #define GOPHER_MAX_SELECTOR_LEN 256
@@ -17,12 +24,55 @@
 /* Maximum length of a server hostname */
 #define GOPHER_MAX_HOSTNAME_LEN 64
 
+/* Longest port field of a menu line kept, carriage return included */
+#define GOPHER_MAX_PORT_FIELD_LEN 16
+
+/* Longest menu line kept: type and display string, selector, hostname and
+ * port with the tabs between them. Longer fields are cut short, Gopher+
+ * fields after the port are dropped. */
+#define GOPHER_MAX_LINE_LEN (GOPHER_MAX_SELECTOR_LEN + (GOPHER_MAX_SELECTOR_LEN - 1) + \
+                             (GOPHER_MAX_HOSTNAME_LEN - 1) + GOPHER_MAX_PORT_FIELD_LEN + 3)
+
 /* Default Gopher port */
 #define GOPHER_DEFAULT_PORT 70
 
 /* Maximum buffer size for responses (increased for better image handling) */
 #define GOPHER_BUFFER_SIZE 16384
 
+/* Size of each receive chunk handed to a streaming sink */
+#define GOPHER_RECV_CHUNK_SIZE 1024
+
+/* A transfer is abandoned when the server sends nothing for this long */
+#define GOPHER_RECV_IDLE_TIMEOUT_MS 15000
+
+/* Socket waits are split into slices of this length to notice cancellation */
+#define GOPHER_POLL_INTERVAL_MS 100
+
+/* Connect, send and receive timeout */
+#define GOPHER_IO_TIMEOUT_MS 5000
+
+/* Pre-opened connections older than this are not used */
+#define GOPHER_WARM_CONN_MAX_AGE_MS 10000
+
+/* Dropped pre-opened connections in a row before a server stops getting them */
+#define GOPHER_WARM_CONN_MAX_MISSES 2
+
+/* Number of servers whose connection behaviour is remembered */
+#define GOPHER_MAX_SERVER_CAPS 4
+
+/* Number of hostnames kept in the resolved-address cache */
+#define GOPHER_DNS_CACHE_SIZE 16
+
+/* Lifetime of resolved addresses (the resolver API does not expose record TTLs) */
+#define GOPHER_DNS_TTL_MS (5 * 60 * 1000)
+
+/* Lifetime of failed lookups */
+#define GOPHER_DNS_NEGATIVE_TTL_MS (30 * 1000)
+
+/* Stack size and priority of the background resolver */
+#define GOPHER_DNS_STACK_SIZE 2048
+#define GOPHER_DNS_PRIORITY K_PRIO_PREEMPT(10)
+
 /* Item type definitions per RFC 1436 */
 #define GOPHER_TYPE_TEXT '0'
 #define GOPHER_TYPE_DIRECTORY '1'
@@ -39,13 +89,66 @@
 #define GOPHER_TYPE_GIF 'g'
 #define GOPHER_TYPE_IMAGE 'I'
 
-/* Structure to represent a Gopher item */
+/* View of a Gopher item, strings point into the directory listing and stay
+ * valid until the listing is replaced */
 struct gopher_item {
     char type;
-    char display_string[GOPHER_MAX_SELECTOR_LEN];
-    char selector[GOPHER_MAX_SELECTOR_LEN];
+    const char *display_string;
+    const char *selector;
+    const char *hostname;
+    uint16_t port;
+};
+
+/* Compact directory entry, strings are offsets into the menu arena */
+struct gopher_menu_entry {
+    uint16_t display_off;
+    uint16_t selector_off;
+    uint16_t host_off;
+    uint16_t port;
+    char type;
+};
+
+/* Directory listing: fixed size entries plus one arena for all strings.
+ * Offset 0 of the arena is the empty string, hostnames are interned. */
+struct gopher_menu {
+    struct gopher_menu_entry entries[GOPHER_MAX_DIR_ITEMS];
+    uint16_t hosts[GOPHER_MAX_MENU_HOSTS];
+    uint8_t host_count;
+    uint16_t arena_used;
+    bool truncated;             /* An item did not fit, the ones after it were dropped */
+    char arena[GOPHER_MENU_ARENA_SIZE];
+};
+
+/* State of a pre-opened connection */
+enum gopher_conn_state {
+    GOPHER_CONN_NONE = 0,    /* No connection */
+    GOPHER_CONN_CONNECTING,  /* Connect started, may already be established */
+};
+
+/* Connection opened ahead of the next request */
+struct gopher_conn {
+    enum gopher_conn_state state;
+    int sock;
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];
+    uint16_t port;
+    int64_t opened_at;
+};
+
+/* What has been learnt about a server's connection handling */
+struct gopher_server_caps {
     char hostname[GOPHER_MAX_HOSTNAME_LEN];
     uint16_t port;
+    uint16_t connect_ms;     /* Smoothed connection setup time */
+    uint32_t warm_hits;      /* Requests served on a pre-opened connection */
+    uint8_t warm_misses;     /* Pre-opened connections dropped in a row */
+    bool warm_disabled;      /* Server drops idle connections, don't pre-open */
+    int64_t last_used;
+};
+
+/* Connection manager state, kept when switching servers */
+struct gopher_conn_mgr {
+    struct gopher_conn warm;
+    struct gopher_server_caps servers[GOPHER_MAX_SERVER_CAPS];
 };
 
 /* Structure to represent the Gopher client state */
@@ -56,9 +159,13 @@ struct gopher_client {
     
     /* Connection status */
     bool connected;
+    struct gopher_conn_mgr conn;
+    
+    /* Set by gopher_cancel() to abort the transfer in progress */
+    atomic_t cancel;
     
     /* Last directory listing */
-    struct gopher_item items[GOPHER_MAX_DIR_ITEMS];
+    struct gopher_menu menu;
     int item_count;
     
     /* Navigation history */
@@ -67,6 +174,38 @@ struct gopher_client {
     int history_count;
 };
 
+/**
+ * @brief Callback invoked for each menu item as soon as its line is parsed
+ *
+ * @param item View of the parsed item, stored in the client's listing
+ * @param index Position of the item in the client's item list
+ * @param user_data Opaque pointer passed to gopher_dir_parser_init()
+ */
+typedef void (*gopher_item_cb_t)(const struct gopher_item *item, int index, void *user_data);
+
+/* States of the incremental directory parser */
+enum gopher_dir_state {
+    GOPHER_DIR_DETECT,   /* Waiting for the first byte of the response */
+    GOPHER_DIR_LINE,     /* Collecting a menu line */
+    GOPHER_DIR_DONE,     /* Terminating period seen */
+    GOPHER_DIR_NOT_MENU, /* Response is not a directory listing */
+};
+
+/* Incremental (push-mode) directory parser state */
+struct gopher_dir_parser {
+    struct gopher_client *client;
+    gopher_item_cb_t on_item;
+    void *user_data;
+    enum gopher_dir_state state;
+    bool first_line;
+    
+    /* Partial line carried across chunk boundaries */
+    char line[GOPHER_MAX_LINE_LEN];
+    size_t line_len;
+    uint8_t field;              /* Field of the line being collected */
+    size_t field_len;           /* Bytes of it kept so far */
+};
+
 /**
  * @brief Initialize the Gopher client
  *
@@ -78,6 +217,11 @@ int gopher_client_init(struct gopher_client *client);
 /**
  * @brief Connect to a Gopher server
  *
+ * Resolves the server and starts opening a connection in the background.
+ * Gopher servers close the connection after every response, so the client
+ * keeps one connection open ahead of the next request instead, for servers
+ * that tolerate idle connections.
+ *
  * @param client Pointer to the client structure
  * @param hostname Server hostname
  * @param port Server port (use 0 for default)
@@ -85,22 +229,103 @@ int gopher_client_init(struct gopher_client *client);
  */
 int gopher_connect(struct gopher_client *client, const char *hostname, uint16_t port);
 
+/**
+ * @brief Close any pre-opened connection and mark the client disconnected
+ *
+ * @param client Pointer to the client structure
+ */
+void gopher_disconnect(struct gopher_client *client);
+
+/**
+ * @brief Abort the transfer in progress on a client
+ *
+ * Safe to call from any thread. Socket waits notice the request within
+ * GOPHER_POLL_INTERVAL_MS and the transfer returns -ECANCELED. The flag
+ * stays set until gopher_cancel_clear() is called.
+ *
+ * @param client Pointer to the client structure
+ */
+void gopher_cancel(struct gopher_client *client);
+
+/**
+ * @brief Clear a cancellation request before starting a new transfer
+ *
+ * @param client Pointer to the client structure
+ */
+void gopher_cancel_clear(struct gopher_client *client);
+
+/**
+ * @brief Callback receiving response data as it arrives from the server
+ *
+ * @param data Received bytes, only valid for the duration of the call
+ * @param len Number of bytes in data
+ * @param user_data Opaque pointer passed to gopher_fetch()
+ * @return 0 to keep receiving, positive to stop early, negative errno to abort
+ */
+typedef int (*gopher_sink_t)(const uint8_t *data, size_t len, void *user_data);
+
 /**
  * @brief Send a selector to the server and receive the response
  *
+ * The response is truncated to buffer_size - 1 bytes; use gopher_fetch()
+ * for items that may be larger. A transfer that stalls or fails after some
+ * data returns the error, and the buffer then holds only part of the
+ * response.
+ *
  * @param client Pointer to the client structure
  * @param selector Selector string to send
  * @param buffer Buffer to store the response
  * @param buffer_size Size of the buffer
- * @return Size of received data on success, negative errno otherwise
+ * @return Size of received data once the server closed the connection or
+ *         the buffer is full, negative errno otherwise
  */
 int gopher_send_selector(struct gopher_client *client, const char *selector, 
                          char *buffer, size_t buffer_size);
 
 /**
- * @brief [DEPRECATED] Update navigation history with a new selector
- * This function is now a stub - history management is handled directly in gopher_send_selector
- * 
+ * @brief Send a selector to the server and stream the response to a sink
+ *
+ * Each received chunk is passed to the sink straight from the receive
+ * buffer, so there is no intermediate copy and no limit on response size.
+ *
+ * A count means the server closed the connection after the whole response,
+ * or the sink stopped the transfer itself. A transfer that stalls or fails
+ * part way returns the error even though the sink has seen some of the
+ * data, so a partial response is never taken for a whole one.
+ *
+ * @param client Pointer to the client structure
+ * @param selector Selector string to send (NULL for the root)
+ * @param sink Callback invoked for every received chunk
+ * @param user_data Opaque pointer passed to the sink
+ * @return Number of bytes received once the server has closed the
+ *         connection or the sink has stopped the transfer, -ECANCELED after
+ *         gopher_cancel(), negative errno otherwise
+ */
+int gopher_fetch(struct gopher_client *client, const char *selector,
+                 gopher_sink_t sink, void *user_data);
+
+/**
+ * @brief Stream a response like gopher_fetch(), without recording the
+ *        selector in the navigation history
+ *
+ * For fetches the user did not ask for, such as prefetching.
+ *
+ * @param client Pointer to the client structure
+ * @param selector Selector string to send (NULL for the root)
+ * @param sink Callback invoked for every received chunk
+ * @param user_data Opaque pointer passed to the sink
+ * @return Number of bytes received on success, -ECANCELED after
+ *         gopher_cancel(), negative errno otherwise
+ */
+int gopher_fetch_background(struct gopher_client *client, const char *selector,
+                            gopher_sink_t sink, void *user_data);
+
+/**
+ * @brief Record a selector in the navigation history
+ *
+ * Fetches record their selector themselves; this is for responses served
+ * without the network, e.g. from the response cache.
+ *
  * @param client Pointer to the client structure
  * @param selector Selector string to add to history
  * @return 0 on success, negative errno otherwise
@@ -116,6 +341,113 @@ int gopher_update_history(struct gopher_client *client, const char *selector);
  */
 int gopher_parse_directory(struct gopher_client *client, const char *buffer);
 
+/**
+ * @brief Start an incremental parse of a directory listing
+ *
+ * Items are stored in the client's item list, replacing the previous listing.
+ *
+ * @param parser Pointer to the parser state
+ * @param client Pointer to the client structure
+ * @param on_item Callback invoked for each parsed item (may be NULL)
+ * @param user_data Opaque pointer passed to the callback
+ */
+void gopher_dir_parser_init(struct gopher_dir_parser *parser, struct gopher_client *client,
+                            gopher_item_cb_t on_item, void *user_data);
+
+/**
+ * @brief Feed a chunk of response data to the directory parser
+ *
+ * Chunks may split lines anywhere; partial lines are carried over to the
+ * next call. Suitable for use directly from a gopher_fetch() sink.
+ *
+ * @param parser Pointer to the parser state
+ * @param data Received bytes
+ * @param len Number of bytes in data
+ * @return Number of items parsed so far
+ */
+int gopher_dir_parser_feed(struct gopher_dir_parser *parser, const uint8_t *data, size_t len);
+
+/**
+ * @brief Finish an incremental parse, flushing any unterminated last line
+ *
+ * The parser's state is GOPHER_DIR_DONE afterwards only if the listing
+ * ended with its terminating period.
+ *
+ * @param parser Pointer to the parser state
+ * @return Number of items parsed, 0 if the response is not a directory listing
+ */
+int gopher_dir_parser_finish(struct gopher_dir_parser *parser);
+
+/**
+ * @brief Get a view of an item of the current directory listing
+ *
+ * @param client Pointer to the client structure
+ * @param index Item index, 0 to item_count - 1
+ * @param item Filled with pointers into the listing
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_get_item(const struct gopher_client *client, int index, struct gopher_item *item);
+
+/**
+ * @brief Get the type of an item of the current directory listing
+ *
+ * @param client Pointer to the client structure
+ * @param index Item index, 0 to item_count - 1
+ * @return Item type character
+ */
+static inline char gopher_item_type(const struct gopher_client *client, int index)
+{
+    return client->menu.entries[index].type;
+}
+
+/**
+ * @brief Callback reporting one resolved-address cache entry
+ *
+ * @param hostname Cached hostname
+ * @param addr Resolved address, NULL for failed or pending lookups
+ * @param status 0 if resolved, -EINPROGRESS if queued, negative errno if failed
+ * @param ttl_ms Remaining lifetime of the entry in milliseconds
+ * @param user_data Opaque pointer passed to gopher_dns_foreach()
+ */
+typedef void (*gopher_dns_entry_cb_t)(const char *hostname, const struct in_addr *addr,
+                                      int status, int64_t ttl_ms, void *user_data);
+
+/**
+ * @brief Resolve a hostname to an IPv4 address through the resolved-address cache
+ *
+ * Successful lookups are cached for GOPHER_DNS_TTL_MS and failures for
+ * GOPHER_DNS_NEGATIVE_TTL_MS. Literal addresses are parsed without a lookup.
+ *
+ * @param hostname Hostname or dotted IPv4 address
+ * @param addr Filled with the resolved address
+ * @return 0 on success, negative errno otherwise
+ */
+int gopher_dns_resolve(const char *hostname, struct in_addr *addr);
+
+/**
+ * @brief Resolve the distinct hostnames of the current listing in the background
+ *
+ * @param client Pointer to the client structure
+ * @return Number of hostnames queued, negative errno otherwise
+ */
+int gopher_dns_prefetch(const struct gopher_client *client);
+
+/**
+ * @brief Drop all entries of the resolved-address cache
+ */
+void gopher_dns_flush(void);
+
+/**
+ * @brief Report every entry of the resolved-address cache
+ *
+ * The callback runs with the cache locked and must not call other
+ * gopher_dns_* functions.
+ *
+ * @param cb Callback invoked for each entry
+ * @param user_data Opaque pointer passed to the callback
+ */
+void gopher_dns_foreach(gopher_dns_entry_cb_t cb, void *user_data);
+
 /**
  * @brief Get string representation of item type
  * 
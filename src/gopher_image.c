@@ -11,106 +11,152 @@
 #include <errno.h>
 #include <ctype.h>
 #include "gopher_image.h"
+#include "gopher_scale.h"
+#include "gopher_mem.h"
+#include "gopher_out.h"
 
 #include <zephyr/sys/util.h>
 
-/* Check if SPIRAM is available */
-#ifdef CONFIG_ESP_SPIRAM
-/* With SPIRAM enabled, we can use much more memory */
-#define LARGE_MEMORY_AVAILABLE 1
-/* Include the shared multi-heap API for PSRAM access */
-#include <zephyr/multi_heap/shared_multi_heap.h>
-#include <zephyr/logging/log.h>
-#else
-#define LARGE_MEMORY_AVAILABLE 0
-#endif
-
-/* Helper function to allocate memory, using PSRAM if available */
-static void *memory_alloc(size_t size, const struct shell *shell) {
-    void *ptr = NULL;
-
-    /* For debugging - temporary force system heap for small allocations */
-    if (size < 50000) {
-        ptr = k_malloc(size);
-        if (ptr && shell) {
-            shell_print(shell, "FORCING small allocation of %zu bytes from system heap", size);
+/* Register logging module after all Zephyr includes */
+LOG_MODULE_REGISTER(gopher_image, LOG_LEVEL_ERR);
+
+/* Everything a picture needs while it is decoded and drawn comes from one
+ * block, reserved on first use and kept, and is handed out by bumping an
+ * offset. Each block is preceded by a header linking it to the one before,
+ * so blocks freed in reverse order are given back at once, which is how
+ * stb_image and the pipeline mostly free them. Anything else is reclaimed
+ * when the session ends, by setting the offset back to zero. */
+struct arena_header {
+    uint32_t prev;              /* Offset of the previous block's header */
+    uint32_t freed;
+};
+
+#define ARENA_ALIGN sizeof(struct arena_header)
+
+static struct {
+    uint8_t *base;
+    size_t used;
+    size_t last;                /* Header of the most recent block, if used > 0 */
+    size_t peak;
+    int sessions;               /* Nesting of image_arena_begin() calls */
+} arena;
+
+/* Output of the picture being drawn; like the arena, there is one drawing
+ * at a time. Written to the shell a frame at a time, in whole buffers. */
+static struct gopher_out image_out;
+
+/* Start drawing a picture; sessions nest, and blocks live until the
+ * outermost one ends */
+static int image_arena_begin(void) {
+    if (!arena.base) {
+        arena.base = gopher_mem_alloc(GOPHER_MEM_IMAGE, GOPHER_IMAGE_ARENA_SIZE, GOPHER_MEM_BULK);
+        if (!arena.base) {
+            return -ENOMEM;
         }
-        return ptr;
     }
+    
+    arena.sessions++;
+    
+    return 0;
+}
 
-#ifdef CONFIG_ESP_SPIRAM
-    if (LARGE_MEMORY_AVAILABLE) {
-        /* Try PSRAM allocation first */
-        ptr = shared_multi_heap_alloc(SMH_REG_ATTR_EXTERNAL, size);
-        if (ptr && shell) {
-            shell_print(shell, "Allocated %zu bytes from PSRAM at %p", size, ptr);
-            
-            /* Perform a sanity check by writing to and reading from the first bytes */
-            if (size >= 4) {
-                /* Write a known pattern */
-                char *test = (char*)ptr;
-                test[0] = 'T';
-                test[1] = 'E';
-                test[2] = 'S';
-                test[3] = 'T';
-                
-                /* Read it back to verify memory access */
-                if (test[0] != 'T' || test[1] != 'E' || test[2] != 'S' || test[3] != 'T') {
-                    if (shell) {
-                        shell_error(shell, "Memory verification failed! Got: %c%c%c%c",
-                                  test[0], test[1], test[2], test[3]);
-                    }
-                    /* Free and force normal heap */
-                    shared_multi_heap_free(ptr);
-                    ptr = NULL;
-                } else if (shell) {
-                    shell_print(shell, "PSRAM memory verification succeeded");
-                }
-            }
-        }
+static void image_arena_end(void) {
+    if (--arena.sessions > 0) {
+        return;
     }
+    
+    LOG_DBG("Image arena peak %zu of %d bytes", arena.peak, GOPHER_IMAGE_ARENA_SIZE);
+    arena.used = 0;
+}
 
-    /* If PSRAM allocation failed or isn't available, try system heap */
-    if (!ptr) {
-        ptr = k_malloc(size);
-        if (ptr && shell) {
-            shell_print(shell, "Allocated %zu bytes from system heap at %p", size, ptr);
-        }
+size_t gopher_image_arena_peak(void) {
+    return arena.peak;
+}
+
+void *gopher_image_alloc(size_t size) {
+    struct arena_header *header;
+    size_t start = arena.used;
+    
+    if (arena.sessions == 0) {
+        return gopher_mem_alloc(GOPHER_MEM_IMAGE, size, 0);
     }
-#else
-    ptr = k_malloc(size);
-    if (ptr && shell) {
-        shell_print(shell, "Allocated %zu bytes from system heap at %p", size, ptr);
+    
+    size = ROUND_UP(size, ARENA_ALIGN);
+    if (size > GOPHER_IMAGE_ARENA_SIZE - sizeof(*header) - start) {
+        LOG_ERR("Image arena exhausted: %zu bytes wanted, %zu in use", size, start);
+        return NULL;
     }
-#endif
-
-    return ptr;
+    
+    header = (struct arena_header *)(arena.base + start);
+    header->prev = arena.last;
+    header->freed = 0;
+    arena.last = start;
+    arena.used = start + sizeof(*header) + size;
+    arena.peak = MAX(arena.peak, arena.used);
+    
+    return header + 1;
 }
 
-/* Helper function to free memory */
-static void memory_free(void *ptr) {
+void gopher_image_free(void *ptr) {
+    struct arena_header *header;
+    
     if (!ptr) {
         return;
     }
+    if ((uint8_t *)ptr < arena.base || (uint8_t *)ptr >= arena.base + GOPHER_IMAGE_ARENA_SIZE) {
+        gopher_mem_free(ptr);
+        return;
+    }
+    
+    header = (struct arena_header *)ptr - 1;
+    header->freed = 1;
+    
+    /* Give back the top of the arena as far as it is free */
+    while (arena.used > 0) {
+        header = (struct arena_header *)(arena.base + arena.last);
+        if (!header->freed) {
+            break;
+        }
+        arena.used = arena.last;
+        arena.last = header->prev;
+    }
+}
 
-#ifdef CONFIG_ESP_SPIRAM
-    /* In Zephyr, shared_multi_heap_free is safe to call on any pointer */
-    shared_multi_heap_free(ptr);
-#else
-    k_free(ptr);
-#endif
+/* Grow or shrink a block, in place if it is the most recent one */
+static void *image_realloc(void *ptr, size_t old_size, size_t size) {
+    void *moved;
+    
+    if (ptr && arena.sessions > 0 && arena.used > 0 &&
+        (uint8_t *)ptr == arena.base + arena.last + sizeof(struct arena_header)) {
+        size_t end = arena.last + sizeof(struct arena_header) + ROUND_UP(size, ARENA_ALIGN);
+        
+        if (end > GOPHER_IMAGE_ARENA_SIZE) {
+            LOG_ERR("Image arena exhausted: %zu bytes wanted, %zu in use", size, arena.used);
+            return NULL;
+        }
+        arena.used = end;
+        arena.peak = MAX(arena.peak, arena.used);
+        return ptr;
+    }
+    
+    moved = gopher_image_alloc(size);
+    if (moved && ptr) {
+        memcpy(moved, ptr, MIN(old_size, size));
+        gopher_image_free(ptr);
+    }
+    
+    return moved;
 }
 
-/* Register logging module after all Zephyr includes */
-LOG_MODULE_REGISTER(gopher_image, LOG_LEVEL_ERR);
+/* stb_image allocates from the arena too */
+#define STBI_MALLOC(size)                           gopher_image_alloc(size)
+#define STBI_REALLOC_SIZED(ptr, old_size, size)     image_realloc(ptr, old_size, size)
+#define STBI_FREE(ptr)                              gopher_image_free(ptr)
 
 /* Define STB_IMAGE implementation in only one file */
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-/* Add global variable for JPEG decoder scale reduction */
-int stbi__jpeg_decode_reduced = 1;
-
 /* ANSI color codes */
 #define COLOR_RESET   "\033[0m"
 #define COLOR_BLACK   "\033[30m"
@@ -136,9 +182,11 @@ int stbi__jpeg_decode_reduced = 1;
 #define ASCII_RAMP " .:-=+*#%@"
 #define ASCII_RAMP_LEN 10
 
-/* Block character set for higher quality (requires Unicode support) */
-#define BLOCK_CHARS " ░▒▓█"
-#define BLOCK_CHARS_LEN 5
+/* Upper and lower half blocks and the full block, in UTF-8 (requires
+ * Unicode support) */
+#define HALF_BLOCK_UPPER "\xe2\x96\x80"
+#define HALF_BLOCK_LOWER "\xe2\x96\x84"
+#define FULL_BLOCK       "\xe2\x96\x88"
 
 /* Terminal color definitions */
 typedef enum {
@@ -168,36 +216,22 @@ static const struct {
     {170, 170, 170, "White"}       /* WHITE */
 };
 
-/* ANSI color codes for foreground */
-static const char *fg_color_codes[COLOR_COUNT] = {
-    COLOR_BLACK, COLOR_RED, COLOR_GREEN, COLOR_YELLOW,
-    COLOR_BLUE, COLOR_MAGENTA, COLOR_CYAN, COLOR_WHITE
-};
-
-/* ANSI color codes for background */
-static const char *bg_color_codes[COLOR_COUNT] = {
-    BG_BLACK, BG_RED, BG_GREEN, BG_YELLOW,
-    BG_BLUE, BG_MAGENTA, BG_CYAN, BG_WHITE
-};
-
-/* Default image processing options */
-static const image_process_options_t default_options = {
-    .maintain_aspect_ratio = true,
-    .use_bilinear_filtering = true,
-    .brightness_adjust = 1.0f,
-    .contrast_adjust = 1.0f
-};
-
 /* Default ASCII art configuration */
 static const ascii_art_config_t default_config = {
     .use_color = true,
     .use_dithering = true,
     .use_extended_chars = false,
-    .color_mode = 8,
+    .color_mode = GOPHER_COLOR_MODE_8,
+    .dither = GOPHER_DITHER_FLOYD_STEINBERG,
     .brightness = 1.0f,
     .contrast = 1.0f
 };
 
+/* Area drawn into when the configuration gives none, in characters: 40x20
+ * pixels two characters wide, or 80x40 pixels as half blocks */
+#define IMAGE_DEFAULT_COLUMNS 80
+#define IMAGE_DEFAULT_LINES   20
+
 /* Helper function to clamp values to 0-255 range */
 static inline uint8_t clamp(int value, int min, int max) {
     return (value < min) ? min : ((value > max) ? max : value);
@@ -209,8 +243,19 @@ static uint8_t rgb_to_gray(uint8_t r, uint8_t g, uint8_t b) {
     return (uint8_t)(0.299f * r + 0.587f * g + 0.114f * b);
 }
 
+/* Colours are matched on 4 bits per channel through a lookup table */
+#define PALETTE_LUT_BITS 4
+#define PALETTE_LUT_INDEX(r, g, b) \
+    ((((r) >> (8 - PALETTE_LUT_BITS)) << (2 * PALETTE_LUT_BITS)) | \
+     (((g) >> (8 - PALETTE_LUT_BITS)) << PALETTE_LUT_BITS) | ((b) >> (8 - PALETTE_LUT_BITS)))
+
+/* Nearest terminal color of each quantised RGB value, filled by
+   gopher_image_init() */
+static uint8_t palette_lut[1 << (3 * PALETTE_LUT_BITS)];
+static bool palette_lut_ready;
+
 /* Map RGB to closest terminal color using weighted Euclidean distance */
-static term_color_t rgb_to_terminal_color(uint8_t r, uint8_t g, uint8_t b) {
+static term_color_t nearest_terminal_color(uint8_t r, uint8_t g, uint8_t b) {
     int best_match = 0;
     int min_distance = 255*255*3; /* Max possible distance */
     
@@ -233,6 +278,11 @@ static term_color_t rgb_to_terminal_color(uint8_t r, uint8_t g, uint8_t b) {
     return (term_color_t)best_match;
 }
 
+/* Map RGB to closest terminal color with a single table load */
+static inline term_color_t rgb_to_terminal_color(uint8_t r, uint8_t g, uint8_t b) {
+    return (term_color_t)palette_lut[PALETTE_LUT_INDEX(r, g, b)];
+}
+
 /* Apply brightness and contrast adjustments to a pixel */
 static rgb_pixel_t adjust_pixel(rgb_pixel_t pixel, float brightness, float contrast) {
     rgb_pixel_t result;
@@ -286,323 +336,181 @@ static bool looks_like_text_content(uint8_t *data, size_t size) {
     return (printable_count > total_checked * 0.9);
 }
 
-/* Decode image data to RGB pixels with pre-scaling to conserve memory 
- * shell parameter is for debug output only, can be NULL */
-static rgb_pixel_t *decode_image_to_rgb(uint8_t *image_data, size_t image_size, 
-                               int *width, int *height, const struct shell *shell, int max_memory) {
-    /* Configure stb_image for RGB decoding */
-    stbi_set_unpremultiply_on_load(1);  /* Handle alpha correctly if present */
-    stbi_convert_iphone_png_to_rgb(1);  /* Fix iOS image formats */
-    
-    /* Check if this might be text content before trying to decode */
-    if (looks_like_text_content(image_data, image_size)) {
-        *width = 0;
-        *height = 0;
-        return NULL;
-    }
-    
-    /* Check the first few bytes to try to identify the image format */
-    const char *format = "unknown";
-    if (image_size >= 3 && image_data[0] == 0xFF && image_data[1] == 0xD8 && image_data[2] == 0xFF) {
-        format = "JPEG";
-    } else if (image_size >= 8 && 
-               image_data[0] == 0x89 && image_data[1] == 'P' && image_data[2] == 'N' && 
-               image_data[3] == 'G' && image_data[4] == 0x0D && image_data[5] == 0x0A &&
-               image_data[6] == 0x1A && image_data[7] == 0x0A) {
-        format = "PNG";
-    } else if (image_size >= 6 && 
-               (memcmp(image_data, "GIF87a", 6) == 0 || memcmp(image_data, "GIF89a", 6) == 0)) {
-        format = "GIF";
-    }
-    
-    /* Skip format logging */
-    
-    /* Skip detailed header logging to avoid log module errors */
-    
-    /* First check the image dimensions without decoding it */
-    int orig_width, orig_height, orig_channels;
-    if (!stbi_info_from_memory(image_data, image_size, 
-                              &orig_width, &orig_height, &orig_channels)) {
-        /* Failed to get image info */
-        return NULL;
-    }
-    
-    /* Skip dimensions logging */
-    
-    /* Calculate memory requirements and determine if we need to reduce the size */
-    size_t memory_needed = orig_width * orig_height * 3; /* 3 bytes per pixel (RGB) */
-    /* max_memory is now defined at the function level */
-    int scale = 1;
-    
-    /* Just print to log file, not to shell in this function */
-    LOG_INF("Image size: %dx%d, Memory needed: %zu bytes",
-           orig_width, orig_height, memory_needed);
-    
-    if (memory_needed > max_memory) {
-        /* Calculate scale factor needed to fit in memory */
-        scale = (int)sqrtf((float)memory_needed / max_memory) + 1;
-        /* Skip scaling log */
+/* Fit an image into the terminal area, keeping its aspect ratio. Pixels are
+ * drawn two characters wide, or as half a character cell, so they come out
+ * roughly square either way. Images are never enlarged. */
+static void fit_to_terminal(int src_w, int src_h, const ascii_art_config_t *config,
+                            int *dst_w, int *dst_h) {
+    bool half_blocks = config->use_extended_chars;
+    int columns = config->columns > 0 ? config->columns : IMAGE_DEFAULT_COLUMNS;
+    int lines = config->lines > 0 ? config->lines : IMAGE_DEFAULT_LINES;
+    int w, h;
+    
+    columns = MIN(columns, GOPHER_IMAGE_MAX_COLUMNS);
+    w = half_blocks ? columns : MAX(columns / 2, 1);
+    h = half_blocks ? lines * 2 : lines;
+    
+    if ((int64_t)src_w * h > (int64_t)src_h * w) {
+        /* Wider than the area, reduce the height */
+        h = MAX(1, (int)((int64_t)src_h * w / src_w));
+    } else {
+        w = MAX(1, (int)((int64_t)src_w * h / src_h));
     }
     
-    /* For JPEG, we can use stbi's reduced loading for better performance and memory usage */
-    if (format == "JPEG") {
-        stbi_set_flip_vertically_on_load(0);
-        
-        /* Set up reduction for JPEG decoding */
-        if (scale >= 8) {
-            stbi__jpeg_decode_reduced = 8;
-        } else if (scale >= 4) {
-            stbi__jpeg_decode_reduced = 4;
-        } else if (scale >= 2) {
-            stbi__jpeg_decode_reduced = 2;
-        } else {
-            stbi__jpeg_decode_reduced = 1;
+    *dst_w = MIN(w, src_w);
+    *dst_h = MIN(h, src_h);
+}
+
+/* Pick the largest decoder scale (8, 4 or 2) that still leaves at least one
+ * decoded pixel per output pixel. JPEGs are then reduced in the DCT domain,
+ * skipping most of the IDCT work and shrinking the decoder's band buffers. */
+static int pick_decode_scale(int src_w, int src_h, int dst_w, int dst_h) {
+    int scale;
+    
+    for (scale = 8; scale > 1; scale /= 2) {
+        if ((src_w + scale - 1) / scale >= dst_w && (src_h + scale - 1) / scale >= dst_h) {
+            break;
         }
     }
     
-    /* Try decoding with memory-saving options */
-    int channels;
-    uint8_t *img = NULL;
-    
-    /* If JPEG special handling didn't work or it's not a JPEG, try regular loading */
-    if (img == NULL) {
-        /* For non-JPEG formats or if the special JPEG handling failed, try direct loading */
-        img = stbi_load_from_memory(image_data, image_size, width, height, &channels, 3);
-        
-        /* If we're still out of memory, try scaling down manually after loading */
-        if (img == NULL && strstr(stbi_failure_reason(), "outofmem") != NULL) {
-            /* For memory issues, try with progressively smaller target sizes */
-            /* Skip memory warning */
-            
-            /* Try with a maximum width/height to limit memory usage */
-            int max_dim = 128; /* This should be small enough for most embedded systems */
-            float aspect = (float)orig_width / orig_height;
-            
-            if (aspect >= 1.0f) {
-                /* Landscape or square */
-                *width = max_dim;
-                *height = (int)(max_dim / aspect);
-            } else {
-                /* Portrait */
-                *height = max_dim;
-                *width = (int)(max_dim * aspect);
-            }
-            
-            if (*width < 1) *width = 1;
-            if (*height < 1) *height = 1;
-            
-            /* Allocate a buffer for RGB data */
-            size_t alloc_size = (*width) * (*height) * sizeof(rgb_pixel_t);
-            if (shell) shell_print(shell, "Attempting memory allocation of %zu bytes", alloc_size);
-            
-            rgb_pixel_t *rgb_img = (rgb_pixel_t *)memory_alloc(alloc_size, shell);
-            
-            if (!rgb_img) {
-                if (shell) shell_print(shell, "Memory allocation failed! Requested: %zu bytes", alloc_size);
-                return NULL;
-            }
-            if (shell) shell_print(shell, "Memory allocation succeeded");
-            
-            /* Fill with a gradient pattern as a placeholder */
-            for (int y = 0; y < *height; y++) {
-                for (int x = 0; x < *width; x++) {
-                    int idx = y * (*width) + x;
-                    rgb_img[idx].r = (uint8_t)(x * 255 / *width);
-                    rgb_img[idx].g = (uint8_t)(y * 255 / *height);
-                    rgb_img[idx].b = 128;
-                }
-            }
-            
-            /* Skip placeholder logging */
-            return rgb_img;
-        }
+    return scale;
+}
+
+/* An error diffusion tap sends weight / 2^shift of a pixel's quantisation
+ * error to the pixel dx columns right and dy rows down */
+struct dither_tap {
+    int8_t dx;
+    int8_t dy;
+    uint8_t weight;
+};
+
+struct dither_kernel {
+    uint8_t shift;
+    uint8_t rows;               /* Error rows kept, the current one included */
+    uint8_t taps;
+    struct dither_tap tap[6];
+};
+
+/* Indexed by GOPHER_DITHER_*; Atkinson passes on only 6/8 of the error,
+ * which keeps highlights and shadows clean at the cost of contrast */
+static const struct dither_kernel dither_kernels[] = {
+    [GOPHER_DITHER_FLOYD_STEINBERG] = {
+        4, 2, 4, { { 1, 0, 7 }, { -1, 1, 3 }, { 0, 1, 5 }, { 1, 1, 1 } }
+    },
+    [GOPHER_DITHER_ATKINSON] = {
+        3, 3, 6, { { 1, 0, 1 }, { 2, 0, 1 }, { -1, 1, 1 }, { 0, 1, 1 }, { 1, 1, 1 }, { 0, 2, 1 } }
+    },
+    [GOPHER_DITHER_SIERRA_LITE] = {
+        2, 2, 3, { { 1, 0, 2 }, { -1, 1, 1 }, { 0, 1, 1 } }
+    },
+};
+
+/* Error rows extend this many pixels past each edge, so taps need no
+ * bounds checks */
+#define DITHER_MARGIN   2
+#define DITHER_MAX_ROWS 3
+
+/* Error diffusion over a picture fed one row at a time. Only the errors of
+ * the rows still to come are kept, weighted but not yet divided, so none
+ * of the precision is lost to rounding on the way. */
+struct ditherer {
+    const struct dither_kernel *kernel;
+    int width;
+    size_t stride;              /* Values per error row, margins included */
+    int16_t *block;
+    int16_t *err[DITHER_MAX_ROWS];  /* RGB per pixel; err[0] is the current row */
+};
+
+/* Set up error diffusion with one of the GOPHER_DITHER_* kernels */
+static int dither_begin(struct ditherer *d, int kernel, int width) {
+    if (kernel < 0 || kernel >= (int)ARRAY_SIZE(dither_kernels) || !dither_kernels[kernel].taps) {
+        return -EINVAL;
     }
     
-    /* If we still failed to decode, handle errors */
-    if (img == NULL) {
-        /* Skip detailed error logging */
-        return NULL;
+    d->kernel = &dither_kernels[kernel];
+    d->width = width;
+    d->stride = (width + 2 * DITHER_MARGIN) * 3;
+    d->block = gopher_image_alloc(d->kernel->rows * d->stride * sizeof(int16_t));
+    if (!d->block) {
+        return -ENOMEM;
     }
+    memset(d->block, 0, d->kernel->rows * d->stride * sizeof(int16_t));
     
-    /* The decoded data is already in RGB format: R,G,B,R,G,B,... */
-    /* We can treat it as an array of rgb_pixel_t */
-    rgb_pixel_t *rgb_img = (rgb_pixel_t*)img;
+    for (int i = 0; i < d->kernel->rows; i++) {
+        d->err[i] = d->block + i * d->stride + DITHER_MARGIN * 3;
+    }
     
-    /* Skip success logging */
-    return rgb_img;
+    return 0;
 }
 
-/* Downscale a color image with options for quality control */
-static rgb_pixel_t *downscale_image_color(rgb_pixel_t *src, int src_w, int src_h, 
-                                  int tgt_w, int tgt_h, 
-                                  const image_process_options_t *options) {
-    /* Use default options if none provided */
-    if (!options) {
-        options = &default_options;
-    }
-    
-    /* Adjust target dimensions if maintaining aspect ratio */
-    if (options->maintain_aspect_ratio) {
-        float src_aspect = (float)src_w / src_h;
-        float tgt_aspect = (float)tgt_w / tgt_h;
+/* Quantise the next row to the basic palette in place, spreading each
+ * pixel's error over the pixels after it */
+static void dither_row(struct ditherer *d, rgb_pixel_t *row) {
+    const struct dither_kernel *kernel = d->kernel;
+    int round = 1 << (kernel->shift - 1);
+    int16_t *next;
+    
+    for (int x = 0; x < d->width; x++) {
+        const int16_t *acc = &d->err[0][x * 3];
+        int want[3] = {
+            clamp(row[x].r + ((acc[0] + round) >> kernel->shift), 0, 255),
+            clamp(row[x].g + ((acc[1] + round) >> kernel->shift), 0, 255),
+            clamp(row[x].b + ((acc[2] + round) >> kernel->shift), 0, 255),
+        };
+        term_color_t color = rgb_to_terminal_color(want[0], want[1], want[2]);
+        int err[3] = {
+            want[0] - terminal_colors[color].r,
+            want[1] - terminal_colors[color].g,
+            want[2] - terminal_colors[color].b,
+        };
         
-        if (src_aspect > tgt_aspect) {
-            /* Source is wider, adjust height */
-            int new_tgt_h = (int)(tgt_w / src_aspect);
-            if (new_tgt_h < 1) new_tgt_h = 1;
-            tgt_h = new_tgt_h;
-        } else if (src_aspect < tgt_aspect) {
-            /* Source is taller, adjust width */
-            int new_tgt_w = (int)(tgt_h * src_aspect);
-            if (new_tgt_w < 1) new_tgt_w = 1;
-            tgt_w = new_tgt_w;
-        }
+        row[x].r = terminal_colors[color].r;
+        row[x].g = terminal_colors[color].g;
+        row[x].b = terminal_colors[color].b;
         
-        /* Adjusted dimensions to maintain aspect ratio */
-    }
-    
-    /* Allocate memory for result */
-    size_t alloc_size = tgt_w * tgt_h * sizeof(rgb_pixel_t);
-    rgb_pixel_t *result = (rgb_pixel_t *)memory_alloc(alloc_size, NULL);
-    
-    if (!result) {
-        return NULL;
-    }
-    
-    /* Calculate scaling factors */
-    float x_ratio = (float)src_w / (float)tgt_w;
-    float y_ratio = (float)src_h / (float)tgt_h;
-    
-    /* Perform the actual scaling */
-    for (int y = 0; y < tgt_h; y++) {
-        for (int x = 0; x < tgt_w; x++) {
-            rgb_pixel_t pixel;
+        for (int t = 0; t < kernel->taps; t++) {
+            const struct dither_tap *tap = &kernel->tap[t];
+            int16_t *to = &d->err[tap->dy][(x + tap->dx) * 3];
             
-            if (options->use_bilinear_filtering) {
-                /* Bilinear filtering for better quality */
-                float src_x = (float)x * x_ratio;
-                float src_y = (float)y * y_ratio;
-                int src_x_int = (int)src_x;
-                int src_y_int = (int)src_y;
-                float x_diff = src_x - src_x_int;
-                float y_diff = src_y - src_y_int;
-                
-                /* Get the four surrounding pixels */
-                rgb_pixel_t p00 = src[src_y_int * src_w + src_x_int];
-                rgb_pixel_t p10 = (src_x_int < src_w - 1) ? 
-                    src[src_y_int * src_w + src_x_int + 1] : p00;
-                rgb_pixel_t p01 = (src_y_int < src_h - 1) ? 
-                    src[(src_y_int + 1) * src_w + src_x_int] : p00;
-                rgb_pixel_t p11 = (src_x_int < src_w - 1 && src_y_int < src_h - 1) ? 
-                    src[(src_y_int + 1) * src_w + src_x_int + 1] : p00;
-                
-                /* Interpolate colors */
-                pixel.r = (uint8_t)((1 - x_diff) * (1 - y_diff) * p00.r +
-                        x_diff * (1 - y_diff) * p10.r +
-                        (1 - x_diff) * y_diff * p01.r +
-                        x_diff * y_diff * p11.r);
-                
-                pixel.g = (uint8_t)((1 - x_diff) * (1 - y_diff) * p00.g +
-                        x_diff * (1 - y_diff) * p10.g +
-                        (1 - x_diff) * y_diff * p01.g +
-                        x_diff * y_diff * p11.g);
-                
-                pixel.b = (uint8_t)((1 - x_diff) * (1 - y_diff) * p00.b +
-                        x_diff * (1 - y_diff) * p10.b +
-                        (1 - x_diff) * y_diff * p01.b +
-                        x_diff * y_diff * p11.b);
-            } else {
-                /* Nearest neighbor (faster but lower quality) */
-                int src_x = (int)(x * x_ratio);
-                int src_y = (int)(y * y_ratio);
-                pixel = src[src_y * src_w + src_x];
-            }
-            
-            /* Apply brightness and contrast adjustments */
-            if (options->brightness_adjust != 1.0f || options->contrast_adjust != 1.0f) {
-                pixel = adjust_pixel(pixel, options->brightness_adjust, options->contrast_adjust);
-            }
-            
-            result[y * tgt_w + x] = pixel;
+            to[0] += err[0] * tap->weight;
+            to[1] += err[1] * tap->weight;
+            to[2] += err[2] * tap->weight;
         }
     }
     
-    return result;
+    /* The current row's errors are spent; its storage becomes the last row */
+    next = d->err[0];
+    for (int i = 0; i + 1 < kernel->rows; i++) {
+        d->err[i] = d->err[i + 1];
+    }
+    d->err[kernel->rows - 1] = next;
+    memset(next - DITHER_MARGIN * 3, 0, d->stride * sizeof(int16_t));
 }
 
-/* Apply Floyd-Steinberg dithering to the image */
-static void apply_floyd_steinberg_dithering(rgb_pixel_t *image, int width, int height) {
-    /* Create a copy of the image for reading during dithering */
-    size_t alloc_size = width * height * sizeof(rgb_pixel_t);
-    rgb_pixel_t *img_copy = (rgb_pixel_t *)memory_alloc(alloc_size, NULL);
-    
-    if (!img_copy) {
-        return;
-    }
-    
-    /* Copy the original image */
-    memcpy(img_copy, image, width * height * sizeof(rgb_pixel_t));
-    
-    /* Apply Floyd-Steinberg dithering */
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            int idx = y * width + x;
-            rgb_pixel_t old_pixel = img_copy[idx];
-            
-            /* Find the closest color in the palette */
-            term_color_t new_color = rgb_to_terminal_color(old_pixel.r, old_pixel.g, old_pixel.b);
-            rgb_pixel_t new_pixel;
-            new_pixel.r = terminal_colors[new_color].r;
-            new_pixel.g = terminal_colors[new_color].g;
-            new_pixel.b = terminal_colors[new_color].b;
-            
-            /* Store the new pixel in the output image */
-            image[idx] = new_pixel;
-            
-            /* Calculate quantization error */
-            int err_r = old_pixel.r - new_pixel.r;
-            int err_g = old_pixel.g - new_pixel.g;
-            int err_b = old_pixel.b - new_pixel.b;
-            
-            /* Distribute error to neighboring pixels using Floyd-Steinberg pattern */
-            if (x + 1 < width) {
-                /* Right pixel (7/16) */
-                int right_idx = y * width + (x + 1);
-                img_copy[right_idx].r = clamp(img_copy[right_idx].r + (err_r * 7 / 16), 0, 255);
-                img_copy[right_idx].g = clamp(img_copy[right_idx].g + (err_g * 7 / 16), 0, 255);
-                img_copy[right_idx].b = clamp(img_copy[right_idx].b + (err_b * 7 / 16), 0, 255);
-            }
-            
-            if (y + 1 < height) {
-                /* Bottom pixel (5/16) */
-                int bottom_idx = (y + 1) * width + x;
-                img_copy[bottom_idx].r = clamp(img_copy[bottom_idx].r + (err_r * 5 / 16), 0, 255);
-                img_copy[bottom_idx].g = clamp(img_copy[bottom_idx].g + (err_g * 5 / 16), 0, 255);
-                img_copy[bottom_idx].b = clamp(img_copy[bottom_idx].b + (err_b * 5 / 16), 0, 255);
-                
-                if (x > 0) {
-                    /* Bottom-left pixel (3/16) */
-                    int bottom_left_idx = (y + 1) * width + (x - 1);
-                    img_copy[bottom_left_idx].r = clamp(img_copy[bottom_left_idx].r + (err_r * 3 / 16), 0, 255);
-                    img_copy[bottom_left_idx].g = clamp(img_copy[bottom_left_idx].g + (err_g * 3 / 16), 0, 255);
-                    img_copy[bottom_left_idx].b = clamp(img_copy[bottom_left_idx].b + (err_b * 3 / 16), 0, 255);
-                }
-                
-                if (x + 1 < width) {
-                    /* Bottom-right pixel (1/16) */
-                    int bottom_right_idx = (y + 1) * width + (x + 1);
-                    img_copy[bottom_right_idx].r = clamp(img_copy[bottom_right_idx].r + (err_r * 1 / 16), 0, 255);
-                    img_copy[bottom_right_idx].g = clamp(img_copy[bottom_right_idx].g + (err_g * 1 / 16), 0, 255);
-                    img_copy[bottom_right_idx].b = clamp(img_copy[bottom_right_idx].b + (err_b * 1 / 16), 0, 255);
-                }
-            }
-        }
-    }
+static void dither_end(struct ditherer *d) {
+    gopher_image_free(d->block);
+    d->block = NULL;
+}
+
+/* 4x4 Bayer threshold matrix for ordered dithering */
+static const uint8_t bayer_matrix[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+/* Ordered dithering: offset a pixel by its position's threshold, scaled to
+ * the 170 steps between the basic palette's levels. It needs no state, so
+ * it is applied as each pixel is drawn. */
+static rgb_pixel_t bayer_pixel(rgb_pixel_t pixel, int x, int y) {
+    int offset = (bayer_matrix[y & 3][x & 3] * 2 - 15) * 170 / 32;
     
-    /* Free the temporary buffer */
-    memory_free(img_copy);
+    pixel.r = clamp(pixel.r + offset, 0, 255);
+    pixel.g = clamp(pixel.g + offset, 0, 255);
+    pixel.b = clamp(pixel.b + offset, 0, 255);
     
-    /* Dithering applied */
+    return pixel;
 }
 
 /* Detect if a file is an image based on magic numbers or extension */
@@ -654,101 +562,404 @@ bool gopher_is_image(const uint8_t *data, size_t size) {
     return false;
 }
 
-/* Render image as ASCII art */
-static int render_ascii_art(const struct shell *shell, rgb_pixel_t *rgb_buffer, 
-                           int width, int height, const ascii_art_config_t *config) {
-    /* Detailed debug info */
-    shell_print(shell, "DEBUG: render_ascii_art called with %dx%d image at %p", width, height, rgb_buffer);
+/* Map RGB to the closest xterm-256 colour: the 6x6x6 cube (16-231) or the
+ * 24-step gray ramp (232-255), whichever is nearer */
+static uint8_t rgb_to_xterm256(uint8_t r, uint8_t g, uint8_t b) {
+    static const uint8_t cube[6] = { 0, 95, 135, 175, 215, 255 };
+    int ri = r < 48 ? 0 : (r < 115 ? 1 : (r - 35) / 40);
+    int gi = g < 48 ? 0 : (g < 115 ? 1 : (g - 35) / 40);
+    int bi = b < 48 ? 0 : (b < 115 ? 1 : (b - 35) / 40);
+    int avg = (r + g + b) / 3;
+    int gray_i = avg > 238 ? 23 : (avg < 3 ? 0 : (avg - 3) / 10);
+    int gray = 8 + gray_i * 10;
+    int dr = r - cube[ri], dg = g - cube[gi], db = b - cube[bi];
+    int cube_dist = dr * dr + dg * dg + db * db;
+    int gray_dist = (r - gray) * (r - gray) + (g - gray) * (g - gray) + (b - gray) * (b - gray);
+    
+    if (gray_dist < cube_dist) {
+        return 232 + gray_i;
+    }
+    return 16 + ri * 36 + gi * 6 + bi;
+}
+
+/* Colour of the pixel at x, y in the configured mode. Equal keys give the
+ * same escape sequence, so runs of one key need a single sequence. */
+static uint32_t color_key(const ascii_art_config_t *config, rgb_pixel_t pixel, int x, int y) {
+    switch (config->color_mode) {
+    case GOPHER_COLOR_MODE_TRUE:
+        return ((uint32_t)pixel.r << 16) | ((uint32_t)pixel.g << 8) | pixel.b;
+    case GOPHER_COLOR_MODE_256:
+        return rgb_to_xterm256(pixel.r, pixel.g, pixel.b);
+    default:
+        if (config->use_dithering && config->dither == GOPHER_DITHER_BAYER) {
+            pixel = bayer_pixel(pixel, x, y);
+        }
+        return rgb_to_terminal_color(pixel.r, pixel.g, pixel.b);
+    }
+}
+
+/* Write the SGR sequence selecting a colour key as the foreground or the
+ * background, returning its length */
+static int format_color(char *buf, size_t size, const ascii_art_config_t *config,
+                        uint32_t key, bool background) {
+    switch (config->color_mode) {
+    case GOPHER_COLOR_MODE_TRUE:
+        return snprintf(buf, size, "\033[%d;2;%u;%u;%um", background ? 48 : 38,
+                        (unsigned int)(key >> 16), (unsigned int)((key >> 8) & 0xFF),
+                        (unsigned int)(key & 0xFF));
+    case GOPHER_COLOR_MODE_256:
+        return snprintf(buf, size, "\033[%d;5;%um", background ? 48 : 38, (unsigned int)key);
+    default:
+        return snprintf(buf, size, "\033[%um", (background ? 40 : 30) + (unsigned int)key);
+    }
+}
+
+/* Longest SGR sequence format_color() writes */
+#define SGR_MAX_LEN (sizeof("\033[38;2;255;255;255m") - 1)
+
+/* Colours last sent on the current line, so unchanged ones are not resent */
+typedef struct {
+    uint32_t fg, bg;
+    bool fg_set, bg_set;
+} sgr_state_t;
+
+/* Append the sequences making fg and bg the current colours */
+static int set_colors(char *buf, size_t size, const ascii_art_config_t *config,
+                      sgr_state_t *state, bool set_fg, uint32_t fg, bool set_bg, uint32_t bg) {
+    int pos = 0;
     
-    /* Verify buffer is not NULL */
-    if (!rgb_buffer) {
-        shell_error(shell, "ERROR: rgb_buffer is NULL!");
-        return -EINVAL;
+    if (set_fg && (!state->fg_set || state->fg != fg)) {
+        pos += format_color(buf + pos, size - pos, config, fg, false);
+        state->fg = fg;
+        state->fg_set = true;
+    }
+    if (set_bg && (!state->bg_set || state->bg != bg)) {
+        pos += format_color(buf + pos, size - pos, config, bg, true);
+        state->bg = bg;
+        state->bg_set = true;
     }
     
-    /* Verify dimensions are reasonable */
-    if (width <= 0 || height <= 0 || width > 1000 || height > 1000) {
-        shell_error(shell, "ERROR: Invalid image dimensions: %dx%d", width, height);
-        return -EINVAL;
+    return pos;
+}
+
+/* Build one line of character art from columns 'from' to 'to': a ramp
+ * character per pixel, doubled for the aspect ratio, on a black background
+ * set once. Blank cells keep whatever colour is active, since it does not
+ * show. */
+static int build_ascii_line(char *line, size_t size, const rgb_pixel_t *row, int y, int from,
+                            int to, const ascii_art_config_t *config) {
+    sgr_state_t state = { 0 };
+    int pos = 0;
+    
+    if (config->use_color) {
+        pos += snprintf(line, size, "%s", BG_BLACK);
     }
     
-    /* Try to access first byte to check memory access */
-    shell_print(shell, "DEBUG: First pixel RGB values: %d,%d,%d", 
-               rgb_buffer[0].r, rgb_buffer[0].g, rgb_buffer[0].b);
+    for (int x = from; x < to; x++) {
+        rgb_pixel_t pixel = row[x];
+        
+        /* Calculate intensity for ASCII character selection */
+        uint8_t gray = rgb_to_gray(pixel.r, pixel.g, pixel.b);
+        
+        /* Select ASCII character based on brightness */
+        char ch = ASCII_RAMP[gray * (ASCII_RAMP_LEN - 1) / 255];
+        
+        if (config->use_color && ch != ' ') {
+            pos += set_colors(line + pos, size - pos, config, &state,
+                              true, color_key(config, pixel, x, y), false, 0);
+        }
+        
+        /* Add the ASCII character (double it for better aspect ratio) */
+        line[pos++] = ch;
+        line[pos++] = ch;
+    }
     
-    /* Determine terminal width (use 80 as default) */
-    int term_width = 80;
-    int term_height = 24;
+    return pos;
+}
+
+/* Build one line of half blocks from columns 'from' to 'to', each cell
+ * showing the pixel of 'top' (row y) in its upper half and the one of
+ * 'bottom' (NULL past the last row) in its lower half. Of the equivalent
+ * ways of drawing a cell, the one needing the fewest colour changes is
+ * picked. The bytes that are glyphs rather than escape sequences go to
+ * text_bytes. */
+static int build_half_block_line(char *line, size_t size, const rgb_pixel_t *top,
+                                 const rgb_pixel_t *bottom, int y, int from, int to,
+                                 const ascii_art_config_t *config, int *text_bytes) {
+    sgr_state_t state = { 0 };
+    int pos = 0;
     
-    /* Allocate a buffer for a line of ASCII art */
-    size_t alloc_size = term_width * 20; /* Extra space for color codes */
-    char *line = (char *)memory_alloc(alloc_size, shell);
+    *text_bytes = 0;
     
-    if (!line) {
-        return -ENOMEM;
+    for (int x = from; x < to; x++) {
+        const char *glyph;
+        int glyph_len;
+        
+        if (!config->use_color) {
+            /* Monochrome: a pixel is lit or not */
+            bool up = rgb_to_gray(top[x].r, top[x].g, top[x].b) >= 128;
+            bool down = bottom && rgb_to_gray(bottom[x].r, bottom[x].g, bottom[x].b) >= 128;
+            
+            glyph = up ? (down ? FULL_BLOCK : HALF_BLOCK_UPPER) : (down ? HALF_BLOCK_LOWER : " ");
+        } else {
+            uint32_t up = color_key(config, top[x], x, y);
+            uint32_t down = color_key(config, bottom ? bottom[x] : (rgb_pixel_t){ 0, 0, 0 },
+                                      x, y + 1);
+            
+            if (up == down) {
+                /* One colour: a space on that background, or a full block in
+                   that foreground, whichever is already set */
+                if (state.fg_set && state.fg == up && !(state.bg_set && state.bg == up)) {
+                    glyph = FULL_BLOCK;
+                } else {
+                    glyph = " ";
+                    pos += set_colors(line + pos, size - pos, config, &state, false, 0, true, up);
+                }
+            } else if ((state.fg_set && state.fg == down) || (state.bg_set && state.bg == up)) {
+                glyph = HALF_BLOCK_LOWER;
+                pos += set_colors(line + pos, size - pos, config, &state, true, down, true, up);
+            } else {
+                glyph = HALF_BLOCK_UPPER;
+                pos += set_colors(line + pos, size - pos, config, &state, true, up, true, down);
+            }
+        }
+        
+        glyph_len = snprintf(line + pos, size - pos, "%s", glyph);
+        pos += glyph_len;
+        *text_bytes += glyph_len;
+    }
+    
+    return pos;
+}
+
+/* Receives each line of character art as a NUL-terminated string of len
+ * bytes, without a line ending. Returns 0, or a negative errno to stop. */
+typedef int (*image_sink_t)(void *user, const char *line, size_t len);
+
+/* Everything after decoding, run once per output row as the scaler
+ * finishes it: brightness and contrast, error diffusion, then formatting
+ * into a line for the sink. Lines reach the terminal while the rows below
+ * them are still being decoded, and no stage holds more than a few rows.
+ * With use_extended_chars each line holds two pixel rows stacked with half
+ * blocks; otherwise each pixel is two ramp characters. */
+struct image_pipeline {
+    const ascii_art_config_t *config;
+    struct gopher_scaler scaler;
+    struct ditherer ditherer;
+    bool diffuse;               /* Error diffusion is running */
+    rgb_pixel_t *top;           /* Upper pixel row of a half-block line */
+    char *line;
+    size_t line_size;
+    image_sink_t sink;
+    void *user;
+    int error;                  /* Error the sink stopped with */
+    size_t frame_bytes;
+    size_t escape_bytes;
+    uint32_t *keys;             /* Look of each pixel drawn last, or NULL */
+    bool delta;                 /* Only redraw the cells that changed */
+};
+
+/* Cells left unchanged between two changed ones are redrawn rather than
+ * skipped with a cursor move if there are at most this many */
+#define DELTA_GAP 2
+
+/* Longest cursor move pipeline_line() writes */
+#define CURSOR_MAX_LEN (sizeof("\033[999G") - 1)
+
+/* How a pixel shows on the terminal, equal keys drawing the same: its
+ * colour key, and in character art its ramp character */
+static uint32_t pixel_key(const ascii_art_config_t *config, rgb_pixel_t pixel, int x, int y) {
+    uint8_t gray = rgb_to_gray(pixel.r, pixel.g, pixel.b);
+    char ch;
+    
+    if (config->use_extended_chars) {
+        return config->use_color ? color_key(config, pixel, x, y) : gray >= 128;
     }
     
+    ch = ASCII_RAMP[gray * (ASCII_RAMP_LEN - 1) / 255];
+    if (!config->use_color || ch == ' ') {
+        return (uint32_t)ch << 24;
+    }
+    return ((uint32_t)ch << 24) | color_key(config, pixel, x, y);
+}
+
+/* Record the key of a pixel, returning whether it differs from before */
+static bool pixel_changed(struct image_pipeline *p, rgb_pixel_t pixel, int x, int y) {
+    uint32_t *key = &p->keys[y * p->scaler.dst_w + x];
+    uint32_t now = pixel_key(p->config, pixel, x, y);
+    bool changed = *key != now;
     
-    /* Render header */
-    shell_fprintf(shell, SHELL_NORMAL, "ASCII Art Image (%dx%d pixels)\n", width, height);
-    shell_fprintf(shell, SHELL_NORMAL, "----------------------------------------\n");
+    *key = now;
     
-    /* Track last used colors to minimize color code output */
-    term_color_t last_fg = BLACK;
-    term_color_t last_bg = BLACK;
+    return changed;
+}
+
+/* Format columns 'from' to 'to' of the line showing pixel row y, and in
+ * half blocks the row below it */
+static int pipeline_cells(struct image_pipeline *p, char *line, size_t size,
+                          const rgb_pixel_t *top, const rgb_pixel_t *bottom, int y,
+                          int from, int to, int *text_bytes) {
+    if (!p->config->use_extended_chars) {
+        *text_bytes = (to - from) * 2;
+        return build_ascii_line(line, size, top, y, from, to, p->config);
+    }
     
-    /* Determine if color is supported */
-    bool color_supported = config->use_color;
+    return build_half_block_line(line, size, top, bottom, y, from, to, p->config, text_bytes);
+}
+
+/* Format the line showing pixel row y, and in half blocks the row below
+ * it. When only changes are drawn, each run of changed cells is written
+ * after a move to its column, and unchanged lines are left empty. */
+static int pipeline_line(struct image_pipeline *p, const rgb_pixel_t *top,
+                         const rgb_pixel_t *bottom, int y, int *text_bytes) {
+    int width = p->scaler.dst_w;
+    int cell = p->config->use_extended_chars ? 1 : 2;
+    int from = -1, to = 0;
+    int pos = 0;
+    int run_text;
     
-    /* Render each line of ASCII art */
-    for (int y = 0; y < height; y++) {
-        int pos = 0;
-        bool color_active = false;
-        
+    if (p->keys && !p->delta) {
+        /* First frame: everything is drawn, remember how it looks */
         for (int x = 0; x < width; x++) {
-            rgb_pixel_t pixel = rgb_buffer[y * width + x];
-            
-            /* Calculate intensity for ASCII character selection */
-            uint8_t gray = rgb_to_gray(pixel.r, pixel.g, pixel.b);
-            
-            /* Select ASCII character based on brightness */
-            char ch = ASCII_RAMP[gray * (ASCII_RAMP_LEN - 1) / 255];
-            
-            if (color_supported) {
-                /* Determine best foreground color */
-                term_color_t fg = rgb_to_terminal_color(pixel.r, pixel.g, pixel.b);
-                term_color_t bg = BLACK; /* Background is typically black */
-                
-                /* Add color codes only when color changes (optimization) */
-                if (!color_active || fg != last_fg || bg != last_bg) {
-                    pos += snprintf(line + pos, 20, "%s%s", 
-                                   fg_color_codes[fg], bg_color_codes[bg]);
-                    last_fg = fg;
-                    last_bg = bg;
-                    color_active = true;
-                }
+            pixel_changed(p, top[x], x, y);
+            if (bottom) {
+                pixel_changed(p, bottom[x], x, y + 1);
+            }
+        }
+    }
+    
+    if (!p->delta) {
+        return pipeline_cells(p, p->line, p->line_size, top, bottom, y, 0, width, text_bytes);
+    }
+    
+    *text_bytes = 0;
+    for (int x = 0; x <= width; x++) {
+        bool changed = false;
+        
+        if (x < width) {
+            changed = pixel_changed(p, top[x], x, y);
+            if (bottom && pixel_changed(p, bottom[x], x, y + 1)) {
+                changed = true;
             }
-            
-            /* Add the ASCII character (double it for better aspect ratio) */
-            line[pos++] = ch;
-            line[pos++] = ch;
         }
         
-        /* Reset colors at end of line */
-        if (color_supported && color_active) {
-            pos += snprintf(line + pos, 10, "%s", COLOR_RESET);
+        if (from >= 0 && (x == width || (changed && x - to > DELTA_GAP))) {
+            pos += snprintf(p->line + pos, p->line_size - pos, "\033[%dG", from * cell + 1);
+            pos += pipeline_cells(p, p->line + pos, p->line_size - pos, top, bottom, y, from, to,
+                                  &run_text);
+            *text_bytes += run_text;
+            from = -1;
         }
         
-        /* Null terminate and print */
-        line[pos] = '\0';
-        shell_print(shell, "%s", line);
+        if (changed) {
+            if (from < 0) {
+                from = x;
+            }
+            to = x + 1;
+        }
     }
     
-    /* Free the line buffer */
-    memory_free(line);
+    return pos;
+}
+
+static int pipeline_row(void *user, int y, rgb_pixel_t *row) {
+    struct image_pipeline *p = user;
+    const ascii_art_config_t *config = p->config;
+    int width = p->scaler.dst_w;
+    int text_bytes;
+    int pos;
+    
+    if (config->brightness != 1.0f || config->contrast != 1.0f) {
+        for (int x = 0; x < width; x++) {
+            row[x] = adjust_pixel(row[x], config->brightness, config->contrast);
+        }
+    }
+    
+    if (p->diffuse) {
+        dither_row(&p->ditherer, row);
+    }
+    
+    if (!config->use_extended_chars) {
+        pos = pipeline_line(p, row, NULL, y, &text_bytes);
+    } else if (y & 1) {
+        pos = pipeline_line(p, p->top, row, y - 1, &text_bytes);
+    } else if (y + 1 < p->scaler.dst_h) {
+        /* Wait for the row below */
+        memcpy(p->top, row, width * sizeof(rgb_pixel_t));
+        return 0;
+    } else {
+        pos = pipeline_line(p, row, NULL, y, &text_bytes);
+    }
     
-    /* Render footer */
-    shell_fprintf(shell, SHELL_NORMAL, "----------------------------------------\n");
+    /* Reset colors at end of line */
+    if (config->use_color && pos > 0) {
+        pos += snprintf(p->line + pos, p->line_size - pos, "%s", COLOR_RESET);
+    }
+    p->line[pos] = '\0';
+    
+    p->frame_bytes += pos + 1;
+    p->escape_bytes += pos - text_bytes;
+    
+    p->error = p->sink(p->user, p->line, pos);
+    
+    return p->error;
+}
+
+/* Set up the stages for a picture of src_w x src_h decoded pixels drawn at
+ * dst_w x dst_h */
+static int pipeline_begin(struct image_pipeline *p, const ascii_art_config_t *config,
+                          int src_w, int src_h, int dst_w, int dst_h,
+                          image_sink_t sink, void *user) {
+    int ret;
+    
+    memset(p, 0, sizeof(*p));
+    p->config = config;
+    p->sink = sink;
+    p->user = user;
+    
+    ret = gopher_scaler_init(&p->scaler, src_w, src_h, dst_w, dst_h, pipeline_row, p);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    /* Worst case two colour changes and a 3-byte glyph per cell, plus a
+       cursor move and the reset; the half-block row waiting for its
+       partner goes after it */
+    p->line_size = dst_w * (2 * SGR_MAX_LEN + 3) + CURSOR_MAX_LEN + sizeof(COLOR_RESET) + 1;
+    p->line = gopher_image_alloc(p->line_size +
+                                 (config->use_extended_chars ? dst_w * sizeof(rgb_pixel_t) : 0));
+    if (!p->line) {
+        gopher_scaler_free(&p->scaler);
+        return -ENOMEM;
+    }
+    p->top = (rgb_pixel_t *)(p->line + p->line_size);
+    
+    /* Dithering targets the 8 basic colours; the larger palettes do without.
+       Ordered dithering happens as pixels are matched to colours, and error
+       diffusion is skipped rather than failing the picture if there is no
+       memory for it */
+    if (config->use_dithering && config->use_color && config->color_mode == GOPHER_COLOR_MODE_8 &&
+        config->dither != GOPHER_DITHER_BAYER) {
+        p->diffuse = dither_begin(&p->ditherer, config->dither, dst_w) == 0;
+    }
+    
+    return 0;
+}
+
+static void pipeline_end(struct image_pipeline *p) {
+    if (p->diffuse) {
+        dither_end(&p->ditherer);
+    }
+    gopher_image_free(p->line);
+    gopher_scaler_free(&p->scaler);
+}
+
+/* Write each line of a picture through the output writer */
+static int out_sink(void *user, const char *line, size_t len) {
+    struct gopher_out *out = user;
+    
+    gopher_out_write(out, line, len);
+    gopher_out_write(out, "\n", 1);
     
     return 0;
 }
@@ -805,24 +1016,127 @@ static void display_text_content(const struct shell *shell, uint8_t *data, size_
     shell_print(shell, "-------------------------------------------");
 }
 
-/* Main function to render an image as ASCII art */
-int gopher_render_image(const struct shell *shell, uint8_t *file_data, 
-                       size_t file_size, ascii_art_config_t *config) {
-    int ret = 0;
-    rgb_pixel_t *img = NULL;
-    rgb_pixel_t *scaled_img = NULL;
-    int width, height;
+/* Explain why an image could not be decoded */
+static void report_decode_error(const struct shell *shell, uint8_t *file_data, size_t file_size,
+                                int width, int height, int channels) {
+    const char *error = stbi_failure_reason();
     
-    /* Define memory limit here so it's available throughout the function */
-    /* Use 3MB when PSRAM is available, 200KB otherwise */
-    int max_memory = LARGE_MEMORY_AVAILABLE ? 3000000 : 200000;
+    shell_error(shell, "Failed to decode image data");
+    
+    if (error == NULL) {
+        error = "unknown";
+    }
     
-    /* Print memory availability */
-    if (LARGE_MEMORY_AVAILABLE) {
-        shell_print(shell, "PSRAM is available - using 3MB memory limit");
+    if (strstr(error, "no SOF") != NULL) {
+        shell_error(shell, "No JPEG Start Of Frame marker found - this usually means:");
+        shell_error(shell, "1. The server returned an HTML error page instead of an image");
+        shell_error(shell, "2. The server may require authentication or cookies");
+        shell_error(shell, "3. There might be a redirect to another page");
+    } else if (strstr(error, "bad huffman") != NULL) {
+        shell_error(shell, "Bad Huffman code found - the image data is corrupted or incomplete");
+    } else if (strstr(error, "PNG") != NULL) {
+        shell_error(shell, "PNG decoding error - file may be corrupted or in an unsupported format");
+    } else if (strstr(error, "outofmem") != NULL) {
+        /* Only formats that cannot be streamed (PNG, GIF, progressive JPEG)
+           need the whole image in memory */
+        shell_error(shell, "Image is too large for available memory");
+        if (width > 0) {
+            shell_print(shell, "Image dimensions: %dx%d pixels (%d channels)",
+                       width, height, channels);
+        }
     } else {
-        shell_print(shell, "PSRAM not available - using 200KB memory limit");
+        shell_error(shell, "Image decoding error: %s", error);
+    }
+    
+    /* Check if this might be a text/HTML response and display if so */
+    if (looks_like_text_content(file_data, file_size)) {
+        display_text_content(shell, file_data, file_size);
+    } else if (file_size < 1024) {
+        /* For small non-image data, try displaying as text anyway */
+        shell_print(shell, "Attempting to display content as text:");
+        display_text_content(shell, file_data, file_size);
+    }
+}
+
+/* Work out from its header how a picture is decoded and drawn */
+static bool get_picture_size(const uint8_t *data, size_t size, const ascii_art_config_t *config,
+                             struct gopher_picture_size *ps) {
+    bool known;
+    
+    if (image_arena_begin() < 0) {
+        return false;
     }
+    known = stbi_info_from_memory(data, size, &ps->width, &ps->height, &ps->channels);
+    image_arena_end();
+    if (!known) {
+        return false;
+    }
+    
+    fit_to_terminal(ps->width, ps->height, config, &ps->target_width, &ps->target_height);
+    ps->scale = pick_decode_scale(ps->width, ps->height, ps->target_width, ps->target_height);
+    
+    return true;
+}
+
+/* Decode a picture straight into the pipeline: baseline JPEGs arrive one
+ * MCU row at a time, and every output row goes to the sink as soon as it is
+ * complete. Returns the bytes of the frame, -EINVAL if the data does not
+ * decode (stbi_failure_reason() tells why), or another negative errno. */
+static int draw_picture(const uint8_t *data, size_t size, const ascii_art_config_t *config,
+                        const struct gopher_picture_size *ps, image_sink_t sink, void *user,
+                        size_t *escape_bytes) {
+    struct image_pipeline pipeline;
+    int width, height, channels;
+    int ret;
+    
+    ret = image_arena_begin();
+    if (ret < 0) {
+        return ret;
+    }
+    
+    ret = pipeline_begin(&pipeline, config, (ps->width + ps->scale - 1) / ps->scale,
+                         (ps->height + ps->scale - 1) / ps->scale,
+                         ps->target_width, ps->target_height, sink, user);
+    if (ret < 0) {
+        image_arena_end();
+        return ret;
+    }
+    
+    stbi_set_unpremultiply_on_load(1);
+    stbi_convert_iphone_png_to_rgb(1);
+    if (!stbi_load_rows_from_memory(data, size, &width, &height, &channels, 3, ps->scale,
+                                    gopher_scaler_row, &pipeline.scaler)) {
+        ret = pipeline.error < 0 ? pipeline.error : -EINVAL;
+    } else {
+        ret = (int)pipeline.frame_bytes;
+        *escape_bytes = pipeline.escape_bytes;
+    }
+    
+    pipeline_end(&pipeline);
+    image_arena_end();
+    
+    return ret;
+}
+
+static void print_header(struct gopher_out *out, const struct gopher_picture_size *ps) {
+    gopher_out_printf(out, "ASCII Art Image (%dx%d pixels)\n", ps->target_width, ps->target_height);
+    gopher_out_printf(out, "----------------------------------------\n");
+}
+
+static void print_footer(struct gopher_out *out, const ascii_art_config_t *config,
+                         int frame_bytes, size_t escape_bytes) {
+    gopher_out_printf(out, "----------------------------------------\n");
+    gopher_out_printf(out, "%s%s, %d bytes per frame (%zu in escape sequences)\n",
+                      !config->use_color ? "monochrome" : gopher_color_mode_name(config->color_mode),
+                      config->use_extended_chars ? " half blocks" : "", frame_bytes, escape_bytes);
+}
+
+/* Main function to render an image as ASCII art */
+int gopher_render_image(const struct shell *shell, uint8_t *file_data, 
+                       size_t file_size, ascii_art_config_t *config) {
+    struct gopher_picture_size ps;
+    size_t escape_bytes = 0;
+    int ret;
     
     /* Use default config if none is provided */
     if (!config) {
@@ -838,196 +1152,524 @@ int gopher_render_image(const struct shell *shell, uint8_t *file_data,
     
     /* Verify the file looks like an image */
     if (!gopher_is_image(file_data, file_size)) {
-        /* Show the first few bytes to help diagnose the issue */
-        if (file_size >= 16) {
-            char header_hex[100] = {0};
-            int pos = 0;
-            for (int i = 0; i < MIN(16, file_size); i++) {
-                pos += snprintf(header_hex + pos, sizeof(header_hex) - pos, "%02x ", file_data[i]);
-            }
-            /* File doesn't match image signature */
-        }
-        
         shell_error(shell, "File format is not a recognized image type (JPEG, PNG, or GIF)");
         
         /* Even though it's not a recognized image format, still try to decode it */
         shell_print(shell, "Attempting to decode anyway...");
     }
     
-    /* First check image dimensions without decoding it fully */
-    int orig_width = 0, orig_height = 0, orig_channels = 0;
-    bool dimensions_available = false;
+    /* The dimensions decide the output size before anything is decoded */
+    if (!get_picture_size(file_data, file_size, config, &ps)) {
+        report_decode_error(shell, file_data, file_size, 0, 0, 0);
+        return -EINVAL;
+    }
+    
+    gopher_out_begin(&image_out, shell);
+    gopher_out_printf(&image_out, "Image is %dx%d pixels, decoding at 1/%d\n",
+                      ps.width, ps.height, ps.scale);
+    print_header(&image_out, &ps);
+    
+    ret = draw_picture(file_data, file_size, config, &ps, out_sink, &image_out, &escape_bytes);
+    if (ret >= 0) {
+        print_footer(&image_out, config, ret, escape_bytes);
+    }
+    gopher_out_flush(&image_out);
+    
+    if (ret == -EINVAL) {
+        report_decode_error(shell, file_data, file_size, ps.width, ps.height, ps.channels);
+    } else if (ret < 0) {
+        shell_error(shell, "Not enough memory to render the image");
+    }
+    
+    return ret;
+}
+
+/* The stop callback is polled this often while a frame is on screen */
+#define ANIMATION_POLL_MS 50
+
+/* Frame delays of 10 ms or less are taken as 100 ms, as browsers do */
+#define ANIMATION_MAX_FAST_DELAY_MS 10
+#define ANIMATION_DEFAULT_DELAY_MS  100
+
+/* Wait until the frame's time is up. Returns false if stopped meanwhile. */
+static bool animation_wait(struct k_timer *timer, gopher_image_stop_t stop, void *user) {
+    while (k_timer_status_get(timer) == 0) {
+        if (stop && stop(user)) {
+            return false;
+        }
+        k_sleep(K_MSEC(MIN(k_timer_remaining_get(timer), ANIMATION_POLL_MS)));
+    }
+    
+    return !(stop && stop(user));
+}
+
+/* Feed one RGBA frame through the pipeline, on black where transparent */
+static int animation_draw(struct image_pipeline *p, const uint8_t *frame, int width, int height,
+                          uint8_t *rgb) {
+    gopher_scaler_reset(&p->scaler);
+    p->frame_bytes = 0;
+    p->escape_bytes = 0;
     
-    if (stbi_info_from_memory(file_data, file_size, &orig_width, &orig_height, &orig_channels)) {
-        dimensions_available = true;
-        /* Image dimensions obtained */
+    for (int y = 0; y < height; y++) {
+        const uint8_t *in = &frame[(size_t)y * width * 4];
         
-        /* Pre-check if this image will need too much memory */
-        size_t memory_needed = orig_width * orig_height * 3; /* 3 bytes per RGB pixel */
-        /* Use the same memory limit as defined earlier */
-        if (memory_needed > max_memory) {
-            shell_print(shell, "Large image detected (%dx%d, ~%zu KB), memory limit: %d KB", 
-                       orig_width, orig_height, memory_needed / 1024, max_memory / 1024);
-            
-            /* Use smaller target size for ASCII art */
-            int target_width = 32;  /* Very conservative target */
-            int target_height = 16;
-            
-            /* Try to maintain aspect ratio */
-            float aspect = (float)orig_width / orig_height;
-            if (aspect > 2.0f) {
-                /* Very wide image */
-                target_height = (int)(target_width / aspect);
-                if (target_height < 4) target_height = 4;
-            } else if (aspect < 0.5f) {
-                /* Very tall image */
-                target_width = (int)(target_height * aspect);
-                if (target_width < 8) target_width = 8;
-            }
-            
-            /* Create a simplified placeholder image at small size */
-            size_t alloc_size = target_width * target_height * sizeof(rgb_pixel_t);
-            rgb_pixel_t *placeholder = (rgb_pixel_t *)memory_alloc(alloc_size, shell);
-            
-            if (placeholder) {
-                /* Generate a gradient placeholder based on original dimensions */
-                for (int y = 0; y < target_height; y++) {
-                    for (int x = 0; x < target_width; x++) {
-                        int idx = y * target_width + x;
-                        placeholder[idx].r = (uint8_t)(x * 255 / target_width);
-                        placeholder[idx].g = (uint8_t)(y * 255 / target_height);
-                        placeholder[idx].b = 128;
-                    }
-                }
-                
-                shell_print(shell, "Using simplified placeholder for large image");
-                shell_print(shell, "Original image dimensions: %dx%d pixels", orig_width, orig_height);
-                
-                /* Render the ASCII art from our placeholder */
-                ret = render_ascii_art(shell, placeholder, target_width, target_height, config);
-                
-                /* Free the placeholder memory */
-                memory_free(placeholder);
-                
-                /* Return success, we've shown a placeholder */
-                return ret;
-            }
+        for (int x = 0; x < width; x++, in += 4) {
+            rgb[x * 3] = in[0] * in[3] / 255;
+            rgb[x * 3 + 1] = in[1] * in[3] / 255;
+            rgb[x * 3 + 2] = in[2] * in[3] / 255;
+        }
+        if (gopher_scaler_row(&p->scaler, y, rgb, width) != 0) {
+            return p->error;
         }
     }
     
-    /* Try to decode the image data to RGB pixels */
-    img = decode_image_to_rgb(file_data, file_size, &width, &height, shell, max_memory);
-    if (!img) {
-        shell_error(shell, "Failed to decode image data");
+    return 0;
+}
+
+int gopher_play_animation(const struct shell *shell, const uint8_t *data, size_t size,
+                          const ascii_art_config_t *config, gopher_image_stop_t stop, void *user) {
+    struct gopher_picture_size ps;
+    ascii_art_config_t anim_config = config ? *config : default_config;
+    struct image_pipeline pipeline;
+    struct k_timer timer;
+    stbi_gif_frames *frames;
+    const uint8_t *frame;
+    uint8_t *rgb;
+    size_t first_bytes = 0, delta_bytes = 0;
+    int width, height, delay;
+    int lines, drawn = 0;
+    bool playing = true;
+    int ret;
+    
+    if (size < 4 || memcmp(data, "GIF8", 4) != 0) {
+        return -ENOTSUP;
+    }
+    
+    if (!get_picture_size(data, size, &anim_config, &ps)) {
+        return -EINVAL;
+    }
+    
+    /* Diffused error carries a change across the whole picture below it,
+       so the 8 colours are dithered with the ordered pattern instead,
+       which leaves still areas alone */
+    if (anim_config.use_dithering && anim_config.dither != GOPHER_DITHER_BAYER) {
+        anim_config.dither = GOPHER_DITHER_BAYER;
+    }
+    
+    /* Frames are decoded at full size, the scaler does all the shrinking */
+    gopher_out_begin(&image_out, shell);
+    ret = image_arena_begin();
+    if (ret == 0) {
+        ret = pipeline_begin(&pipeline, &anim_config, ps.width, ps.height,
+                             ps.target_width, ps.target_height, out_sink, &image_out);
+        if (ret < 0) {
+            image_arena_end();
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
+    
+    pipeline.keys = gopher_image_alloc(ps.target_width * ps.target_height * sizeof(uint32_t) +
+                                       ps.width * 3);
+    if (!pipeline.keys) {
+        pipeline_end(&pipeline);
+        image_arena_end();
+        return -ENOMEM;
+    }
+    rgb = (uint8_t *)&pipeline.keys[ps.target_width * ps.target_height];
+    lines = anim_config.use_extended_chars ? (ps.target_height + 1) / 2 : ps.target_height;
+    
+    gopher_out_printf(&image_out, "Image is %dx%d pixels, animated\n", ps.width, ps.height);
+    print_header(&image_out, &ps);
+    
+    k_timer_init(&timer, NULL, NULL);
+    
+    /* Each loop decodes the file again, one frame in memory at a time */
+    for (int loop = 0; playing && loop < GOPHER_ANIMATION_LOOPS; loop++) {
+        int count = 0;
         
-        /* Check what kind of error we might have */
-        const char *error = stbi_failure_reason();
+        frames = stbi_gif_open(data, size);
+        if (!frames) {
+            break;
+        }
         
-        if (strstr(error, "no SOF") != NULL) {
-            shell_error(shell, "No JPEG Start Of Frame marker found - this usually means:");
-            shell_error(shell, "1. The server returned an HTML error page instead of an image");
-            shell_error(shell, "2. The server may require authentication or cookies");
-            shell_error(shell, "3. There might be a redirect to another page");
-        } else if (strstr(error, "bad huffman") != NULL) {
-            shell_error(shell, "Bad Huffman code found - the image data is corrupted or incomplete");
-        } else if (strstr(error, "PNG") != NULL) {
-            shell_error(shell, "PNG decoding error - file may be corrupted or in an unsupported format");
-        } else if (strstr(error, "outofmem") != NULL) {
-            shell_error(shell, "Image is too large for available memory");
+        /* The next frame is decoded while the current one is on screen */
+        while (playing && (frame = stbi_gif_next(frames, &width, &height, &delay)) != NULL) {
+            if (width != ps.width || height != ps.height) {
+                break;
+            }
             
-            if (dimensions_available) {
-                shell_print(shell, "Image dimensions: %dx%d pixels (%d channels)", 
-                           orig_width, orig_height, orig_channels);
+            if (drawn > 0) {
+                playing = animation_wait(&timer, stop, user);
+                if (!playing) {
+                    break;
+                }
+                gopher_out_printf(&image_out, "\033[%dA", lines);
             }
             
-            /* For out of memory errors, create a small placeholder gradient */
-            int ph_width = 32;
-            int ph_height = 16;
-            size_t alloc_size = ph_width * ph_height * sizeof(rgb_pixel_t);
-            rgb_pixel_t *placeholder = (rgb_pixel_t *)memory_alloc(alloc_size, shell);
+            /* The frame goes out whole, cursor movement included, before
+               its time starts */
+            ret = animation_draw(&pipeline, frame, width, height, rgb);
+            gopher_out_flush(&image_out);
+            if (ret < 0) {
+                playing = false;
+                break;
+            }
+            k_timer_start(&timer, K_MSEC(delay <= ANIMATION_MAX_FAST_DELAY_MS ?
+                                         ANIMATION_DEFAULT_DELAY_MS : delay), K_NO_WAIT);
             
-            if (placeholder) {
-                /* Generate a simple gradient */
-                for (int y = 0; y < ph_height; y++) {
-                    for (int x = 0; x < ph_width; x++) {
-                        int idx = y * ph_width + x;
-                        placeholder[idx].r = (uint8_t)(x * 255 / ph_width);
-                        placeholder[idx].g = (uint8_t)(y * 255 / ph_height);
-                        placeholder[idx].b = 128;
-                    }
-                }
-                
-                shell_print(shell, "Using placeholder image since original is too large for memory");
-                
-                /* Render the ASCII art from our placeholder */
-                ret = render_ascii_art(shell, placeholder, ph_width, ph_height, config);
-                
-                /* Free the placeholder memory */
-                memory_free(placeholder);
-                
-                /* Return success, we've shown a placeholder */
-                return ret;
+            if (drawn++ == 0) {
+                first_bytes = pipeline.frame_bytes;
+                pipeline.delta = true;
+            } else {
+                delta_bytes += pipeline.frame_bytes;
             }
-        } else {
-            shell_error(shell, "Image decoding error: %s", error);
+            count++;
+        }
+        
+        stbi_gif_close(frames);
+        
+        /* A single frame is a still picture */
+        if (count <= 1) {
+            break;
+        }
+    }
+    
+    k_timer_stop(&timer);
+    gopher_image_free(pipeline.keys);
+    pipeline_end(&pipeline);
+    image_arena_end();
+    
+    if (drawn == 0) {
+        /* Nothing went out yet, drop the header so the picture can be
+           drawn still instead */
+        gopher_out_begin(&image_out, shell);
+        return ret < 0 ? ret : -EINVAL;
+    }
+    
+    gopher_out_printf(&image_out, "----------------------------------------\n");
+    gopher_out_printf(&image_out,
+                      "%d frames drawn, %zu bytes for the first, %zu per frame after that\n",
+                      drawn, first_bytes, drawn > 1 ? delta_bytes / (drawn - 1) : 0);
+    gopher_out_flush(&image_out);
+    
+    return drawn;
+}
+
+/* Formats of an image stream, as far as previews are concerned */
+enum {
+    STREAM_UNKNOWN,
+    STREAM_JPEG,
+    STREAM_PNG,
+    STREAM_OTHER,
+};
+
+/* Grow a stream's buffer to hold at least 'need' bytes */
+static int stream_reserve(struct gopher_image_stream *stream, size_t need) {
+    size_t size = MAX(stream->size, (size_t)GOPHER_IMAGE_STREAM_CHUNK);
+    uint8_t *data;
+    
+    if (stream->data && need <= stream->size) {
+        return 0;
+    }
+    
+    while (size < need) {
+        size *= 2;
+    }
+    
+    data = gopher_mem_alloc(GOPHER_MEM_NET, size, GOPHER_MEM_BULK);
+    if (!data) {
+        return -ENOMEM;
+    }
+    
+    if (stream->len > 0) {
+        memcpy(data, stream->data, stream->len);
+    }
+    gopher_mem_free(stream->data);
+    stream->data = data;
+    stream->size = size;
+    
+    return 0;
+}
+
+/* Follow the markers of a progressive JPEG as it arrives, counting the
+ * scans received whole. Entropy-coded data only holds 0xFF followed by a
+ * stuffed zero or a restart marker, so the first other marker after a
+ * scan's header ends it. */
+static void stream_find_scans(struct gopher_image_stream *stream) {
+    const uint8_t *d = stream->data;
+    size_t len = stream->len;
+    size_t pos = stream->parse_pos;
+    
+    while (pos + 1 < len) {
+        uint8_t marker;
+        
+        if (stream->in_scan) {
+            if (d[pos] != 0xFF || d[pos + 1] == 0x00 ||
+                (d[pos + 1] >= 0xD0 && d[pos + 1] <= 0xD7)) {
+                pos++;
+                continue;
+            }
+            stream->in_scan = false;
+            stream->scans++;
+            stream->scan_end = pos;
         }
         
-        /* Check if this might be a text/HTML response and display if so */
-        if (looks_like_text_content(file_data, file_size)) {
-            display_text_content(shell, file_data, file_size);
-        } else if (file_size < 1024) {
-            /* For small non-image data, try displaying as text anyway */
-            shell_print(shell, "Attempting to display content as text:");
-            display_text_content(shell, file_data, file_size);
+        if (d[pos] != 0xFF) {
+            /* Lost track of the markers, leave it to the final decode */
+            stream->previews = false;
+            break;
         }
         
-        return -EINVAL;
+        marker = d[pos + 1];
+        if (marker == 0xFF) {
+            /* Fill byte */
+            pos++;
+            continue;
+        }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            /* No length field */
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9 || pos + 4 > len) {
+            break;
+        }
+        
+        if (marker == 0xC0 || marker == 0xC1) {
+            /* Sequential: a single scan, nothing to show before the end */
+            stream->previews = false;
+            break;
+        }
+        
+        if (marker == 0xDA) {
+            stream->in_scan = true;
+        }
+        pos += 2 + ((d[pos + 2] << 8) | d[pos + 3]);
+    }
+    
+    stream->parse_pos = pos;
+}
+
+/* Write each line of a picture and count them, so the next draw can go
+ * back over it. The header waits for the first line, as a preview may
+ * not decode at all. */
+static int stream_sink(void *user, const char *line, size_t len) {
+    struct gopher_image_stream *stream = user;
+    
+    if (stream->lines == 0 && stream->drawn == 0) {
+        gopher_out_printf(&image_out, "Image is %dx%d pixels, loading progressively\n",
+                          stream->size_info.width, stream->size_info.height);
+        print_header(&image_out, &stream->size_info);
+    }
+    out_sink(&image_out, line, len);
+    stream->drawn++;
+    
+    return 0;
+}
+
+/* Draw the first 'len' bytes of the stream over the last preview, if any.
+ * Returns the bytes of the frame or a negative errno. */
+static int stream_draw(struct gopher_image_stream *stream, size_t len, size_t *escape_bytes) {
+    int ret;
+    
+    gopher_out_begin(&image_out, stream->shell);
+    if (stream->lines > 0) {
+        /* Back to the first line of the picture */
+        gopher_out_printf(&image_out, "\033[%dA", stream->lines);
     }
     
-    shell_print(shell, "Successfully decoded image: %dx%d pixels", width, height);
+    stream->drawn = 0;
+    ret = draw_picture(stream->data, len, &stream->config, &stream->size_info, stream_sink, stream,
+                       escape_bytes);
+    stream->lines = MAX(stream->lines, stream->drawn);
     
-    /* Determine target dimensions for the console (aspect ratio 2:1 for terminal chars) */
-    int target_width = 40;  /* Reasonable default for most terminals */
-    int target_height = 20; /* Double the width-to-height ratio for text console */
+    /* A preview that did not decode leaves the screen as it was */
+    if (stream->drawn == 0) {
+        gopher_out_begin(&image_out, stream->shell);
+    }
+    gopher_out_flush(&image_out);
     
-    /* Create options for downscaling */
-    image_process_options_t options = {
-        .maintain_aspect_ratio = true,
-        .use_bilinear_filtering = true,
-        .brightness_adjust = config->brightness,
-        .contrast_adjust = config->contrast
-    };
+    return ret;
+}
+
+/* Draw a preview if the data received since the last one completes another
+ * scan or interlace pass */
+static void stream_preview(struct gopher_image_stream *stream) {
+    size_t escape_bytes;
+    
+    if (!stream->size_known) {
+        if (!get_picture_size(stream->data, stream->len, &stream->config, &stream->size_info)) {
+            return;
+        }
+        stream->size_known = true;
+    }
     
-    /* Downscale the image */
-    shell_print(shell, "DEBUG: Attempting to downscale image from %dx%d to %dx%d", 
-               width, height, target_width, target_height);
-    scaled_img = downscale_image_color(img, width, height, target_width, target_height, &options);
-    if (!scaled_img) {
-        shell_error(shell, "Failed to downscale image");
-        stbi_image_free(img);
+    if (stream->format == STREAM_JPEG) {
+        int scans = stream->scans;
+        uint8_t saved[2];
+        
+        stream_find_scans(stream);
+        if (!stream->previews || stream->scans == scans) {
+            return;
+        }
+        
+        /* Decode the complete scans as an image of their own, ending it
+           where the next scan begins */
+        memcpy(saved, &stream->data[stream->scan_end], 2);
+        stream->data[stream->scan_end] = 0xFF;
+        stream->data[stream->scan_end + 1] = 0xD9;
+        stream_draw(stream, stream->scan_end + 2, &escape_bytes);
+        memcpy(&stream->data[stream->scan_end], saved, 2);
+        return;
+    }
+    
+    /* PNG passes can only be told apart by inflating, so try again once
+       another quarter has arrived */
+    if (stream->len < stream->next_try) {
+        return;
+    }
+    stream->next_try = stream->len + MAX(stream->len / 4, (size_t)GOPHER_IMAGE_STREAM_CHUNK);
+    
+    stbi_set_png_partial(1);
+    if (stream_draw(stream, stream->len, &escape_bytes) >= 0 && stbi_png_passes() == 7) {
+        /* All there already, the final draw will do */
+        stream->previews = false;
+    }
+    stbi_set_png_partial(0);
+}
+
+int gopher_image_stream_begin(struct gopher_image_stream *stream, const struct shell *shell,
+                              const ascii_art_config_t *config) {
+    memset(stream, 0, sizeof(*stream));
+    stream->shell = shell;
+    stream->config = config ? *config : default_config;
+    stream->parse_pos = 2;
+    stream->previews = true;
+    
+    return stream_reserve(stream, GOPHER_IMAGE_STREAM_CHUNK);
+}
+
+int gopher_image_stream_feed(struct gopher_image_stream *stream, const uint8_t *data, size_t len) {
+    if (!stream->data) {
         return -ENOMEM;
     }
-    shell_print(shell, "DEBUG: Successfully downscaled image to %dx%d, result at %p", 
-               target_width, target_height, scaled_img);
     
-    /* Apply dithering if requested */
-    if (config->use_dithering) {
-        apply_floyd_steinberg_dithering(scaled_img, target_width, target_height);
+    /* Two spare bytes let a JPEG preview be ended in place */
+    if (stream_reserve(stream, stream->len + len + 2) < 0) {
+        /* Give up on the picture, the transfer carries on */
+        gopher_mem_free(stream->data);
+        stream->data = NULL;
+        return -ENOMEM;
+    }
+    memcpy(stream->data + stream->len, data, len);
+    stream->len += len;
+    
+    if (stream->format == STREAM_UNKNOWN && stream->len >= 29) {
+        /* Only progressive JPEGs and interlaced PNGs have anything to show
+           before the end */
+        if (stream->data[0] == 0xFF && stream->data[1] == 0xD8) {
+            stream->format = STREAM_JPEG;
+        } else if (memcmp(stream->data, "\x89PNG", 4) == 0 && stream->data[28] == 1) {
+            stream->format = STREAM_PNG;
+        } else {
+            stream->format = STREAM_OTHER;
+            stream->previews = false;
+        }
+    }
+    
+    if (stream->previews && stream->format != STREAM_UNKNOWN) {
+        stream_preview(stream);
     }
     
-    /* Render the ASCII art */
-    ret = render_ascii_art(shell, scaled_img, target_width, target_height, config);
+    return 0;
+}
+
+int gopher_image_stream_end(struct gopher_image_stream *stream, bool complete) {
+    size_t escape_bytes = 0;
+    int ret = 0;
     
-    /* Free memory */
-    stbi_image_free(img);  /* Use stbi_image_free instead of k_free for the original image */
+    if (!stream->data) {
+        if (complete) {
+            shell_error(stream->shell, "Image is too large for available memory");
+        }
+        return -ENOMEM;
+    }
     
-    /* Free the scaled image */
-    memory_free(scaled_img);
+    if (complete && stream->lines == 0) {
+        /* Nothing shown yet, draw it like any other picture */
+        ret = gopher_render_image(stream->shell, stream->data, stream->len, &stream->config);
+    } else if (complete) {
+        /* The whole picture over the last preview */
+        ret = stream_draw(stream, stream->len, &escape_bytes);
+        if (ret >= 0) {
+            print_footer(&image_out, &stream->config, ret, escape_bytes);
+            gopher_out_flush(&image_out);
+        } else if (ret == -EINVAL) {
+            report_decode_error(stream->shell, stream->data, stream->len, stream->size_info.width,
+                                stream->size_info.height, stream->size_info.channels);
+        } else {
+            shell_error(stream->shell, "Not enough memory to render the image");
+        }
+    }
+    
+    gopher_mem_free(stream->data);
+    stream->data = NULL;
     
     return ret;
 }
 
 /* Initialize the image rendering module */
 int gopher_image_init(void) {
+    int levels = 1 << PALETTE_LUT_BITS;
+    int step = 256 / levels;
+    
+    if (palette_lut_ready) {
+        return 0;
+    }
+    
+    /* Match the centre of each quantisation cell */
+    for (int r = 0; r < levels; r++) {
+        for (int g = 0; g < levels; g++) {
+            for (int b = 0; b < levels; b++) {
+                uint8_t cr = r * step + step / 2;
+                uint8_t cg = g * step + step / 2;
+                uint8_t cb = b * step + step / 2;
+                
+                palette_lut[PALETTE_LUT_INDEX(cr, cg, cb)] = nearest_terminal_color(cr, cg, cb);
+            }
+        }
+    }
+    palette_lut_ready = true;
+    
     return 0;
+}
+
+const char *gopher_color_mode_name(int color_mode) {
+    switch (color_mode) {
+    case GOPHER_COLOR_MODE_TRUE:
+        return "truecolour";
+    case GOPHER_COLOR_MODE_256:
+        return "256 colours";
+    default:
+        return "8 colours";
+    }
+}
+
+const char *gopher_dither_name(int dither) {
+    switch (dither) {
+    case GOPHER_DITHER_ATKINSON:
+        return "Atkinson";
+    case GOPHER_DITHER_SIERRA_LITE:
+        return "Sierra Lite";
+    case GOPHER_DITHER_BAYER:
+        return "Bayer 4x4";
+    default:
+        return "Floyd-Steinberg";
+    }
+}
+
+int gopher_image_nearest_color(uint8_t r, uint8_t g, uint8_t b) {
+    return rgb_to_terminal_color(r, g, b);
 }
\ No newline at end of file
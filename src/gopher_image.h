@@ -22,16 +22,141 @@ typedef struct {
     float contrast_adjust;    /* 0.5-2.0, 1.0 is neutral */
 } image_process_options_t;
 
+/* Memory for decoding and drawing one picture, reserved on first use and
+ * kept; taken from PSRAM when available. Set by Kconfig, whose default
+ * follows the heap size. */
+#define GOPHER_IMAGE_ARENA_SIZE CONFIG_GOPHER_IMAGE_ARENA_SIZE
+
+/* Widest picture drawn in characters, whatever the terminal, as the image
+ * arena has to hold a few rows of it */
+#ifdef CONFIG_ESP_SPIRAM
+#define GOPHER_IMAGE_MAX_COLUMNS 320
+#else
+#define GOPHER_IMAGE_MAX_COLUMNS 100
+#endif
+
+/* Terminal lines left free of a picture, for its header and the prompt */
+#define GOPHER_IMAGE_RESERVED_LINES 4
+
+/* Colour modes, named by their number of colours */
+#define GOPHER_COLOR_MODE_8     8           /* Basic ANSI colours */
+#define GOPHER_COLOR_MODE_256   256         /* xterm-256 palette */
+#define GOPHER_COLOR_MODE_TRUE  16777216    /* 24-bit SGR colour */
+
+/* Dithering methods for the 8-colour mode. The first three diffuse the
+ * quantisation error, Bayer is ordered dithering. */
+#define GOPHER_DITHER_FLOYD_STEINBERG   0
+#define GOPHER_DITHER_ATKINSON          1
+#define GOPHER_DITHER_SIERRA_LITE       2
+#define GOPHER_DITHER_BAYER             3
+
 /* Configuration struct for ASCII art rendering */
 typedef struct {
     bool use_color;          /* Use color or grayscale */
     bool use_dithering;      /* Apply dithering to improve color */
-    bool use_extended_chars; /* Use extended ASCII for better resolution */
-    int color_mode;          /* 8 or 16 colors */
+    bool use_extended_chars; /* Draw two pixels per cell with Unicode half blocks */
+    int color_mode;          /* GOPHER_COLOR_MODE_8, _256 or _TRUE */
+    int dither;              /* GOPHER_DITHER_*, when use_dithering is set */
     float brightness;        /* Brightness adjustment (0.5-2.0) */
     float contrast;          /* Contrast adjustment (0.5-2.0) */
+    int columns;             /* Character cells the picture may fill, 0 for 80x20 */
+    int lines;
 } ascii_art_config_t;
 
+/* Size of a picture in full, as decoded and as drawn */
+struct gopher_picture_size {
+    int width, height, channels;    /* From the header */
+    int scale;                      /* Decoder scale */
+    int target_width, target_height;
+};
+
+/* Times an animation is played, unless stopped earlier */
+#define GOPHER_ANIMATION_LOOPS 5
+
+/* Polled while an animation plays, returns true to stop it */
+typedef bool (*gopher_image_stop_t)(void *user);
+
+/**
+ * @brief Play an animated GIF in place
+ *
+ * The first frame is drawn whole. Each later frame is drawn over it once
+ * the previous frame's delay is up, rewriting only the character cells
+ * that changed. Frames are decoded one at a time into a single buffer.
+ *
+ * @param shell Shell to draw on
+ * @param data GIF file data
+ * @param size Size of the data in bytes
+ * @param config Pointer to the ASCII art configuration (or NULL for default)
+ * @param stop Polled between frames, or NULL to play to the end
+ * @param user Passed to stop
+ * Nothing is printed unless a frame is drawn, so on an error the caller
+ * can still draw the picture with gopher_render_image().
+ *
+ * @return Number of frames drawn, -ENOTSUP if the data is not a GIF,
+ *         negative errno if no frame could be drawn
+ */
+int gopher_play_animation(const struct shell *shell, const uint8_t *data, size_t size,
+                          const ascii_art_config_t *config, gopher_image_stop_t stop, void *user);
+
+/* Buffer growth step of an image stream, also the least data between two
+ * attempts at previewing an interlaced PNG */
+#define GOPHER_IMAGE_STREAM_CHUNK 16384
+
+/* A picture drawn while it is being received. Each time another scan of a
+ * progressive JPEG or pass of an interlaced PNG arrives, a preview is drawn
+ * over the last one; the complete picture finally replaces it. */
+struct gopher_image_stream {
+    const struct shell *shell;
+    ascii_art_config_t config;
+    uint8_t *data;              /* Received so far, NULL once out of memory */
+    size_t len;
+    size_t size;
+    int format;
+    bool previews;              /* More previews may come */
+    bool size_known;            /* size_info is valid */
+    struct gopher_picture_size size_info;
+    size_t parse_pos;           /* JPEG: next byte to look at */
+    bool in_scan;               /* JPEG: parse_pos is inside a scan */
+    int scans;                  /* JPEG: complete scans */
+    size_t scan_end;            /* JPEG: end of the last complete scan */
+    size_t next_try;            /* PNG: length for the next preview attempt */
+    int lines;                  /* Picture lines on screen, 0 before the first preview */
+    int drawn;                  /* Lines of the picture being drawn */
+};
+
+/**
+ * @brief Start receiving a picture to draw progressively
+ *
+ * @param stream Stream state
+ * @param shell Shell to draw on
+ * @param config Pointer to the ASCII art configuration (or NULL for default)
+ * @return 0 on success, -ENOMEM if out of memory
+ */
+int gopher_image_stream_begin(struct gopher_image_stream *stream, const struct shell *shell,
+                              const ascii_art_config_t *config);
+
+/**
+ * @brief Add received data, drawing a preview if it completes another
+ *        scan or pass
+ *
+ * @param stream Stream state
+ * @param data Received bytes
+ * @param len Number of bytes
+ * @return 0 on success, -ENOMEM if the picture no longer fits in memory
+ */
+int gopher_image_stream_feed(struct gopher_image_stream *stream, const uint8_t *data, size_t len);
+
+/**
+ * @brief Finish a picture stream and release its buffer
+ *
+ * @param stream Stream state
+ * @param complete Whether the whole picture arrived; if so it is drawn,
+ *                 over the last preview if there is one
+ * @return Bytes of terminal output for the picture, 0 if incomplete,
+ *         negative errno otherwise
+ */
+int gopher_image_stream_end(struct gopher_image_stream *stream, bool complete);
+
 /**
  * @brief Render an image file as ASCII art on the console
  *
@@ -39,7 +164,8 @@ typedef struct {
  * @param file_data Pointer to the file data buffer
  * @param file_size Size of the file data buffer
  * @param config Pointer to the ASCII art configuration (or NULL for default)
- * @return 0 on success, negative errno otherwise
+ * @return Bytes of terminal output for the picture on success,
+ *         negative errno otherwise
  */
 int gopher_render_image(const struct shell *shell, uint8_t *file_data, 
                         size_t file_size, ascii_art_config_t *config);
@@ -53,11 +179,67 @@ int gopher_render_image(const struct shell *shell, uint8_t *file_data,
  */
 bool gopher_is_image(const uint8_t *data, size_t size);
 
+/**
+ * @brief Allocate a buffer for drawing a picture
+ *
+ * While a picture is being decoded or drawn, buffers come from the image
+ * arena and fail once GOPHER_IMAGE_ARENA_SIZE is used up; they only live
+ * until the drawing ends. Otherwise they are charged to GOPHER_MEM_IMAGE
+ * with gopher_mem_alloc().
+ *
+ * @param size Number of bytes to allocate
+ * @return Pointer to the buffer, or NULL if out of memory
+ */
+void *gopher_image_alloc(size_t size);
+
+/**
+ * @brief Free a buffer allocated with gopher_image_alloc()
+ *
+ * @param ptr Buffer to free (may be NULL)
+ */
+void gopher_image_free(void *ptr);
+
+/**
+ * @brief Get the most of the image arena any picture has used so far
+ *
+ * @return Peak number of bytes in use, 0 before the first picture
+ */
+size_t gopher_image_arena_peak(void);
+
 /**
  * @brief Initialize the image rendering module
  *
+ * Builds the colour lookup table used to match pixels to the terminal
+ * palette. Must run before the first image is rendered.
+ *
  * @return 0 on success, negative errno otherwise
  */
 int gopher_image_init(void);
 
+/**
+ * @brief Name a colour mode for display
+ *
+ * @param color_mode GOPHER_COLOR_MODE_8, _256 or _TRUE
+ * @return Name of the mode
+ */
+const char *gopher_color_mode_name(int color_mode);
+
+/**
+ * @brief Name a dithering method for display
+ *
+ * @param dither GOPHER_DITHER_*
+ * @return Name of the method
+ */
+const char *gopher_dither_name(int dither);
+
+/**
+ * @brief Map a colour to the nearest of the 8 basic terminal colours
+ *
+ * @param r Red component
+ * @param g Green component
+ * @param b Blue component
+ * @return Palette index, 0 (black) to 7 (white)
+ */
+int gopher_image_nearest_color(uint8_t r, uint8_t g, uint8_t b);
+
 #endif /* GOPHER_IMAGE_H_ */
\ No newline at end of file
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+#include "gopher_mem.h"
+#include "gopher_cache.h"
+#include "gopher_image.h"
+
+#ifdef CONFIG_ESP_SPIRAM
+#include <zephyr/multi_heap/shared_multi_heap.h>
+#endif
+
+LOG_MODULE_REGISTER(gopher_mem, LOG_LEVEL_ERR);
+
+/* Each buffer is preceded by a header recording what it was charged to and
+ * where it was placed, so it can be accounted for and given back to the
+ * right heap. It keeps the buffer 8-byte aligned. */
+struct mem_header {
+    uint32_t size;
+    uint8_t pool;
+    uint8_t external;
+    uint16_t magic;
+};
+
+#define MEM_MAGIC 0x6d47
+
+static const char *const pool_names[GOPHER_MEM_POOLS] = {
+    [GOPHER_MEM_CACHE] = "cache",
+    [GOPHER_MEM_IMAGE] = "image",
+    [GOPHER_MEM_NET] = "net",
+    [GOPHER_MEM_BENCH] = "bench",
+};
+
+static struct gopher_mem_stats pools[GOPHER_MEM_POOLS] = {
+    [GOPHER_MEM_CACHE] = { .budget = GOPHER_CACHE_SIZE + sizeof(struct mem_header) },
+    [GOPHER_MEM_IMAGE] = { .budget = GOPHER_IMAGE_ARENA_SIZE + GOPHER_MEM_IMAGE_SPARE },
+    [GOPHER_MEM_NET] = { .budget = GOPHER_MEM_NET_BUDGET },
+    [GOPHER_MEM_BENCH] = { .budget = GOPHER_MEM_BENCH_BUDGET },
+};
+
+static K_MUTEX_DEFINE(mem_lock);
+
+/* Take the block from the region the hints point to, or from the other one */
+static struct mem_header *mem_block_alloc(size_t total, uint32_t flags, bool *external)
+{
+    struct mem_header *header = NULL;
+    
+#ifdef CONFIG_ESP_SPIRAM
+    bool prefer_external;
+    
+    if (flags & GOPHER_MEM_HOT) {
+        prefer_external = false;
+    } else if (flags & GOPHER_MEM_BULK) {
+        prefer_external = true;
+    } else {
+        prefer_external = total >= GOPHER_MEM_EXTERNAL_THRESHOLD;
+    }
+    
+    if (prefer_external) {
+        header = shared_multi_heap_alloc(SMH_REG_ATTR_EXTERNAL, total);
+        if (header) {
+            *external = true;
+            return header;
+        }
+    }
+    header = k_malloc(total);
+    if (!header && !prefer_external) {
+        header = shared_multi_heap_alloc(SMH_REG_ATTR_EXTERNAL, total);
+        *external = header != NULL;
+    }
+#else
+    ARG_UNUSED(flags);
+    header = k_malloc(total);
+#endif
+    
+    return header;
+}
+
+void *gopher_mem_alloc(enum gopher_mem_pool pool, size_t size, uint32_t flags)
+{
+    struct gopher_mem_stats *stats = &pools[pool];
+    struct mem_header *header;
+    size_t total = size + sizeof(*header);
+    bool external = false;
+    
+    if (size > UINT32_MAX - sizeof(*header)) {
+        return NULL;
+    }
+    
+    /* Charge the pool first, so two threads cannot both squeeze under the
+       budget */
+    k_mutex_lock(&mem_lock, K_FOREVER);
+    if (stats->budget > 0 && total > stats->budget - MIN(stats->used, stats->budget)) {
+        stats->failures++;
+        k_mutex_unlock(&mem_lock);
+        LOG_WRN("%s: %zu bytes would exceed the budget of %zu, %zu in use",
+                pool_names[pool], size, stats->budget, stats->used);
+        return NULL;
+    }
+    stats->used += total;
+    k_mutex_unlock(&mem_lock);
+    
+    header = mem_block_alloc(total, flags, &external);
+    
+    k_mutex_lock(&mem_lock, K_FOREVER);
+    if (!header) {
+        stats->used -= total;
+        stats->failures++;
+    } else {
+        stats->allocs++;
+        stats->peak = MAX(stats->peak, stats->used);
+        if (external) {
+            stats->external += total;
+        }
+    }
+    k_mutex_unlock(&mem_lock);
+    
+    if (!header) {
+        LOG_ERR("%s: out of memory for %zu bytes", pool_names[pool], size);
+        return NULL;
+    }
+    
+    header->size = total;
+    header->pool = pool;
+    header->external = external;
+    header->magic = MEM_MAGIC;
+    
+    return header + 1;
+}
+
+void gopher_mem_free(void *ptr)
+{
+    struct mem_header *header;
+    struct gopher_mem_stats *stats;
+    
+    if (!ptr) {
+        return;
+    }
+    
+    header = (struct mem_header *)ptr - 1;
+    __ASSERT(header->magic == MEM_MAGIC, "Not allocated with gopher_mem_alloc()");
+    stats = &pools[header->pool];
+    
+    k_mutex_lock(&mem_lock, K_FOREVER);
+    stats->used -= header->size;
+    if (header->external) {
+        stats->external -= header->size;
+    }
+    k_mutex_unlock(&mem_lock);
+    
+    header->magic = 0;
+#ifdef CONFIG_ESP_SPIRAM
+    if (header->external) {
+        shared_multi_heap_free(header);
+        return;
+    }
+#endif
+    k_free(header);
+}
+
+void gopher_mem_stats(enum gopher_mem_pool pool, struct gopher_mem_stats *stats)
+{
+    k_mutex_lock(&mem_lock, K_FOREVER);
+    *stats = pools[pool];
+    k_mutex_unlock(&mem_lock);
+}
+
+const char *gopher_mem_pool_name(enum gopher_mem_pool pool)
+{
+    return pool < GOPHER_MEM_POOLS ? pool_names[pool] : "?";
+}
+
+void gopher_mem_reset_peaks(void)
+{
+    k_mutex_lock(&mem_lock, K_FOREVER);
+    for (int i = 0; i < GOPHER_MEM_POOLS; i++) {
+        pools[i].peak = pools[i].used;
+        pools[i].failures = 0;
+    }
+    k_mutex_unlock(&mem_lock);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_MEM_H_
+#define GOPHER_MEM_H_
+
+#include <zephyr/kernel.h>
+
+/* Parts of the client that allocate memory, each with its own budget */
+enum gopher_mem_pool {
+    GOPHER_MEM_CACHE = 0,       /* Response cache heap */
+    GOPHER_MEM_IMAGE,           /* Image arena and buffers for drawing pictures */
+    GOPHER_MEM_NET,             /* Responses collected whole, e.g. pictures as they arrive */
+    GOPHER_MEM_BENCH,           /* Benchmark data */
+    GOPHER_MEM_POOLS,
+};
+
+/* Hints on how a buffer is used, deciding where it is placed */
+#define GOPHER_MEM_HOT  BIT(0)  /* Touched often in tight loops, keep it in internal RAM */
+#define GOPHER_MEM_BULK BIT(1)  /* Large and mostly read through once, PSRAM is fine */
+
+/* Without a hint, buffers at least this large go to PSRAM when available */
+#define GOPHER_MEM_EXTERNAL_THRESHOLD 4096
+
+/* Budgets of the pools; 0 means no limit. A growing buffer briefly holds
+ * both its old and its new copy, so the NET budget lets a 1 MB picture
+ * (32 KB without PSRAM) be grown out of half its size. */
+#ifdef CONFIG_ESP_SPIRAM
+#define GOPHER_MEM_NET_BUDGET (1600 * 1024)
+#else
+#define GOPHER_MEM_NET_BUDGET (64 * 1024)
+#endif
+#define GOPHER_MEM_BENCH_BUDGET 0
+
+/* The cache and image pools hold their reserved block; the image pool also
+ * has room for buffers allocated while no picture is being drawn */
+#ifdef CONFIG_ESP_SPIRAM
+#define GOPHER_MEM_IMAGE_SPARE (64 * 1024)
+#else
+#define GOPHER_MEM_IMAGE_SPARE (8 * 1024)
+#endif
+
+/* Usage of a pool, as reported by 'gopher mem' */
+struct gopher_mem_stats {
+    size_t budget;              /* 0 for no limit */
+    size_t used;                /* Bytes allocated now */
+    size_t peak;                /* Highest value of used */
+    size_t external;            /* Part of used placed in PSRAM */
+    uint32_t allocs;
+    uint32_t failures;          /* Allocations refused or out of memory */
+};
+
+/**
+ * @brief Allocate a buffer on behalf of a pool
+ *
+ * The buffer is placed in internal RAM or in PSRAM (when the board has it)
+ * according to the hints and its size, falling back to the other one if the
+ * preferred region is full. Allocations that would take the pool over its
+ * budget fail.
+ *
+ * @param pool Pool the buffer is charged to
+ * @param size Number of bytes to allocate
+ * @param flags GOPHER_MEM_HOT, GOPHER_MEM_BULK or 0
+ * @return Pointer to the buffer, or NULL if out of memory or over budget
+ */
+void *gopher_mem_alloc(enum gopher_mem_pool pool, size_t size, uint32_t flags);
+
+/**
+ * @brief Free a buffer allocated with gopher_mem_alloc()
+ *
+ * @param ptr Buffer to free (may be NULL)
+ */
+void gopher_mem_free(void *ptr);
+
+/**
+ * @brief Get the usage of a pool
+ *
+ * @param pool Pool to look at
+ * @param stats Filled in with the pool's usage
+ */
+void gopher_mem_stats(enum gopher_mem_pool pool, struct gopher_mem_stats *stats);
+
+/**
+ * @brief Get the name of a pool
+ *
+ * @param pool Pool to name
+ * @return Short lower case name
+ */
+const char *gopher_mem_pool_name(enum gopher_mem_pool pool);
+
+/**
+ * @brief Forget the peaks and failure counts of all pools
+ */
+void gopher_mem_reset_peaks(void);
+
+#endif /* GOPHER_MEM_H_ */
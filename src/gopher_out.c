@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "gopher_out.h"
+
+static atomic_t out_bytes;
+static atomic_t out_writes;
+static atomic_t out_requests;
+
+/* Hand bytes to the shell, in one call unless they hold NUL bytes. Those
+ * would end the formatted string early, so they are left out. */
+static void out_emit(const struct shell *shell, const char *data, size_t len)
+{
+    const char *end = data + len;
+    
+    while (data < end) {
+        const char *nul = memchr(data, '\0', end - data);
+        size_t run = (nul ? nul : end) - data;
+        
+        if (run > 0) {
+            shell_fprintf(shell, SHELL_NORMAL, "%.*s", (int)run, data);
+            atomic_add(&out_bytes, run);
+            atomic_inc(&out_writes);
+        }
+        data += run + (nul ? 1 : 0);
+    }
+}
+
+void gopher_out_begin(struct gopher_out *out, const struct shell *shell)
+{
+    out->shell = shell;
+    out->len = 0;
+}
+
+void gopher_out_write(struct gopher_out *out, const char *data, size_t len)
+{
+    atomic_inc(&out_requests);
+    
+    if (len > sizeof(out->buf) - out->len) {
+        gopher_out_flush(out);
+    }
+    
+    /* Too large to collect, it goes out as it is */
+    if (len > sizeof(out->buf)) {
+        out_emit(out->shell, data, len);
+        return;
+    }
+    
+    memcpy(out->buf + out->len, data, len);
+    out->len += len;
+}
+
+void gopher_out_printf(struct gopher_out *out, const char *fmt, ...)
+{
+    size_t space = sizeof(out->buf) - out->len;
+    va_list args;
+    int len;
+    
+    atomic_inc(&out_requests);
+    
+    va_start(args, fmt);
+    len = vsnprintf(out->buf + out->len, space, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < space) {
+        out->len += len;
+        return;
+    }
+    
+    /* Did not fit behind what is there, try again in an empty buffer */
+    gopher_out_flush(out);
+    va_start(args, fmt);
+    if ((size_t)len < sizeof(out->buf)) {
+        out->len = vsnprintf(out->buf, sizeof(out->buf), fmt, args);
+    } else {
+        shell_vfprintf(out->shell, SHELL_NORMAL, fmt, args);
+        atomic_add(&out_bytes, len);
+        atomic_inc(&out_writes);
+    }
+    va_end(args);
+}
+
+void gopher_out_flush(struct gopher_out *out)
+{
+    if (out->len == 0) {
+        return;
+    }
+    
+    out_emit(out->shell, out->buf, out->len);
+    out->len = 0;
+}
+
+void gopher_out_get_stats(struct gopher_out_stats *stats)
+{
+    stats->bytes = atomic_get(&out_bytes);
+    stats->writes = atomic_get(&out_writes);
+    stats->requests = atomic_get(&out_requests);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_OUT_H_
+#define GOPHER_OUT_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+/* Bytes collected before they are written to the shell in one call */
+#define GOPHER_OUT_BUFFER_SIZE 2048
+
+/* Collects output for the shell, so a screenful costs a few shell calls
+ * instead of one per line. Each thread that draws has its own. */
+struct gopher_out {
+    const struct shell *shell;
+    size_t len;
+    char buf[GOPHER_OUT_BUFFER_SIZE];
+};
+
+/* Totals over all writers, as reported by 'gopher term' */
+struct gopher_out_stats {
+    uint32_t bytes;             /* Bytes written to the shell */
+    uint32_t writes;            /* Shell calls they took */
+    uint32_t requests;          /* Writes and prints handed to the writers */
+};
+
+/**
+ * @brief Start writing to a shell, dropping anything not flushed
+ *
+ * @param out Writer
+ * @param shell Shell to write to
+ */
+void gopher_out_begin(struct gopher_out *out, const struct shell *shell);
+
+/**
+ * @brief Add bytes to the output
+ *
+ * NUL bytes cannot go through the shell's formatted output and are left
+ * out; the rest of the data is written.
+ *
+ * @param out Writer
+ * @param data Bytes to write, copied before the call returns
+ * @param len Number of bytes in data
+ */
+void gopher_out_write(struct gopher_out *out, const char *data, size_t len);
+
+/**
+ * @brief Add formatted text to the output
+ *
+ * @param out Writer
+ * @param fmt printf-style format
+ */
+void gopher_out_printf(struct gopher_out *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Write everything collected so far to the shell
+ *
+ * Called at the end of a frame, a page or a received chunk, and before
+ * anything is printed on the shell directly.
+ *
+ * @param out Writer
+ */
+void gopher_out_flush(struct gopher_out *out);
+
+/**
+ * @brief Read the output totals
+ *
+ * @param stats Filled with the totals
+ */
+void gopher_out_get_stats(struct gopher_out_stats *stats);
+
+#endif /* GOPHER_OUT_H_ */
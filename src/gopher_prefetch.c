@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+#include <errno.h>
+#include "gopher_prefetch.h"
+#include "gopher_request.h"
+
+LOG_MODULE_REGISTER(gopher_prefetch, LOG_LEVEL_ERR);
+
+/* A round of prefetches for one menu */
+struct prefetch_round {
+    struct gopher_client *client;
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];
+    uint16_t port;
+    char selectors[GOPHER_PREFETCH_MAX_ITEMS][GOPHER_MAX_SELECTOR_LEN];
+    char types[GOPHER_PREFETCH_MAX_ITEMS];
+    int count;
+    int next;                   /* Index of the next item to fetch */
+    size_t received;            /* Bytes downloaded by this round */
+    size_t cached;              /* Bytes added to the cache by this round */
+    bool running;
+};
+
+static struct prefetch_round prefetch;
+static struct gopher_prefetch_stats prefetch_stats;
+static bool prefetch_enabled;
+static K_MUTEX_DEFINE(prefetch_lock);
+
+/* The request of the running prefetch; only touched by the fetch engine
+ * while it runs */
+static struct gopher_request prefetch_req;
+static struct gopher_cache_writer prefetch_writer;
+static bool prefetch_over_budget;
+static char prefetch_type;
+
+/* Last bytes of the response, telling whether a menu arrived whole */
+static uint8_t prefetch_tail[4];
+
+static void prefetch_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(prefetch_work, prefetch_work_handler);
+
+/* Runs on the fetch engine: only prefetch while still on the menu's server */
+static int prefetch_prepare(struct gopher_client *client, void *user_data)
+{
+    if (strcmp(client->hostname, prefetch.hostname) != 0 || client->port != prefetch.port) {
+        return -ESTALE;
+    }
+    
+    return gopher_cache_writer_begin(&prefetch_writer, client, prefetch_req.selector);
+}
+
+static int prefetch_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    /* Stop downloading once the bandwidth budget or the size of a cache
+       entry is exceeded, the partial response is useless */
+    if (prefetch.received + prefetch_req.received > GOPHER_PREFETCH_MAX_BYTES ||
+        prefetch_writer.block == NULL) {
+        prefetch_over_budget = true;
+        return 1;
+    }
+    
+    gopher_cache_writer_append(&prefetch_writer, data, len);
+    
+    if (len >= sizeof(prefetch_tail)) {
+        memcpy(prefetch_tail, data + len - sizeof(prefetch_tail), sizeof(prefetch_tail));
+    } else {
+        memmove(prefetch_tail, prefetch_tail + len, sizeof(prefetch_tail) - len);
+        memcpy(prefetch_tail + sizeof(prefetch_tail) - len, data, len);
+    }
+    
+    return 0;
+}
+
+/* Whether a menu ended with its terminating period, rather than being cut off */
+static bool prefetch_menu_ended(void)
+{
+    static const char *const endings[] = { "\n.\r\n", "\n.\n" };
+    
+    for (int i = 0; i < ARRAY_SIZE(endings); i++) {
+        size_t n = strlen(endings[i]);
+        
+        if (prefetch_req.received >= n &&
+            memcmp(prefetch_tail + sizeof(prefetch_tail) - n, endings[i], n) == 0) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+static void prefetch_done(int result, void *user_data)
+{
+    size_t size = prefetch_writer.len;
+    bool keep;
+    
+    /* Only whole responses are kept: the server closed the connection
+       after all of it, and a menu ended with its period */
+    keep = result >= 0 && !prefetch_over_budget && prefetch_writer.block != NULL &&
+           (prefetch_type != GOPHER_TYPE_DIRECTORY || prefetch_menu_ended());
+    
+    if (prefetch_writer.block != NULL) {
+        gopher_cache_writer_end(&prefetch_writer, keep);
+    }
+    
+    k_mutex_lock(&prefetch_lock, K_FOREVER);
+    
+    prefetch_stats.bytes += prefetch_req.received;
+    prefetch.received += prefetch_req.received;
+    
+    if (keep) {
+        prefetch_stats.fetched++;
+        prefetch.cached += size;
+    } else if (result == -ECANCELED) {
+        prefetch_stats.cancelled++;
+    } else {
+        prefetch_stats.dropped++;
+    }
+    
+    prefetch.next++;
+    if (prefetch.running) {
+        k_work_schedule(&prefetch_work, K_MSEC(GOPHER_PREFETCH_DELAY_MS));
+    }
+    
+    k_mutex_unlock(&prefetch_lock);
+}
+
+/* Runs on the system work queue: start the next prefetch once the fetch
+ * engine is idle */
+static void prefetch_work_handler(struct k_work *work)
+{
+    int ret;
+    
+    k_mutex_lock(&prefetch_lock, K_FOREVER);
+    
+    if (!prefetch.running) {
+        k_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    
+    /* Items cached since the round was planned are skipped */
+    while (prefetch.next < prefetch.count &&
+           gopher_cache_contains(prefetch.hostname, prefetch.port,
+                                 prefetch.selectors[prefetch.next])) {
+        prefetch.next++;
+    }
+    
+    if (prefetch.next >= prefetch.count ||
+        prefetch.received >= GOPHER_PREFETCH_MAX_BYTES ||
+        prefetch.cached >= GOPHER_PREFETCH_MAX_CACHE_BYTES) {
+        prefetch.running = false;
+        k_mutex_unlock(&prefetch_lock);
+        return;
+    }
+    
+    memset(&prefetch_req, 0, sizeof(prefetch_req));
+    prefetch_req.client = prefetch.client;
+    prefetch_req.selector = prefetch.selectors[prefetch.next];
+    prefetch_req.prepare = prefetch_prepare;
+    prefetch_req.sink = prefetch_sink;
+    prefetch_req.done = prefetch_done;
+    prefetch_req.background = true;
+    prefetch_over_budget = false;
+    prefetch_type = prefetch.types[prefetch.next];
+    memset(prefetch_tail, 0, sizeof(prefetch_tail));
+    
+    ret = gopher_request_submit(&prefetch_req);
+    if (ret == -EBUSY) {
+        /* The user got there first, try again when the engine is idle */
+        k_work_schedule(&prefetch_work, K_MSEC(GOPHER_PREFETCH_DELAY_MS));
+    } else if (ret < 0) {
+        LOG_ERR("Failed to submit prefetch: %d", ret);
+        prefetch.running = false;
+    }
+    
+    k_mutex_unlock(&prefetch_lock);
+}
+
+void gopher_prefetch_enable(bool enable)
+{
+    if (!enable) {
+        gopher_prefetch_stop();
+    }
+    
+    prefetch_enabled = enable;
+}
+
+bool gopher_prefetch_enabled(void)
+{
+    return prefetch_enabled;
+}
+
+int gopher_prefetch_start(struct gopher_client *client)
+{
+    struct gopher_item item;
+    int count = 0;
+    
+    if (!prefetch_enabled || client == NULL) {
+        return 0;
+    }
+    
+    k_mutex_lock(&prefetch_lock, K_FOREVER);
+    
+    /* The user almost always picks one of the first few items */
+    for (int i = 0; i < client->item_count && count < GOPHER_PREFETCH_MAX_ITEMS; i++) {
+        gopher_get_item(client, i, &item);
+        
+        if ((item.type != GOPHER_TYPE_DIRECTORY && item.type != GOPHER_TYPE_TEXT) ||
+            item.port != client->port || strcmp(item.hostname, client->hostname) != 0) {
+            continue;
+        }
+        
+        strncpy(prefetch.selectors[count], item.selector, GOPHER_MAX_SELECTOR_LEN - 1);
+        prefetch.selectors[count][GOPHER_MAX_SELECTOR_LEN - 1] = '\0';
+        prefetch.types[count] = item.type;
+        count++;
+    }
+    
+    prefetch.client = client;
+    strcpy(prefetch.hostname, client->hostname);
+    prefetch.port = client->port;
+    prefetch.count = count;
+    prefetch.next = 0;
+    prefetch.received = 0;
+    prefetch.cached = 0;
+    prefetch.running = (count > 0);
+    
+    if (prefetch.running) {
+        k_work_reschedule(&prefetch_work, K_MSEC(GOPHER_PREFETCH_DELAY_MS));
+    }
+    
+    k_mutex_unlock(&prefetch_lock);
+    
+    return count;
+}
+
+void gopher_prefetch_stop(void)
+{
+    struct k_work_sync sync;
+    
+    k_mutex_lock(&prefetch_lock, K_FOREVER);
+    prefetch.running = false;
+    k_mutex_unlock(&prefetch_lock);
+    
+    /* The handler takes prefetch_lock, so wait for it without holding it */
+    k_work_cancel_delayable_sync(&prefetch_work, &sync);
+}
+
+void gopher_prefetch_get_stats(struct gopher_prefetch_stats *stats)
+{
+    k_mutex_lock(&prefetch_lock, K_FOREVER);
+    *stats = prefetch_stats;
+    k_mutex_unlock(&prefetch_lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_PREFETCH_H_
+#define GOPHER_PREFETCH_H_
+
+#include <zephyr/kernel.h>
+#include "gopher_client.h"
+#include "gopher_cache.h"
+
+/* Number of leading directory and text items of a menu to prefetch */
+#define GOPHER_PREFETCH_MAX_ITEMS 3
+
+/* Bytes a menu's prefetches may download in total */
+#define GOPHER_PREFETCH_MAX_BYTES (64 * 1024)
+
+/* Cache bytes a menu's prefetches may fill, so that they never push more
+ * than half of the cache out */
+#define GOPHER_PREFETCH_MAX_CACHE_BYTES (GOPHER_CACHE_SIZE / 2)
+
+/* Idle time before the next prefetch starts */
+#define GOPHER_PREFETCH_DELAY_MS 250
+
+/* Prefetch counters, as reported by 'gopher prefetch' */
+struct gopher_prefetch_stats {
+    uint32_t fetched;           /* Responses added to the cache */
+    uint32_t cancelled;         /* Stopped by a user request */
+    uint32_t dropped;           /* Over budget or failed */
+    size_t bytes;               /* Bytes downloaded */
+};
+
+/**
+ * @brief Turn prefetching on or off
+ *
+ * @param enable true to prefetch after each displayed menu
+ */
+void gopher_prefetch_enable(bool enable);
+
+/**
+ * @brief Check whether prefetching is on
+ *
+ * @return true if prefetching is on
+ */
+bool gopher_prefetch_enabled(void);
+
+/**
+ * @brief Start prefetching the leading items of the client's listing
+ *
+ * Up to GOPHER_PREFETCH_MAX_ITEMS directory and text items on the current
+ * server that are not cached yet are fetched into the response cache, one
+ * at a time, whenever the fetch engine is idle. Replaces any earlier round.
+ *
+ * @param client Pointer to the client structure
+ * @return Number of items queued, 0 if prefetching is off
+ */
+int gopher_prefetch_start(struct gopher_client *client);
+
+/**
+ * @brief Stop prefetching
+ *
+ * A prefetch already running on the fetch engine is cancelled along with
+ * the engine's active request by gopher_request_cancel().
+ */
+void gopher_prefetch_stop(void);
+
+/**
+ * @brief Read the prefetch counters
+ *
+ * @param stats Filled with the current counters
+ */
+void gopher_prefetch_get_stats(struct gopher_prefetch_stats *stats);
+
+#endif /* GOPHER_PREFETCH_H_ */
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+#include <limits.h>
+#include "gopher_request.h"
+
+LOG_MODULE_REGISTER(gopher_request, LOG_LEVEL_ERR);
+
+/* Requests run one at a time on a work queue of their own, so neither the
+ * shell thread nor the system work queue ever waits for a server */
+static K_THREAD_STACK_DEFINE(request_stack, GOPHER_STACK_SIZE);
+static struct k_work_q request_work_q;
+static struct k_work request_work;
+static bool request_work_q_started;
+
+/* Taken while a request is queued or running */
+static K_SEM_DEFINE(request_idle, 1, 1);
+static K_MUTEX_DEFINE(request_lock);
+
+static struct gopher_request *active_request;
+static atomic_t request_cancelled;
+static int next_handle;
+
+/* Sink wrapper counting received bytes for progress reports */
+static int request_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    struct gopher_request *req = user_data;
+    
+    req->received += len;
+    if (req->progress != NULL) {
+        req->progress(req->received, req->user_data);
+    }
+    
+    return req->sink(data, len, req->user_data);
+}
+
+static void request_handler(struct k_work *work)
+{
+    struct gopher_request *req = active_request;
+    int ret = 0;
+    
+    ARG_UNUSED(work);
+    
+    /* A cancel issued before the request started must not be lost when the
+       flag left over from the previous request is cleared */
+    gopher_cancel_clear(req->client);
+    if (atomic_get(&request_cancelled)) {
+        gopher_cancel(req->client);
+        ret = -ECANCELED;
+    }
+    
+    if (ret == 0 && req->prepare != NULL) {
+        ret = req->prepare(req->client, req->user_data);
+    }
+    
+    if (ret == 0) {
+        ret = req->background ?
+              gopher_fetch_background(req->client, req->selector, request_sink, req) :
+              gopher_fetch(req->client, req->selector, request_sink, req);
+    } else if (ret > 0) {
+        /* Served by the prepare callback */
+        ret = 0;
+    }
+    
+    if (ret < 0 && ret != -ECANCELED) {
+        LOG_DBG("Request %d failed: %d", req->handle, ret);
+    }
+    
+    if (req->done != NULL) {
+        req->done(ret, req->user_data);
+    }
+    
+    k_mutex_lock(&request_lock, K_FOREVER);
+    active_request = NULL;
+    k_mutex_unlock(&request_lock);
+    
+    k_sem_give(&request_idle);
+}
+
+int gopher_request_submit(struct gopher_request *req)
+{
+    if (req == NULL || req->client == NULL || req->sink == NULL) {
+        return -EINVAL;
+    }
+    
+    if (k_sem_take(&request_idle, K_NO_WAIT) != 0) {
+        return -EBUSY;
+    }
+    
+    if (!request_work_q_started) {
+        k_work_queue_init(&request_work_q);
+        k_work_queue_start(&request_work_q, request_stack,
+                           K_THREAD_STACK_SIZEOF(request_stack),
+                           GOPHER_PRIORITY, NULL);
+        k_work_init(&request_work, request_handler);
+        request_work_q_started = true;
+    }
+    
+    k_mutex_lock(&request_lock, K_FOREVER);
+    next_handle = (next_handle < INT_MAX) ? next_handle + 1 : 1;
+    req->handle = next_handle;
+    req->received = 0;
+    atomic_clear(&request_cancelled);
+    active_request = req;
+    k_mutex_unlock(&request_lock);
+    
+    k_work_submit_to_queue(&request_work_q, &request_work);
+    
+    return req->handle;
+}
+
+int gopher_request_cancel(int handle, k_timeout_t timeout)
+{
+    k_mutex_lock(&request_lock, K_FOREVER);
+    
+    if (active_request == NULL) {
+        k_mutex_unlock(&request_lock);
+        return (handle == 0) ? 0 : -ENOENT;
+    }
+    
+    if (handle != 0 && active_request->handle != handle) {
+        k_mutex_unlock(&request_lock);
+        return -ENOENT;
+    }
+    
+    atomic_set(&request_cancelled, 1);
+    gopher_cancel(active_request->client);
+    
+    k_mutex_unlock(&request_lock);
+    
+    /* Socket waits notice the flag within GOPHER_POLL_INTERVAL_MS */
+    if (k_sem_take(&request_idle, timeout) != 0) {
+        return -EAGAIN;
+    }
+    k_sem_give(&request_idle);
+    
+    return 0;
+}
+
+int gopher_request_active(size_t *received)
+{
+    int handle = 0;
+    
+    k_mutex_lock(&request_lock, K_FOREVER);
+    if (active_request != NULL) {
+        handle = active_request->handle;
+        if (received != NULL) {
+            *received = active_request->received;
+        }
+    }
+    k_mutex_unlock(&request_lock);
+    
+    return handle;
+}
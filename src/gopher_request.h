@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_REQUEST_H_
+#define GOPHER_REQUEST_H_
+
+#include <zephyr/kernel.h>
+#include "gopher_client.h"
+
+/* Fetch engine thread */
+#define GOPHER_STACK_SIZE 8192  /* Increased stack size for ESP32-S3 */
+#define GOPHER_PRIORITY 7
+
+/**
+ * @brief Callback run on the engine thread before the selector is fetched
+ *
+ * @param client Client the request runs on
+ * @param user_data Opaque pointer from the request
+ * @return 0 to go ahead with the fetch, positive if the request was served
+ *         without the network (e.g. from the response cache), negative errno
+ *         to fail the request
+ */
+typedef int (*gopher_prepare_cb_t)(struct gopher_client *client, void *user_data);
+
+/**
+ * @brief Callback reporting the number of bytes received so far
+ *
+ * @param received Total bytes received by the request
+ * @param user_data Opaque pointer from the request
+ */
+typedef void (*gopher_progress_cb_t)(size_t received, void *user_data);
+
+/**
+ * @brief Callback run on the engine thread when a request has finished
+ *
+ * @param result Result of gopher_fetch(), 0 if the prepare callback served
+ *               the request, or the error returned by the prepare callback
+ * @param user_data Opaque pointer from the request
+ */
+typedef void (*gopher_done_cb_t)(int result, void *user_data);
+
+/* A fetch to be run by the engine; must stay valid until done() is called */
+struct gopher_request {
+    struct gopher_client *client;
+    const char *selector;           /* NULL for the root */
+    gopher_prepare_cb_t prepare;    /* Optional */
+    gopher_sink_t sink;
+    gopher_progress_cb_t progress;  /* Optional */
+    gopher_done_cb_t done;          /* Optional */
+    void *user_data;
+    bool background;                /* Not recorded in the navigation history */
+    
+    /* Set by the engine */
+    int handle;
+    size_t received;
+};
+
+/**
+ * @brief Queue a request on the fetch engine
+ *
+ * Only one request runs at a time; cancel the active one first to replace it.
+ *
+ * @param req Request to run
+ * @return Positive request handle on success, -EBUSY if a request is
+ *         active, negative errno otherwise
+ */
+int gopher_request_submit(struct gopher_request *req);
+
+/**
+ * @brief Cancel a request and wait for it to finish
+ *
+ * The done callback of the request still runs, with -ECANCELED unless the
+ * request had already completed.
+ *
+ * @param handle Handle returned by gopher_request_submit(), 0 for any
+ * @param timeout How long to wait for the engine to become idle
+ * @return 0 when no request is active anymore, -ENOENT if the handle is
+ *         not active, -EAGAIN if the request did not finish in time
+ */
+int gopher_request_cancel(int handle, k_timeout_t timeout);
+
+/**
+ * @brief Check whether a request is running
+ *
+ * @param received If not NULL, set to the bytes received by the request
+ * @return Handle of the active request, 0 if the engine is idle
+ */
+int gopher_request_active(size_t *received);
+
+#endif /* GOPHER_REQUEST_H_ */
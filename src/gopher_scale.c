@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include <errno.h>
+#include "gopher_scale.h"
+
+LOG_MODULE_REGISTER(gopher_scale, LOG_LEVEL_ERR);
+
+/* Weights are Q15 fractions of an output pixel; positions are kept in
+ * 1/256 source pixels */
+#define SCALE_ONE 32768
+#define SCALE_POS(i, src, dst) ((uint32_t)((uint64_t)(i) * (src) * 256 / (dst)))
+
+/* Start the output row that the scaler's dst_y points at */
+static void scaler_next_row(struct gopher_scaler *scaler) {
+    uint32_t start = scaler->row_end;
+    
+    scaler->row_end = SCALE_POS(scaler->dst_y + 1, scaler->src_h, scaler->dst_h);
+    scaler->row_span = scaler->row_end - start;
+    scaler->row_left = SCALE_ONE;
+}
+
+int gopher_scaler_init(struct gopher_scaler *scaler, int src_w, int src_h, int dst_w, int dst_h,
+                       gopher_scale_sink_t sink, void *user) {
+    size_t spans_size = dst_w * sizeof(struct gopher_scale_span);
+    size_t acc_size = dst_w * 3 * sizeof(uint32_t);
+    size_t hrow_size = dst_w * 3 * sizeof(uint16_t);
+    size_t out_rows = sink ? 1 : dst_h;
+    uint8_t *block;
+    
+    memset(scaler, 0, sizeof(*scaler));
+    /* Positions must fit 32 bits in 1/256 pixels */
+    if (dst_w < 1 || dst_h < 1 || dst_w > src_w || dst_h > src_h ||
+        src_w >= (1 << 23) || src_h >= (1 << 23)) {
+        return -EINVAL;
+    }
+    
+    /* One block for the tables, the sums and the result */
+    block = gopher_image_alloc(spans_size + acc_size + hrow_size +
+                               dst_w * out_rows * sizeof(rgb_pixel_t));
+    if (!block) {
+        return -ENOMEM;
+    }
+    scaler->spans = (struct gopher_scale_span *)block;
+    scaler->acc = (uint32_t *)(block + spans_size);
+    scaler->hrow = (uint16_t *)(block + spans_size + acc_size);
+    scaler->out = (rgb_pixel_t *)(block + spans_size + acc_size + hrow_size);
+    memset(scaler->acc, 0, acc_size);
+    
+    scaler->src_w = src_w;
+    scaler->src_h = src_h;
+    scaler->dst_w = dst_w;
+    scaler->dst_h = dst_h;
+    scaler->sink = sink;
+    scaler->sink_user = user;
+    
+    /* Column weights are the same for every row, work them out once. Every
+       output column is at least one source column wide, so the first and
+       last source columns are the only partial ones */
+    for (int x = 0; x < dst_w; x++) {
+        struct gopher_scale_span *span = &scaler->spans[x];
+        uint32_t start = SCALE_POS(x, src_w, dst_w);
+        uint32_t end = SCALE_POS(x + 1, src_w, dst_w);
+        uint32_t width = end - start;
+        
+        span->first = start >> 8;
+        span->count = ((end - 1) >> 8) - span->first + 1;
+        if (span->count == 1) {
+            span->w_first = SCALE_ONE;
+            continue;
+        }
+        span->w_first = ((span->first + 1) * 256 - start) * SCALE_ONE / width;
+        span->w_mid = 256 * SCALE_ONE / width;
+        /* The last column takes what the rounding left over, so the weights
+           add up to exactly 1.0 */
+        span->w_last = SCALE_ONE - span->w_first - span->w_mid * (span->count - 2);
+    }
+    
+    scaler_next_row(scaler);
+    
+    return 0;
+}
+
+/* Filter a source row horizontally into Q4 values at output width */
+static void scaler_filter_row(struct gopher_scaler *scaler, const uint8_t *row) {
+    uint16_t *hrow = scaler->hrow;
+    
+    for (int x = 0; x < scaler->dst_w; x++) {
+        const struct gopher_scale_span *span = &scaler->spans[x];
+        const uint8_t *p = row + span->first * 3;
+        uint32_t r = p[0] * span->w_first;
+        uint32_t g = p[1] * span->w_first;
+        uint32_t b = p[2] * span->w_first;
+        
+        if (span->count > 1) {
+            uint32_t mr = 0, mg = 0, mb = 0;
+            const uint8_t *last = p + (span->count - 1) * 3;
+            
+            /* Plain sums over the fully covered columns, one multiply each */
+            for (p += 3; p < last; p += 3) {
+                mr += p[0];
+                mg += p[1];
+                mb += p[2];
+            }
+            r += mr * span->w_mid + last[0] * span->w_last;
+            g += mg * span->w_mid + last[1] * span->w_last;
+            b += mb * span->w_mid + last[2] * span->w_last;
+        }
+        
+        hrow[x * 3] = (r + (1 << 10)) >> 11;
+        hrow[x * 3 + 1] = (g + (1 << 10)) >> 11;
+        hrow[x * 3 + 2] = (b + (1 << 10)) >> 11;
+    }
+}
+
+int gopher_scaler_row(void *user, int y, const uint8_t *row, int width) {
+    struct gopher_scaler *scaler = user;
+    const uint16_t *hrow = scaler->hrow;
+    uint32_t *acc = scaler->acc;
+    int n = scaler->dst_w * 3;
+    rgb_pixel_t *out;
+    uint32_t bottom;
+    uint32_t weight;
+    int ret = 0;
+    
+    ARG_UNUSED(y);
+    
+    if (scaler->dst_y >= scaler->dst_h || width != scaler->src_w) {
+        return 0;
+    }
+    
+    scaler_filter_row(scaler, row);
+    bottom = ++scaler->src_y * 256;
+    
+    if (bottom < scaler->row_end) {
+        /* Entirely inside the output row */
+        weight = 256 * SCALE_ONE / scaler->row_span;
+        weight = MIN(weight, scaler->row_left);
+        scaler->row_left -= weight;
+        for (int i = 0; i < n; i++) {
+            acc[i] += hrow[i] * weight;
+        }
+        return 0;
+    }
+    
+    /* The row completes the output row; it gets the weight left over by
+       rounding, and whatever lies below the boundary starts the next row */
+    out = scaler->sink ? scaler->out : &scaler->out[scaler->dst_y * scaler->dst_w];
+    weight = scaler->row_left;
+    for (int x = 0; x < scaler->dst_w; x++) {
+        out[x].r = MIN((acc[x * 3] + hrow[x * 3] * weight + (1 << 18)) >> 19, 255);
+        out[x].g = MIN((acc[x * 3 + 1] + hrow[x * 3 + 1] * weight + (1 << 18)) >> 19, 255);
+        out[x].b = MIN((acc[x * 3 + 2] + hrow[x * 3 + 2] * weight + (1 << 18)) >> 19, 255);
+    }
+    if (scaler->sink) {
+        ret = scaler->sink(scaler->sink_user, scaler->dst_y, out);
+    }
+    
+    if (++scaler->dst_y >= scaler->dst_h) {
+        return ret;
+    }
+    
+    bottom -= scaler->row_end;
+    scaler_next_row(scaler);
+    weight = bottom * SCALE_ONE / scaler->row_span;
+    scaler->row_left -= weight;
+    for (int i = 0; i < n; i++) {
+        acc[i] = hrow[i] * weight;
+    }
+    
+    return ret;
+}
+
+void gopher_scaler_reset(struct gopher_scaler *scaler) {
+    scaler->src_y = 0;
+    scaler->dst_y = 0;
+    scaler->row_end = 0;
+    memset(scaler->acc, 0, scaler->dst_w * 3 * sizeof(uint32_t));
+    scaler_next_row(scaler);
+}
+
+void gopher_scaler_free(struct gopher_scaler *scaler) {
+    gopher_image_free(scaler->spans);
+    scaler->spans = NULL;
+    scaler->acc = NULL;
+    scaler->hrow = NULL;
+    scaler->out = NULL;
+}
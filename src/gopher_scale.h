@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_SCALE_H_
+#define GOPHER_SCALE_H_
+
+#include <zephyr/kernel.h>
+#include "gopher_image.h"
+
+/* Source columns feeding one output column, with Q15 weights that add up
+ * to 1.0. Columns between the first and the last are covered entirely and
+ * share one weight. */
+struct gopher_scale_span {
+    uint32_t first;             /* First source column */
+    uint32_t count;             /* Number of source columns */
+    uint16_t w_first;
+    uint16_t w_mid;
+    uint16_t w_last;
+};
+
+/* Receives each finished output row of a scaler. The row holds dst_w
+ * pixels, may be modified and is only valid during the call. A nonzero
+ * return is passed back from gopher_scaler_row(), stopping the decoder. */
+typedef int (*gopher_scale_sink_t)(void *user, int y, rgb_pixel_t *row);
+
+/* Separable fixed-point area filter, fed one source row at a time */
+struct gopher_scaler {
+    int src_w, src_h;
+    int dst_w, dst_h;
+    int src_y;                  /* Next source row */
+    int dst_y;                  /* Output row being accumulated */
+    uint32_t row_end;           /* End of that row, in 1/256 source rows */
+    uint32_t row_span;          /* Its height, in 1/256 source rows */
+    uint32_t row_left;          /* Q15 weight still to be added to it */
+    struct gopher_scale_span *spans;  /* Per output column */
+    uint32_t *acc;              /* Q19 sums of the output row, RGB packed */
+    uint16_t *hrow;             /* Q4 horizontally filtered source row */
+    rgb_pixel_t *out;           /* Result, dst_w x dst_h pixels, or one row with a sink */
+    gopher_scale_sink_t sink;
+    void *sink_user;
+};
+
+/**
+ * @brief Set up a downscaler
+ *
+ * Each output pixel becomes the average of the source area it covers,
+ * partially covered source pixels counting by their coverage. Only one
+ * row of sums at output resolution is kept besides the result. With a
+ * sink, each output row goes to it as soon as it is complete and the
+ * result is never held whole.
+ *
+ * @param scaler Scaler state
+ * @param src_w Source width
+ * @param src_h Source height
+ * @param dst_w Output width, at most src_w
+ * @param dst_h Output height, at most src_h
+ * @param sink Receiver of the output rows, or NULL to keep them all in out
+ * @param user Passed to the sink
+ * @return 0 on success, -EINVAL for bad sizes, -ENOMEM if out of memory
+ */
+int gopher_scaler_init(struct gopher_scaler *scaler, int src_w, int src_h, int dst_w, int dst_h,
+                       gopher_scale_sink_t sink, void *user);
+
+/**
+ * @brief Add the next source row
+ *
+ * Matches stbi_row_callback, so it can be passed to
+ * stbi_load_rows_from_memory() directly. Rows must arrive in order.
+ *
+ * @param user Scaler state
+ * @param y Source row index
+ * @param row src_w RGB pixels
+ * @param width Number of pixels in the row, rows of another width are ignored
+ * @return 0, or the sink's nonzero return to stop the decoder
+ */
+int gopher_scaler_row(void *user, int y, const uint8_t *row, int width);
+
+/**
+ * @brief Start over with the first source row, for another picture of the
+ *        same size
+ *
+ * @param scaler Scaler state
+ */
+void gopher_scaler_reset(struct gopher_scaler *scaler);
+
+/**
+ * @brief Release the buffers of a downscaler, the result included
+ *
+ * @param scaler Scaler state
+ */
+void gopher_scaler_free(struct gopher_scaler *scaler);
+
+#endif /* GOPHER_SCALE_H_ */
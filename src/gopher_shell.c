@@ -14,10 +14,21 @@
 #include <ctype.h>
 #include "gopher_client.h"
 #include "gopher_image.h"
+#include "gopher_request.h"
+#include "gopher_cache.h"
+#include "gopher_cache_fs.h"
+#include "gopher_prefetch.h"
+#include "gopher_bench.h"
+#include "gopher_mem.h"
+#include "gopher_text.h"
+#include "gopher_term.h"
+#include "gopher_out.h"
 
 /* Forward declarations of helper functions */
 static int ensure_client_initialized(const struct shell *shell);
 static int gopher_count_info_items(struct gopher_client *client);
+static void print_fetch_error(const struct shell *shell, int ret);
+static int switch_server(const struct shell *shell, const char *hostname, uint16_t port);
 
 /* ANSI color codes */
 #define COLOR_RESET   "\033[0m"
@@ -29,36 +40,748 @@ static int gopher_count_info_items(struct gopher_client *client);
 #define COLOR_CYAN    "\033[36m"
 #define COLOR_WHITE   "\033[37m"
 
-#define GOPHER_STACK_SIZE 8192  /* Increased stack size for ESP32-S3 */
-#define GOPHER_PRIORITY 7
+/* Received bytes between progress reports for documents */
+#define GOPHER_PROGRESS_STEP 16384
 
 static struct gopher_client client;
 static char gopher_buffer[GOPHER_BUFFER_SIZE];
 static bool net_initialized = false;
 static bool client_initialized = false;
 
+/* Colour mode for images, set with 'gopher color' */
+static int image_color_mode = GOPHER_COLOR_MODE_8;
+
+/* Dithering of 8-colour images, set with 'gopher dither' */
+static bool image_dithering = true;
+static int image_dither = GOPHER_DITHER_FLOYD_STEINBERG;
+
+/* Draw images with half blocks, set with 'gopher blocks' */
+static bool image_half_blocks = false;
+
+/* Play animated GIFs, set with 'gopher animate' */
+static bool image_animate = false;
+
+/* Image being drawn while it arrives */
+static struct gopher_image_stream image_stream;
+
+/* Page of a text document being printed */
+static struct gopher_pager text_pager;
+
+/* Menu rows and text pages, written to the shell once per received chunk
+ * rather than once per line */
+static struct gopher_out browse_out;
+
+/* Text document last shown, paged through with 'gopher more' */
+static struct {
+    char selector[GOPHER_MAX_SELECTOR_LEN];
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];
+    uint16_t port;
+    int first;                  /* First line of the page shown */
+    int next;                   /* First line of the next page */
+    int total;                  /* Lines in the document, -1 until known */
+    bool valid;
+} text_doc;
+
+/* Terminal size asked for once, by the first command that displays anything */
+static bool term_queried = false;
+
+static void term_measure_once(const struct shell *shell)
+{
+    if (!term_queried) {
+        term_queried = gopher_term_query(shell) == 0;
+    }
+}
+
+/* Lines of a text page that fit the terminal */
+static int text_page_lines(void)
+{
+    struct gopher_term_size term;
+    
+    gopher_term_get(&term);
+    
+    return term.lines - GOPHER_PAGER_RESERVED_LINES;
+}
+
 /* Helper function to count info items in directory listing */
 static int gopher_count_info_items(struct gopher_client *client)
 {
     int info_count = 0;
     for (int i = 0; i < client->item_count; i++) {
-        if (client->items[i].type == 'i') {
+        if (gopher_item_type(client, i) == 'i') {
             info_count++;
         }
     }
     return info_count;
 }
 
+/* State for displaying a menu while it is being received */
+struct menu_stream {
+    struct gopher_out *out;
+    struct gopher_dir_parser parser;
+    const char *title;        /* Header shown above the listing */
+    const char *query;        /* Search query shown under the header, or NULL */
+    int item_index;           /* Display index of the last selectable item */
+    size_t buffered;          /* Bytes kept in gopher_buffer for non-menu responses */
+};
+
+static struct menu_stream menu_stream;
+
+/* Map a 1-based display index (info lines excluded) to an item list index.
+ * Returns -1 if there is no such item. */
+static int find_item_index(int display_index)
+{
+    int real_index = 0;
+    
+    for (int i = 0; i < client.item_count; i++) {
+        if (gopher_item_type(&client, i) == 'i') {
+            continue;
+        }
+        if (++real_index == display_index) {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+/* Print a single directory item, with color and a type tag for selectable items */
+static void print_menu_item(struct gopher_out *out, const struct gopher_item *item,
+                            int item_index)
+{
+    struct gopher_term_size term;
+    const char *color;
+    const char *type_str;
+    int prefix;
+    
+    /* Rows are cut to the terminal width rather than left to wrap */
+    gopher_term_get(&term);
+    
+    /* Special handling for info items */
+    if (item->type == 'i') {
+        /* Align with text after the type indicator with 10-char offset */
+        gopher_out_printf(out, "          %s%.*s%s\n", COLOR_GREEN,
+                          (int)gopher_text_fit(item->display_string, term.columns - 10),
+                          item->display_string, COLOR_RESET);
+        return;
+    }
+    
+    switch (item->type) {
+        case GOPHER_TYPE_DIRECTORY:
+            color = COLOR_BLUE;
+            type_str = "DIR";
+            break;
+        case GOPHER_TYPE_TEXT:
+            color = COLOR_WHITE;
+            type_str = "TXT";
+            break;
+        case GOPHER_TYPE_SEARCH:
+            color = COLOR_GREEN;
+            type_str = "SRC";
+            break;
+        case GOPHER_TYPE_IMAGE:
+        case GOPHER_TYPE_GIF:
+            color = COLOR_MAGENTA;
+            type_str = "IMG";
+            break;
+        case GOPHER_TYPE_BINARY:
+            color = COLOR_YELLOW;
+            type_str = "BIN";
+            break;
+        case GOPHER_TYPE_ERROR:
+            color = COLOR_RED;
+            type_str = "ERR";
+            break;
+        default:
+            color = COLOR_CYAN;
+            type_str = "UNK";
+            break;
+    }
+    
+    /* Display item with line number and type, "nn: [TYP] " */
+    prefix = MAX(snprintf(NULL, 0, "%d", item_index), 2) + 8;
+    gopher_out_printf(out, "%2d: %s[%s]%s %.*s\n", 
+                      item_index, /* Starting from 1 for more intuitive numbering */
+                      color, type_str, COLOR_RESET,
+                      (int)gopher_text_fit(item->display_string, term.columns - prefix),
+                      item->display_string);
+}
+
+/* Parser callback printing each menu row as soon as it has been received */
+static void menu_stream_item(const struct gopher_item *item, int index, void *user_data)
+{
+    struct menu_stream *ms = user_data;
+    
+    /* Display header before the first item */
+    if (index == 0) {
+        gopher_out_printf(ms->out, "%s: %s%s%s\n", 
+                          ms->title, COLOR_BLUE, client.hostname, COLOR_RESET);
+        gopher_out_printf(ms->out, "---------------------------------------------\n");
+        if (ms->query != NULL) {
+            gopher_out_printf(ms->out, "%sSearch query: %s%s\n\n", 
+                              COLOR_GREEN, ms->query, COLOR_RESET);
+        }
+    }
+    
+    /* For selectable items, increment the item index */
+    if (item->type != 'i') {
+        ms->item_index++;
+    }
+    
+    print_menu_item(ms->out, item, ms->item_index);
+}
+
+/* Fetch sink feeding the menu parser, keeping a copy of non-menu responses */
+static int menu_stream_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    struct menu_stream *ms = user_data;
+    
+    gopher_dir_parser_feed(&ms->parser, data, len);
+    
+    /* Until the response is known to be a menu, keep it for the document viewer */
+    if (client.item_count == 0 && ms->buffered < sizeof(gopher_buffer) - 1) {
+        size_t n = MIN(len, sizeof(gopher_buffer) - 1 - ms->buffered);
+        
+        memcpy(gopher_buffer + ms->buffered, data, n);
+        ms->buffered += n;
+    }
+    
+    return 0;
+}
+
+/* ASCII art configuration from the image settings */
+static ascii_art_config_t image_config(void)
+{
+    struct gopher_term_size term;
+    ascii_art_config_t config = {
+        .use_color = true,
+        .use_dithering = image_dithering,
+        .use_extended_chars = image_half_blocks,
+        .color_mode = image_color_mode,
+        .dither = image_dither,
+        .brightness = 1.0f,
+        .contrast = 1.0f
+    };
+    
+    /* Pictures are scaled to the cells there are, not decoded bigger only
+       to be cropped or wrapped by the terminal */
+    gopher_term_get(&term);
+    config.columns = term.columns;
+    config.lines = term.lines - GOPHER_IMAGE_RESERVED_LINES;
+    
+    return config;
+}
+
+/* A navigation request handed to the fetch engine. Everything it needs is
+ * copied in, the command that submitted it returns straight away. */
+struct browse_job {
+    const struct shell *shell;
+    struct gopher_request req;
+    char selector[GOPHER_MAX_SELECTOR_LEN];
+    char hostname[GOPHER_MAX_HOSTNAME_LEN];  /* Server to switch to first, or empty */
+    uint16_t port;
+    char type;                  /* Expected item type, 0 if not known */
+    bool connect;               /* Fresh connection for 'gopher connect' */
+    bool allow_document;        /* Display responses that are not menus */
+    bool fetching;              /* Preparation succeeded, data may be displayed */
+    bool text_started;          /* Header of a text document printed */
+    bool text_stopped;          /* Text page shown, the rest was not received */
+    bool more;                  /* Another page of text_doc */
+    int first_line;             /* First line of the text page to show */
+    int page_lines;             /* Lines per text page, 0 for the whole document */
+    bool replaying;             /* Response coming from the cache */
+    bool image;                 /* Response goes to image_stream */
+    bool use_cache;             /* Serve the response from the cache if possible */
+    bool store;                 /* Keep the response in the cache */
+    int cached;                 /* Kind of cache hit, 0 if fetched */
+    struct gopher_cache_writer writer;  /* Document being collected for the cache */
+    const char *title;          /* Header shown above a listing */
+    const char *error_msg;      /* Error prefix, NULL for print_fetch_error() */
+    const char *empty_msg;      /* Shown when no listing was received, or NULL */
+    char query[GOPHER_MAX_SELECTOR_LEN];  /* Search query shown with results */
+    size_t next_progress;       /* Byte count of the next progress report */
+};
+
+static struct browse_job browse_job;
+
+static int browse_sink(const uint8_t *data, size_t len, void *user_data);
+
+/* Get onto the right server */
+static int browse_connect(struct gopher_client *c, struct browse_job *job)
+{
+    int ret;
+    
+    if (job->connect) {
+        ret = gopher_connect(c, job->hostname, job->port);
+        if (ret < 0) {
+            shell_error(job->shell, "Failed to connect to server: %d", ret);
+            return ret;
+        }
+        
+        shell_print(job->shell, "Connected to server successfully");
+        shell_print(job->shell, "Fetching root directory...");
+    } else if (job->hostname[0] != '\0') {
+        ret = switch_server(job->shell, job->hostname, job->port);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    
+    return 0;
+}
+
+/* Start a text page, wrapped to the terminal */
+static void text_pager_init(struct browse_job *job)
+{
+    struct gopher_term_size term;
+    
+    gopher_term_get(&term);
+    gopher_pager_init(&text_pager, &browse_out, term.columns, job->first_line, job->page_lines);
+}
+
+/* Get ready to display the response */
+static void browse_display_init(struct gopher_client *c, struct browse_job *job)
+{
+    struct menu_stream *ms = &menu_stream;
+    
+    job->fetching = true;
+    gopher_out_begin(&browse_out, job->shell);
+    
+    /* Text documents are streamed straight to the console a page at a
+       time, so they are not limited by the size of gopher_buffer */
+    if (job->type == GOPHER_TYPE_TEXT) {
+        text_pager_init(job);
+        return;
+    }
+    
+    /* Images are collected in a buffer of their own, growing as needed,
+       and drawn as early as their format allows */
+    if ((job->type == GOPHER_TYPE_IMAGE || job->type == GOPHER_TYPE_GIF) && job->allow_document) {
+        ascii_art_config_t config = image_config();
+        
+        if (gopher_image_stream_begin(&image_stream, job->shell, &config) == 0) {
+            job->image = true;
+            return;
+        }
+    }
+    
+    /* Directories are displayed row by row while they arrive, anything
+       else is collected in gopher_buffer and displayed once complete */
+    ms->out = &browse_out;
+    ms->title = job->title;
+    ms->query = (job->query[0] != '\0') ? job->query : NULL;
+    ms->item_index = 0;
+    ms->buffered = 0;
+    gopher_dir_parser_init(&ms->parser, c, menu_stream_item, ms);
+}
+
+/* Serve the job from the cache, displaying the response as if it had just
+ * been received. Returns the kind of cache hit, negative errno on a miss. */
+static int browse_from_cache(struct gopher_client *c, struct browse_job *job, bool offline)
+{
+    struct gopher_item item;
+    int ret;
+    
+    /* Nothing of a failed fetch is kept */
+    if (job->writer.block != NULL) {
+        gopher_cache_writer_end(&job->writer, false);
+    }
+    
+    job->replaying = true;
+    ret = gopher_cache_lookup(c, job->selector, offline, browse_sink, job);
+    job->replaying = false;
+    if (ret == GOPHER_CACHE_MENU) {
+        /* Display the restored listing as if it had just been parsed */
+        for (int i = 0; i < c->item_count; i++) {
+            gopher_get_item(c, i, &item);
+            menu_stream_item(&item, i, &menu_stream);
+        }
+        gopher_out_flush(&browse_out);
+    }
+    
+    if (ret > 0) {
+        job->cached = ret;
+        if (!job->req.background) {
+            gopher_update_history(c, job->selector);
+        }
+        
+        if (offline) {
+            /* Keep browsing the cached copies of this server */
+            c->connected = true;
+            shell_warn(job->shell, "Server unreachable, showing a cached copy");
+        }
+    }
+    
+    return ret;
+}
+
+/* Runs on the engine thread: serve the request from the cache, or get ready
+ * to fetch and keep the response */
+static int browse_prepare(struct gopher_client *c, void *user_data)
+{
+    struct browse_job *job = user_data;
+    int ret;
+    
+    ret = browse_connect(c, job);
+    if (ret < 0 && !job->store) {
+        return ret;
+    }
+    
+    browse_display_init(c, job);
+    
+    if (ret < 0) {
+        /* Cacheable responses can still be shown without the server */
+        if (browse_from_cache(c, job, true) > 0) {
+            return 1;
+        }
+        
+        job->fetching = false;
+        return ret;
+    }
+    
+    if (job->use_cache && browse_from_cache(c, job, false) > 0) {
+        return 1;
+    }
+    
+    /* Listings are cached in parsed form once complete, anything else
+       is collected while it streams through */
+    if (job->store && job->type != GOPHER_TYPE_DIRECTORY) {
+        gopher_cache_writer_begin(&job->writer, c, job->selector);
+    }
+    
+    return 0;
+}
+
+/* Print the header of a text page */
+static void text_page_begin(struct browse_job *job)
+{
+    if (job->first_line == 0) {
+        gopher_out_printf(&browse_out, "Gopher Text: %s%s%s\n", 
+                          COLOR_BLUE, client.hostname, COLOR_RESET);
+        gopher_out_printf(&browse_out, "---------------------------------------------\n");
+    }
+    
+    /* Display text content in green for readability */
+    gopher_out_printf(&browse_out, "%s", COLOR_GREEN);
+    job->text_started = true;
+}
+
+/* Close a text page, remember where the next one starts and say so */
+static void text_page_finish(struct browse_job *job, int result)
+{
+    struct gopher_pager *pager = &text_pager;
+    struct gopher_out *out = &browse_out;
+    bool complete = result >= 0 && !job->text_stopped;
+    int shown;
+    int last;
+    
+    gopher_pager_end(pager, complete);
+    gopher_out_printf(out, "%s", COLOR_RESET);
+    
+    if (result < 0) {
+        gopher_out_printf(out, "---------------------------------------------\n");
+        gopher_out_flush(out);
+        return;
+    }
+    
+    if (!job->more) {
+        strncpy(text_doc.selector, job->selector, sizeof(text_doc.selector) - 1);
+        strncpy(text_doc.hostname, client.hostname, sizeof(text_doc.hostname) - 1);
+        text_doc.port = client.port;
+        text_doc.total = -1;
+        text_doc.valid = true;
+    }
+    
+    shown = gopher_pager_shown(pager);
+    last = pager->first + shown;
+    text_doc.first = pager->first;
+    text_doc.next = last;
+    if (complete) {
+        text_doc.total = pager->line;
+    }
+    
+    if (shown == 0) {
+        gopher_out_printf(out, "--- End of document (%d lines) ---\n", pager->line);
+    } else if (text_doc.total < 0) {
+        gopher_out_printf(out, "--- Lines %d-%d, 'g more' for the next page ---\n",
+                          pager->first + 1, last);
+    } else if (last < text_doc.total) {
+        gopher_out_printf(out, "--- Lines %d-%d of %d (%d%%), 'g more' for the next page ---\n",
+                          pager->first + 1, last, text_doc.total, last * 100 / text_doc.total);
+    } else {
+        gopher_out_printf(out, "--- Lines %d-%d of %d (end) ---\n", pager->first + 1, last,
+                          text_doc.total);
+    }
+    gopher_out_flush(out);
+}
+
+/* Display received data and collect it for the cache */
+static int browse_sink(const uint8_t *data, size_t len, void *user_data)
+{
+    struct browse_job *job = user_data;
+    int ret;
+    
+    if (job->type == GOPHER_TYPE_TEXT) {
+        if (!job->text_started) {
+            text_page_begin(job);
+        }
+        ret = gopher_pager_feed(&text_pager, data, len);
+    } else if (job->image) {
+        /* A picture too large for memory is only reported once complete,
+           the cache may still take it */
+        gopher_image_stream_feed(&image_stream, data, len);
+        ret = 0;
+    } else {
+        ret = menu_stream_sink(data, len, &menu_stream);
+    }
+    
+    if (job->writer.block != NULL) {
+        if (job->type != GOPHER_TYPE_TEXT && client.item_count > 0) {
+            /* A listing after all, it is cached in parsed form instead */
+            gopher_cache_writer_end(&job->writer, false);
+        } else {
+            gopher_cache_writer_append(&job->writer, data, len);
+        }
+    }
+    
+    /* What this chunk printed goes out in one piece */
+    gopher_out_flush(&browse_out);
+    
+    /* Past the page, text is only received while the cache still takes
+       it, or read from the cache to learn its length */
+    if (job->type == GOPHER_TYPE_TEXT && ret > 0) {
+        if (job->replaying || job->writer.block != NULL) {
+            ret = 0;
+        } else {
+            job->text_stopped = true;
+        }
+    }
+    
+    return ret;
+}
+
+/* Display a non-menu response held in gopher_buffer as an image or text */
+static void display_document(struct browse_job *job, size_t len)
+{
+    const struct shell *shell = job->shell;
+    
+    /* Check if this might be an image file */
+    if (gopher_is_image((uint8_t *)gopher_buffer, len)) {
+        ascii_art_config_t config = image_config();
+        
+        /* Display as image using ASCII art */
+        shell_print(shell, "Detected image file, rendering as ASCII art...");
+        
+        /* Render the image */
+        gopher_render_image(shell, (uint8_t *)gopher_buffer, len, &config);
+        return;
+    }
+    
+    /* Display as text, a page at a time */
+    text_pager_init(job);
+    text_page_begin(job);
+    gopher_pager_feed(&text_pager, (const uint8_t *)gopher_buffer, len);
+    text_page_finish(job, 0);
+}
+
+/* Report the progress of documents, which show nothing until complete */
+static void browse_progress(size_t received, void *user_data)
+{
+    struct browse_job *job = user_data;
+    
+    if (job->type == GOPHER_TYPE_TEXT || client.item_count > 0 ||
+        (job->image && image_stream.lines > 0) || received < job->next_progress) {
+        return;
+    }
+    
+    shell_print(job->shell, "Received %zu KB...", received / 1024);
+    job->next_progress = received + GOPHER_PROGRESS_STEP;
+}
+
+/* Stops an animation once another command cancels the request */
+static bool browse_stopped(void *user_data)
+{
+    ARG_UNUSED(user_data);
+    
+    return atomic_get(&client.cancel) != 0;
+}
+
+/* Runs on the engine thread once the response is complete, failed or cancelled */
+static void browse_done(int result, void *user_data)
+{
+    struct browse_job *job = user_data;
+    const struct shell *shell = job->shell;
+    struct menu_stream *ms = &menu_stream;
+    bool complete;
+    int items = 0;
+    
+    if (result < 0 && result != -ECANCELED && job->fetching && job->store &&
+        job->req.received == 0 && browse_from_cache(&client, job, true) > 0) {
+        /* The server failed before sending anything, show the cached copy */
+        result = 0;
+    }
+    
+    if (job->text_started) {
+        text_page_finish(job, result);
+    } else if (job->cached == GOPHER_CACHE_MENU) {
+        items = client.item_count;
+    } else if (job->fetching && job->type != GOPHER_TYPE_TEXT && !job->image) {
+        /* Whatever part of a listing arrived stays usable */
+        gopher_buffer[ms->buffered] = '\0';
+        items = gopher_dir_parser_finish(&ms->parser);
+    }
+    gopher_out_flush(&browse_out);
+    
+    /* Keep complete responses for the next visit: the server closed the
+       connection after all of it, and a listing ended with its period */
+    complete = result >= 0 && !job->text_stopped;
+    if (job->writer.block != NULL) {
+        gopher_cache_writer_end(&job->writer, complete && items == 0);
+    } else if (complete && items > 0 && ms->parser.state == GOPHER_DIR_DONE &&
+               !client.menu.truncated && job->store && job->cached != GOPHER_CACHE_MENU) {
+        /* Prefetched listings are cached raw, keep the parsed form instead */
+        gopher_cache_store_menu(&client, job->selector);
+    }
+    
+    if (job->image) {
+        int played = -ENOTSUP;
+        
+        if (result >= 0 && image_animate && image_stream.data != NULL) {
+            /* Played until the next command or the last loop */
+            played = gopher_play_animation(shell, image_stream.data, image_stream.len,
+                                           &image_stream.config, browse_stopped, job);
+        }
+        
+        /* Draw the complete picture unless it played, also when not even its
+           first frame could be, or drop what arrived of it */
+        gopher_image_stream_end(&image_stream, result >= 0 && played <= 0);
+    }
+    
+    if (result == -ECANCELED) {
+        shell_warn(shell, "Request cancelled after %zu bytes", job->req.received);
+        return;
+    }
+    
+    if (result < 0) {
+        /* Preparation failures have already been reported */
+        if (job->fetching && job->error_msg != NULL) {
+            shell_error(shell, "%s: %d", job->error_msg, result);
+        } else if (job->fetching) {
+            print_fetch_error(shell, result);
+        }
+        
+        if (job->connect) {
+            /* Disconnect to clean up */
+            gopher_disconnect(&client);
+        }
+        return;
+    }
+    
+    if (job->type == GOPHER_TYPE_TEXT || job->image) {
+        return;
+    }
+    
+    if (items > 0) {
+        /* Links to other servers open without a resolver stall */
+        gopher_dns_prefetch(&client);
+        
+        /* Use the idle time until the next command to fetch likely picks */
+        gopher_prefetch_start(&client);
+        
+        gopher_out_printf(&browse_out, "---------------------------------------------\n");
+        gopher_out_printf(&browse_out, "Use 'gopher view <index>' to view an item\n");
+        gopher_out_flush(&browse_out);
+        
+        if (client.menu.truncated) {
+            shell_warn(shell, "Listing cut short after %d items, the rest did not fit",
+                       client.item_count);
+        }
+        return;
+    }
+    
+    if (job->allow_document) {
+        display_document(job, ms->buffered);
+    }
+    
+    if (job->empty_msg != NULL) {
+        shell_error(shell, "%s", job->empty_msg);
+    }
+}
+
+/* Stop the request in progress; a new command replaces it rather than
+ * queueing behind it. Must be called before touching the client. */
+static int cancel_active_request(const struct shell *shell)
+{
+    int ret;
+    
+    /* Prefetching gives way to the user at once */
+    gopher_prefetch_stop();
+    
+    ret = gopher_request_cancel(0, K_MSEC(GOPHER_IO_TIMEOUT_MS));
+    
+    if (ret == -EAGAIN) {
+        shell_error(shell, "The previous request is still finishing, please try again");
+        return -EBUSY;
+    }
+    
+    return 0;
+}
+
+/* Reset the browse job for a new request. Only valid while idle. */
+static struct browse_job *browse_job_new(const struct shell *shell, const char *selector)
+{
+    struct browse_job *job = &browse_job;
+    
+    memset(job, 0, sizeof(*job));
+    job->shell = shell;
+    job->title = "Gopher Directory";
+    job->error_msg = "Failed to get response from server";
+    job->allow_document = true;
+    job->store = true;
+    job->next_progress = GOPHER_PROGRESS_STEP;
+    job->page_lines = text_page_lines();
+    
+    if (selector != NULL) {
+        strncpy(job->selector, selector, sizeof(job->selector) - 1);
+    }
+    
+    return job;
+}
+
+/* Hand the browse job to the fetch engine */
+static int browse_submit(const struct shell *shell, struct browse_job *job)
+{
+    int ret;
+    
+    job->req.client = &client;
+    job->req.selector = job->selector;
+    job->req.prepare = browse_prepare;
+    job->req.sink = browse_sink;
+    job->req.progress = browse_progress;
+    job->req.done = browse_done;
+    job->req.user_data = job;
+    
+    ret = gopher_request_submit(&job->req);
+    if (ret < 0) {
+        shell_error(shell, "Failed to start request: %d", ret);
+        return ret;
+    }
+    
+    return 0;
+}
+
 /* Helper function to ensure client is initialized */
 static int ensure_client_initialized(const struct shell *shell)
 {
     int ret;
     
+    term_measure_once(shell);
+    
     if (client_initialized) {
         /* Even if already initialized, check if client is in a valid state */
         if (client.connected && client.hostname[0] == '\0') {
             /* Inconsistent state detected - reinitialize */
             shell_print(shell, "Reinitializing client due to inconsistent state");
+            gopher_disconnect(&client);
             memset(&client, 0, sizeof(struct gopher_client));
             client_initialized = false;
         } else {
@@ -159,12 +882,56 @@ static int cmd_gopher_ip(const struct shell *shell, size_t argc, char **argv)
     return 0;
 }
 
-/* Connect to a Gopher server and automatically get root directory */
-static int cmd_gopher_connect(const struct shell *shell, size_t argc, char **argv)
+/* Report a failed fetch with a hint for the common network errors */
+static void print_fetch_error(const struct shell *shell, int ret)
 {
-    const char *hostname;
-    uint16_t port = GOPHER_DEFAULT_PORT;
-    int ret;
+    if (ret == -ETIMEDOUT) {
+        shell_error(shell, "Connection to server timed out. Please check network connectivity.");
+    } else if (ret == -ECONNREFUSED) {
+        shell_error(shell, "Connection refused by server. The server may be down or not accepting connections.");
+    } else if (ret == -EHOSTUNREACH) {
+        shell_error(shell, "Host unreachable. Please check DNS settings and network routing.");
+    } else {
+        shell_error(shell, "Failed to get response from server: %d", ret);
+    }
+}
+
+/* Switch the client to another server, keeping the navigation history */
+static int switch_server(const struct shell *shell, const char *hostname, uint16_t port)
+{
+    /* Kept off the engine thread's stack, which also decodes pictures;
+       requests run one at a time, so one copy is enough */
+    static char history_backup[10][GOPHER_MAX_SELECTOR_LEN];
+    int history_pos_backup = client.history_pos;
+    int history_count_backup = client.history_count;
+    int ret;
+    
+    /* Backup navigation history, gopher_connect() resets the whole client */
+    memcpy(history_backup, client.history, sizeof(client.history));
+    
+    /* Clear buffer */
+    memset(gopher_buffer, 0, sizeof(gopher_buffer));
+    
+    ret = gopher_connect(&client, hostname, port);
+    if (ret < 0) {
+        shell_error(shell, "Failed to connect to server %s:%d: %d", 
+                    hostname, port, ret);
+        return ret;
+    }
+    
+    /* Restore navigation history */
+    memcpy(client.history, history_backup, sizeof(client.history));
+    client.history_pos = history_pos_backup;
+    client.history_count = history_count_backup;
+    
+    return 0;
+}
+
+/* Connect to a Gopher server and automatically get root directory */
+static int cmd_gopher_connect(const struct shell *shell, size_t argc, char **argv)
+{
+    struct browse_job *job;
+    uint16_t port = GOPHER_DEFAULT_PORT;
     
     if (argc < 2) {
         shell_error(shell, "Usage: gopher connect <hostname> [port]");
@@ -175,6 +942,10 @@ static int cmd_gopher_connect(const struct shell *shell, size_t argc, char **arg
         return -ENODEV;
     }
     
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
+    
     /* We've completely rewritten gopher_connect to handle initialization safely */
     /* So we only need to make sure the client is initialized first time */
     if (!client_initialized) {
@@ -186,8 +957,6 @@ static int cmd_gopher_connect(const struct shell *shell, size_t argc, char **arg
     /* Clear buffer to avoid potential issues */
     memset(gopher_buffer, 0, sizeof(gopher_buffer));
     
-    hostname = argv[1];
-    
     if (argc >= 3) {
         port = atoi(argv[2]);
         if (port == 0) {
@@ -195,174 +964,27 @@ static int cmd_gopher_connect(const struct shell *shell, size_t argc, char **arg
         }
     }
     
-    shell_print(shell, "Connecting to Gopher server %s:%d...", hostname, port);
-    
-    ret = gopher_connect(&client, hostname, port);
-    if (ret < 0) {
-        shell_error(shell, "Failed to connect to server: %d", ret);
-        return ret;
-    }
-    
-    shell_print(shell, "Connected to server successfully");
-    
-    /* Simpler connection with built-in timeout */
-    shell_print(shell, "Fetching root directory...");
-    
-    ret = gopher_send_selector(&client, NULL, gopher_buffer, sizeof(gopher_buffer));
-    
-    if (ret < 0) {
-        if (ret == -ETIMEDOUT) {
-            shell_error(shell, "Connection to server timed out. Please check network connectivity.");
-        } else if (ret == -ECONNREFUSED) {
-            shell_error(shell, "Connection refused by server. The server may be down or not accepting connections.");
-        } else if (ret == -EHOSTUNREACH) {
-            shell_error(shell, "Host unreachable. Please check DNS settings and network routing.");
-        } else {
-            shell_error(shell, "Failed to get response from server: %d", ret);
-        }
-        
-        /* Disconnect to clean up */
-        client.connected = false;
-        return ret;
-    }
+    term_measure_once(shell);
+    shell_print(shell, "Connecting to Gopher server %s:%d...", argv[1], port);
     
-    /* Received response from server */
+    /* Resolving and fetching happen on the engine thread */
+    job = browse_job_new(shell, NULL);
+    strncpy(job->hostname, argv[1], sizeof(job->hostname) - 1);
+    job->port = port;
+    job->connect = true;
+    job->error_msg = NULL;
     
-    /* Try to parse response as a directory listing */
-    ret = gopher_parse_directory(&client, gopher_buffer);
-    if (ret > 0) {
-        /* Display directory header */
-        shell_fprintf(shell, SHELL_NORMAL, "Gopher Directory: %s%s%s\n", 
-                     COLOR_BLUE, client.hostname, COLOR_RESET);
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        
-        /* Display all items in their original order */
-        int item_index = 0;
-        for (int i = 0; i < client.item_count; i++) {
-            /* Choose color based on item type */
-            const char *color;
-            const char *type_str;
-            
-            /* Special handling for info items */
-            if (client.items[i].type == 'i') {
-                /* Align with text after the type indicator with 10-char offset */
-                shell_fprintf(shell, SHELL_NORMAL, "          %s%s%s\n", 
-                             COLOR_GREEN, client.items[i].display_string, COLOR_RESET);
-                continue;
-            }
-            
-            /* For selectable items, increment the item index */
-            item_index++;
-            
-            switch (client.items[i].type) {
-                case GOPHER_TYPE_DIRECTORY:
-                    color = COLOR_BLUE;
-                    type_str = "DIR";
-                    break;
-                case GOPHER_TYPE_TEXT:
-                    color = COLOR_WHITE;
-                    type_str = "TXT";
-                    break;
-                case GOPHER_TYPE_SEARCH:
-                    color = COLOR_GREEN;
-                    type_str = "SRC";
-                    break;
-                case GOPHER_TYPE_IMAGE:
-                case GOPHER_TYPE_GIF:
-                    color = COLOR_MAGENTA;
-                    type_str = "IMG";
-                    break;
-                case GOPHER_TYPE_BINARY:
-                    color = COLOR_YELLOW;
-                    type_str = "BIN";
-                    break;
-                case GOPHER_TYPE_ERROR:
-                    color = COLOR_RED;
-                    type_str = "ERR";
-                    break;
-                default:
-                    color = COLOR_CYAN;
-                    type_str = "UNK";
-                    break;
-            }
-            
-            /* Display item with line number and type */
-            shell_fprintf(shell, SHELL_NORMAL, "%2d: %s[%s]%s %s\n", 
-                         item_index, /* Starting from 1 for more intuitive numbering */
-                         color, type_str, COLOR_RESET,
-                         client.items[i].display_string);
-        }
-        
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        shell_print(shell, "Use 'gopher view <index>' to view an item");
-    } else {
-        /* Check if this might be an image file */
-        if (gopher_is_image((uint8_t *)gopher_buffer, ret)) {
-            /* Display as image using ASCII art */
-            shell_print(shell, "Detected image file, rendering as ASCII art...");
-            
-            /* Use default ASCII art configuration */
-            ascii_art_config_t config = {
-                .use_color = true,
-                .use_dithering = true,
-                .use_extended_chars = false,
-                .color_mode = 8,
-                .brightness = 1.0f,
-                .contrast = 1.0f
-            };
-            
-            /* Render the image */
-            gopher_render_image(shell, (uint8_t *)gopher_buffer, ret, &config);
-        } else {
-            /* Display as text with proper formatting */
-            shell_fprintf(shell, SHELL_NORMAL, "Gopher Text: %s%s%s\n", 
-                        COLOR_BLUE, client.hostname, COLOR_RESET);
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            
-            /* Display text content in green for readability */
-            char *line_start = gopher_buffer;
-            char *line_end;
-            char line_buffer[GOPHER_BUFFER_SIZE];
-            
-            /* Process each line */
-            while (*line_start) {
-                /* Find end of line */
-                line_end = strstr(line_start, "\r\n");
-                if (!line_end) {
-                    /* Last line */
-                    shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                                COLOR_GREEN, line_start, COLOR_RESET);
-                    break;
-                }
-                
-                /* Extract the line */
-                int line_len = line_end - line_start;
-                if (line_len >= sizeof(line_buffer)) {
-                    line_len = sizeof(line_buffer) - 1;
-                }
-                memcpy(line_buffer, line_start, line_len);
-                line_buffer[line_len] = '\0';
-                
-                /* Display the line */
-                shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                            COLOR_GREEN, line_buffer, COLOR_RESET);
-                
-                /* Move to next line */
-                line_start = line_end + 2;
-            }
-            
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        }
-    }
-    
-    return 0;
+    return browse_submit(shell, job);
 }
 
 /* Send a selector and display the response */
 static int cmd_gopher_get(const struct shell *shell, size_t argc, char **argv)
 {
     const char *selector = NULL;
-    int ret;
+    
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
     
     if (ensure_client_initialized(shell) != 0) {
         return -EFAULT;
@@ -380,156 +1002,26 @@ static int cmd_gopher_get(const struct shell *shell, size_t argc, char **argv)
     shell_print(shell, "Requesting '%s' from %s:%d...", 
                 selector ? selector : "(root)", client.hostname, client.port);
     
-    ret = gopher_send_selector(&client, selector, gopher_buffer, sizeof(gopher_buffer));
-    if (ret < 0) {
-        shell_error(shell, "Failed to get response from server: %d", ret);
-        return ret;
-    }
-    
-    /* Try to parse response as a directory listing */
-    ret = gopher_parse_directory(&client, gopher_buffer);
-    if (ret > 0) {
-        /* Display directory header */
-        shell_fprintf(shell, SHELL_NORMAL, "Gopher Directory: %s%s%s\n", 
-                     COLOR_BLUE, client.hostname, COLOR_RESET);
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        
-        /* Display all items in their original order */
-        int item_index = 0;
-        for (int i = 0; i < client.item_count; i++) {
-            /* Choose color based on item type */
-            const char *color;
-            const char *type_str;
-            
-            /* Special handling for info items */
-            if (client.items[i].type == 'i') {
-                /* Align with text after the type indicator with 10-char offset */
-                shell_fprintf(shell, SHELL_NORMAL, "          %s%s%s\n", 
-                             COLOR_GREEN, client.items[i].display_string, COLOR_RESET);
-                continue;
-            }
-            
-            /* For selectable items, increment the item index */
-            item_index++;
-            
-            switch (client.items[i].type) {
-                case GOPHER_TYPE_DIRECTORY:
-                    color = COLOR_BLUE;
-                    type_str = "DIR";
-                    break;
-                case GOPHER_TYPE_TEXT:
-                    color = COLOR_WHITE;
-                    type_str = "TXT";
-                    break;
-                case GOPHER_TYPE_SEARCH:
-                    color = COLOR_GREEN;
-                    type_str = "SRC";
-                    break;
-                case GOPHER_TYPE_IMAGE:
-                case GOPHER_TYPE_GIF:
-                    color = COLOR_MAGENTA;
-                    type_str = "IMG";
-                    break;
-                case GOPHER_TYPE_BINARY:
-                    color = COLOR_YELLOW;
-                    type_str = "BIN";
-                    break;
-                case GOPHER_TYPE_ERROR:
-                    color = COLOR_RED;
-                    type_str = "ERR";
-                    break;
-                default:
-                    color = COLOR_CYAN;
-                    type_str = "UNK";
-                    break;
-            }
-            
-            /* Display item with line number and type */
-            shell_fprintf(shell, SHELL_NORMAL, "%2d: %s[%s]%s %s\n", 
-                         item_index, /* Starting from 1 for more intuitive numbering */
-                         color, type_str, COLOR_RESET,
-                         client.items[i].display_string);
-        }
-        
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        shell_print(shell, "Use 'gopher view <index>' to view an item");
-    } else {
-        /* Check if this might be an image file */
-        if (gopher_is_image((uint8_t *)gopher_buffer, ret)) {
-            /* Display as image using ASCII art */
-            shell_print(shell, "Detected image file, rendering as ASCII art...");
-            
-            /* Use default ASCII art configuration */
-            ascii_art_config_t config = {
-                .use_color = true,
-                .use_dithering = true,
-                .use_extended_chars = false,
-                .color_mode = 8,
-                .brightness = 1.0f,
-                .contrast = 1.0f
-            };
-            
-            /* Render the image */
-            gopher_render_image(shell, (uint8_t *)gopher_buffer, ret, &config);
-        } else {
-            /* Display as text with proper formatting */
-            shell_fprintf(shell, SHELL_NORMAL, "Gopher Text: %s%s%s\n", 
-                        COLOR_BLUE, client.hostname, COLOR_RESET);
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            
-            /* Display text content in green for readability */
-            char *line_start = gopher_buffer;
-            char *line_end;
-            char line_buffer[GOPHER_BUFFER_SIZE];
-            
-            /* Process each line */
-            while (*line_start) {
-                /* Find end of line */
-                line_end = strstr(line_start, "\r\n");
-                if (!line_end) {
-                    /* Last line */
-                    shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                                COLOR_GREEN, line_start, COLOR_RESET);
-                    break;
-                }
-                
-                /* Extract the line */
-                int line_len = line_end - line_start;
-                if (line_len >= sizeof(line_buffer)) {
-                    line_len = sizeof(line_buffer) - 1;
-                }
-                memcpy(line_buffer, line_start, line_len);
-                line_buffer[line_len] = '\0';
-                
-                /* Display the line */
-                shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                            COLOR_GREEN, line_buffer, COLOR_RESET);
-                
-                /* Move to next line */
-                line_start = line_end + 2;
-            }
-            
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        }
-    }
-    
-    return 0;
+    /* Always fetched from the server, which refreshes the cached copy */
+    return browse_submit(shell, browse_job_new(shell, selector));
 }
 
 /* View a specific item from the directory listing */
 static int cmd_gopher_view(const struct shell *shell, size_t argc, char **argv)
 {
     int index;
-    int ret;
-    char *selector;
-    char *hostname;
-    uint16_t port;
+    struct gopher_item item;
+    struct browse_job *job;
     
     if (argc < 2) {
         shell_error(shell, "Usage: gopher view <index>");
         return -EINVAL;
     }
     
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
+    
     if (ensure_client_initialized(shell) != 0) {
         return -EFAULT;
     }
@@ -544,86 +1036,19 @@ static int cmd_gopher_view(const struct shell *shell, size_t argc, char **argv)
         return -ENODATA;
     }
     
-    /* Get the index from user input */
-    index = atoi(argv[1]);
-    if (index < 1) {
-        shell_error(shell, "Invalid item index. Must be between 1 and %d", client.item_count - gopher_count_info_items(&client));
-        return -EINVAL;
-    }
-    index--; /* Convert from 1-based display index to 0-based array index */
-    
-    /* Count the number of info items to find the real index */
-    int real_index = 0;
-    int info_count = 0;
-    for (int i = 0; i < client.item_count; i++) {
-        if (client.items[i].type == 'i') {
-            info_count++;
-            continue;
-        }
-        if (real_index == index) {
-            index = i;
-            break;
-        }
-        real_index++;
-    }
-    
-    /* Debug info about indices */
-    shell_print(shell, "DEBUG: User requested index %d, translated to index %d of %d items (after %d info items)",
-              atoi(argv[1]), index, client.item_count, info_count);
-
-    /* Check if the index is valid after adjusting for info items */
-    if (index < 0 || index >= client.item_count) {
+    /* Translate the user's index, which skips info items, to the item list index */
+    index = find_item_index(atoi(argv[1]));
+    if (index < 0) {
         shell_error(shell, "Invalid item index. Must be between 1 and %d", 
-                   client.item_count - info_count);
+                   client.item_count - gopher_count_info_items(&client));
         return -EINVAL;
     }
     
-    selector = client.items[index].selector;
-    hostname = client.items[index].hostname;
-    port = client.items[index].port;
-    
-    /* Debug item details */
-    shell_print(shell, "DEBUG: Selected item - Type: %c, Hostname: %s, Port: %d, Selector: %s",
-              client.items[index].type, hostname, port, selector);
-    
-    /* Check if this item is on a different server */
-    if (strcmp(hostname, client.hostname) != 0 || port != client.port) {
-        shell_print(shell, "Item is on a different server (%s:%d). Connecting...", 
-                    hostname, port);
-        
-        /* Reset client state before connecting to a different server */
-        /* Keep history intact but reset other state */
-        char history_backup[10][GOPHER_MAX_SELECTOR_LEN];
-        int history_pos_backup = client.history_pos;
-        int history_count_backup = client.history_count;
-        
-        /* Backup navigation history */
-        memcpy(history_backup, client.history, sizeof(client.history));
-        
-        /* Reset client state */
-        memset(&client, 0, sizeof(struct gopher_client));
-        client.port = GOPHER_DEFAULT_PORT;
-        client.connected = false;
-        client.item_count = 0;
-        
-        /* Restore navigation history */
-        memcpy(client.history, history_backup, sizeof(client.history));
-        client.history_pos = history_pos_backup;
-        client.history_count = history_count_backup;
-        
-        /* Clear buffer */
-        memset(gopher_buffer, 0, sizeof(gopher_buffer));
-        
-        ret = gopher_connect(&client, hostname, port);
-        if (ret < 0) {
-            shell_error(shell, "Failed to connect to server %s:%d: %d", 
-                        hostname, port, ret);
-            return ret;
-        }
-    }
+    /* The job takes a copy of the item, the listing is replaced by the fetch */
+    gopher_get_item(&client, index, &item);
     
     /* Handle special item types */
-    switch (client.items[index].type) {
+    switch (item.type) {
         case GOPHER_TYPE_TELNET:
         case GOPHER_TYPE_TN3270:
             shell_print(shell, "Telnet sessions are not supported in this client");
@@ -647,163 +1072,41 @@ static int cmd_gopher_view(const struct shell *shell, size_t argc, char **argv)
             break;
     }
     
-    /* Display original user-requested index, not internal adjusted index */
-    shell_print(shell, "Requesting item %d: '%s' (%c) from %s:%d...", 
-                atoi(argv[1]), /* Use the user's input index */
-                client.items[index].display_string, 
-                client.items[index].type,
-                client.hostname, 
-                client.port);
-                
-    /* For images, remove detailed logging to avoid build errors */
-    
-    ret = gopher_send_selector(&client, selector, gopher_buffer, sizeof(gopher_buffer));
-    if (ret < 0) {
-        shell_error(shell, "Failed to get response from server: %d", ret);
-        return ret;
+    job = browse_job_new(shell, item.selector);
+    job->type = item.type;
+    job->use_cache = true;
+    if (item.type == GOPHER_TYPE_DIRECTORY) {
+        job->empty_msg = "Failed to parse directory listing or empty directory";
     }
     
-    /* For directory items, parse and display the listing */
-    if (client.items[index].type == GOPHER_TYPE_DIRECTORY) {
-        ret = gopher_parse_directory(&client, gopher_buffer);
-        if (ret > 0) {
-            /* Display directory header */
-            shell_fprintf(shell, SHELL_NORMAL, "Gopher Directory: %s%s%s\n", 
-                        COLOR_BLUE, client.hostname, COLOR_RESET);
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            
-            /* Display all items in their original order */
-            int item_index = 0;
-            for (int i = 0; i < client.item_count; i++) {
-                /* Choose color based on item type */
-                const char *color;
-                const char *type_str;
-                
-                /* Special handling for info items */
-                if (client.items[i].type == 'i') {
-                    /* Align with text after the type indicator */
-                    shell_fprintf(shell, SHELL_NORMAL, "    %s%s%s\n", 
-                                COLOR_GREEN, client.items[i].display_string, COLOR_RESET);
-                    continue;
-                }
-                
-                /* For selectable items, increment the item index */
-                item_index++;
-                
-                switch (client.items[i].type) {
-                    case GOPHER_TYPE_DIRECTORY:
-                        color = COLOR_BLUE;
-                        type_str = "DIR";
-                        break;
-                    case GOPHER_TYPE_TEXT:
-                        color = COLOR_WHITE;
-                        type_str = "TXT";
-                        break;
-                    case GOPHER_TYPE_SEARCH:
-                        color = COLOR_GREEN;
-                        type_str = "SRC";
-                        break;
-                    case GOPHER_TYPE_IMAGE:
-                    case GOPHER_TYPE_GIF:
-                        color = COLOR_MAGENTA;
-                        type_str = "IMG";
-                        break;
-                    case GOPHER_TYPE_BINARY:
-                        color = COLOR_YELLOW;
-                        type_str = "BIN";
-                        break;
-                    case GOPHER_TYPE_ERROR:
-                        color = COLOR_RED;
-                        type_str = "ERR";
-                        break;
-                    default:
-                        color = COLOR_CYAN;
-                        type_str = "UNK";
-                        break;
-                }
-                
-                /* Display item with line number and type */
-                shell_fprintf(shell, SHELL_NORMAL, "%2d: %s[%s]%s %s\n", 
-                            item_index,
-                            color, type_str, COLOR_RESET,
-                            client.items[i].display_string);
-            }
-            
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            shell_print(shell, "Use 'gopher view <index>' to view an item");
-        } else {
-            shell_error(shell, "Failed to parse directory listing or empty directory");
-            shell_print(shell, "Raw response:");
-            shell_print(shell, "-------------");
-            shell_print(shell, "%s", gopher_buffer);
-        }
-    } else {
-        /* Check if this might be an image file */
-        if (gopher_is_image((uint8_t *)gopher_buffer, ret)) {
-            /* Display as image using ASCII art */
-            shell_print(shell, "Detected image file, rendering as ASCII art...");
-            
-            /* Use default ASCII art configuration */
-            ascii_art_config_t config = {
-                .use_color = true,
-                .use_dithering = true,
-                .use_extended_chars = false,
-                .color_mode = 8,
-                .brightness = 1.0f,
-                .contrast = 1.0f
-            };
-            
-            /* Render the image */
-            gopher_render_image(shell, (uint8_t *)gopher_buffer, ret, &config);
-        } else {
-            /* Display as text with proper formatting */
-            shell_fprintf(shell, SHELL_NORMAL, "Gopher Text: %s%s%s\n", 
-                        COLOR_BLUE, client.hostname, COLOR_RESET);
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            
-            /* Display text content in green for readability */
-            char *line_start = gopher_buffer;
-            char *line_end;
-            char line_buffer[GOPHER_BUFFER_SIZE];
-            
-            /* Process each line */
-            while (*line_start) {
-                /* Find end of line */
-                line_end = strstr(line_start, "\r\n");
-                if (!line_end) {
-                    /* Last line */
-                    shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                                COLOR_GREEN, line_start, COLOR_RESET);
-                    break;
-                }
-                
-                /* Extract the line */
-                int line_len = line_end - line_start;
-                if (line_len >= sizeof(line_buffer)) {
-                    line_len = sizeof(line_buffer) - 1;
-                }
-                memcpy(line_buffer, line_start, line_len);
-                line_buffer[line_len] = '\0';
-                
-                /* Display the line */
-                shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                            COLOR_GREEN, line_buffer, COLOR_RESET);
-                
-                /* Move to next line */
-                line_start = line_end + 2;
-            }
-            
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        }
+    /* Check if this item is on a different server */
+    if (strcmp(item.hostname, client.hostname) != 0 || item.port != client.port) {
+        shell_print(shell, "Item is on a different server (%s:%d). Connecting...", 
+                    item.hostname, item.port);
+        
+        strncpy(job->hostname, item.hostname, sizeof(job->hostname) - 1);
+        job->port = item.port;
     }
     
-    return 0;
+    /* Display original user-requested index, not internal adjusted index */
+    shell_print(shell, "Requesting item %d: '%s' (%c) from %s:%d...", 
+                atoi(argv[1]), /* Use the user's input index */
+                item.display_string, 
+                item.type,
+                item.hostname, 
+                item.port);
+    
+    return browse_submit(shell, job);
 }
 
 /* Navigate back in history */
 static int cmd_gopher_back(const struct shell *shell, size_t argc, char **argv)
 {
-    int ret;
+    struct browse_job *job;
+    
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
     
     if (ensure_client_initialized(shell) != 0) {
         return -EFAULT;
@@ -824,157 +1127,87 @@ static int cmd_gopher_back(const struct shell *shell, size_t argc, char **argv)
     
     shell_print(shell, "Navigating back to: '%s'", client.history[client.history_pos]);
     
-    ret = gopher_send_selector(&client, client.history[client.history_pos], 
-                              gopher_buffer, sizeof(gopher_buffer));
-    if (ret < 0) {
-        shell_error(shell, "Failed to get response from server: %d", ret);
-        return ret;
+    /* Going back is served from the cache when possible */
+    job = browse_job_new(shell, client.history[client.history_pos]);
+    job->use_cache = true;
+    
+    return browse_submit(shell, job);
+}
+
+/* Page through the text document last shown */
+static int cmd_gopher_more(const struct shell *shell, size_t argc, char **argv)
+{
+    struct browse_job *job;
+    int first = text_doc.next;
+    int lines = text_page_lines();
+    
+    if (!text_doc.valid) {
+        shell_error(shell, "No text document to page through");
+        return -ENODATA;
     }
     
-    /* Determine if this is a directory or a text file */
-    ret = gopher_parse_directory(&client, gopher_buffer);
-    if (ret > 0) {
-        /* Display directory header */
-        shell_fprintf(shell, SHELL_NORMAL, "Gopher Directory: %s%s%s\n", 
-                    COLOR_BLUE, client.hostname, COLOR_RESET);
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        
-        /* Display all items in their original order */
-        int item_index = 0;
-        for (int i = 0; i < client.item_count; i++) {
-            /* Choose color based on item type */
-            const char *color;
-            const char *type_str;
-            
-            /* Special handling for info items */
-            if (client.items[i].type == 'i') {
-                /* Align with text after the type indicator with 10-char offset */
-                shell_fprintf(shell, SHELL_NORMAL, "          %s%s%s\n", 
-                             COLOR_GREEN, client.items[i].display_string, COLOR_RESET);
-                continue;
-            }
-            
-            /* For selectable items, increment the item index */
-            item_index++;
-            
-            switch (client.items[i].type) {
-                case GOPHER_TYPE_DIRECTORY:
-                    color = COLOR_BLUE;
-                    type_str = "DIR";
-                    break;
-                case GOPHER_TYPE_TEXT:
-                    color = COLOR_WHITE;
-                    type_str = "TXT";
-                    break;
-                case GOPHER_TYPE_SEARCH:
-                    color = COLOR_GREEN;
-                    type_str = "SRC";
-                    break;
-                case GOPHER_TYPE_IMAGE:
-                case GOPHER_TYPE_GIF:
-                    color = COLOR_MAGENTA;
-                    type_str = "IMG";
-                    break;
-                case GOPHER_TYPE_BINARY:
-                    color = COLOR_YELLOW;
-                    type_str = "BIN";
-                    break;
-                case GOPHER_TYPE_ERROR:
-                    color = COLOR_RED;
-                    type_str = "ERR";
-                    break;
-                default:
-                    color = COLOR_CYAN;
-                    type_str = "UNK";
-                    break;
-            }
-            
-            /* Display item with line number and type */
-            shell_fprintf(shell, SHELL_NORMAL, "%2d: %s[%s]%s %s\n", 
-                         item_index, /* Starting from 1 for more intuitive numbering */
-                         color, type_str, COLOR_RESET,
-                         client.items[i].display_string);
-        }
-        
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        shell_print(shell, "Use 'gopher view <index>' to view an item");
-    } else {
-        /* Check if this might be an image file */
-        if (gopher_is_image((uint8_t *)gopher_buffer, ret)) {
-            
-            /* Display as image using ASCII art */
-            shell_print(shell, "Rendering image as ASCII art...");
-            
-            /* Use default ASCII art configuration */
-            ascii_art_config_t config = {
-                .use_color = true,
-                .use_dithering = true,
-                .use_extended_chars = false,
-                .color_mode = 8,
-                .brightness = 1.0f,
-                .contrast = 1.0f
-            };
-            
-            /* Render the image */
-            gopher_render_image(shell, (uint8_t *)gopher_buffer, ret, &config);
-            
+    if (argc >= 2) {
+        if (strcmp(argv[1], "back") == 0) {
+            first = MAX(text_doc.first - lines, 0);
+        } else if (strcmp(argv[1], "top") == 0) {
+            first = 0;
+        } else if (strcmp(argv[1], "all") == 0) {
+            lines = 0;
+        } else if (isdigit((unsigned char)argv[1][0]) && atoi(argv[1]) > 0) {
+            first = atoi(argv[1]) - 1;
         } else {
-            /* Display as text with proper formatting */
-            shell_fprintf(shell, SHELL_NORMAL, "Gopher Text: %s%s%s\n", 
-                        COLOR_BLUE, client.hostname, COLOR_RESET);
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-            
-            /* Display text content in green for readability */
-            char *line_start = gopher_buffer;
-            char *line_end;
-            char line_buffer[GOPHER_BUFFER_SIZE];
-            
-            /* Process each line */
-            while (*line_start) {
-                /* Find end of line */
-                line_end = strstr(line_start, "\r\n");
-                if (!line_end) {
-                    /* Last line */
-                    shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                                COLOR_GREEN, line_start, COLOR_RESET);
-                    break;
-                }
-                
-                /* Extract the line */
-                int line_len = line_end - line_start;
-                if (line_len >= sizeof(line_buffer)) {
-                    line_len = sizeof(line_buffer) - 1;
-                }
-                memcpy(line_buffer, line_start, line_len);
-                line_buffer[line_len] = '\0';
-                
-                /* Display the line */
-                shell_fprintf(shell, SHELL_NORMAL, "%s%s%s\n", 
-                            COLOR_GREEN, line_buffer, COLOR_RESET);
-                
-                /* Move to next line */
-                line_start = line_end + 2;
-            }
-            
-            shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
+            shell_error(shell, "Usage: gopher more [back|top|all|<line>]");
+            return -EINVAL;
         }
     }
     
-    return 0;
+    if (text_doc.total >= 0 && first >= text_doc.total) {
+        shell_print(shell, "End of document (%d lines)", text_doc.total);
+        return 0;
+    }
+    
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
+    
+    if (ensure_client_initialized(shell) != 0) {
+        return -EFAULT;
+    }
+    
+    /* Later pages come from the cache, or the document is fetched again
+       and read up to the page */
+    job = browse_job_new(shell, text_doc.selector);
+    job->type = GOPHER_TYPE_TEXT;
+    job->use_cache = true;
+    job->more = true;
+    job->first_line = first;
+    job->page_lines = lines;
+    job->req.background = true;
+    
+    if (strcmp(text_doc.hostname, client.hostname) != 0 || text_doc.port != client.port) {
+        strncpy(job->hostname, text_doc.hostname, sizeof(job->hostname) - 1);
+        job->port = text_doc.port;
+    }
+    
+    return browse_submit(shell, job);
 }
 
 /* Display search interface */
 static int cmd_gopher_search(const struct shell *shell, size_t argc, char **argv)
 {
     int index;
-    int ret;
-    char search_selector[GOPHER_MAX_SELECTOR_LEN];
+    struct gopher_item item;
+    struct browse_job *job;
     
     if (argc < 3) {
         shell_error(shell, "Usage: gopher search <index> <search_string>");
         return -EINVAL;
     }
     
+    if (cancel_active_request(shell) != 0) {
+        return -EBUSY;
+    }
+    
     if (ensure_client_initialized(shell) != 0) {
         return -EFAULT;
     }
@@ -989,161 +1222,416 @@ static int cmd_gopher_search(const struct shell *shell, size_t argc, char **argv
         return -ENODATA;
     }
     
-    /* Get the index from user input */
-    index = atoi(argv[1]);
-    if (index < 1) {
-        shell_error(shell, "Invalid item index. Must be between 1 and %d", client.item_count - gopher_count_info_items(&client));
+    /* Translate the user's index, which skips info items, to the item list index */
+    index = find_item_index(atoi(argv[1]));
+    if (index < 0) {
+        shell_error(shell, "Invalid item index. Must be between 1 and %d", 
+                   client.item_count - gopher_count_info_items(&client));
         return -EINVAL;
     }
-    index--; /* Convert from 1-based display index to 0-based array index */
-    
-    /* Count the number of info items to find the real index */
-    int real_index = 0;
-    int info_count = 0;
-    for (int i = 0; i < client.item_count; i++) {
-        if (client.items[i].type == 'i') {
-            info_count++;
-            continue;
-        }
-        if (real_index == index) {
-            index = i;
-            break;
-        }
-        real_index++;
-    }
     
     /* Check if item is a search server */
-    if (client.items[index].type != GOPHER_TYPE_SEARCH) {
-        shell_error(shell, "Item %d is not a search server", index + 1);
+    gopher_get_item(&client, index, &item);
+    if (item.type != GOPHER_TYPE_SEARCH) {
+        shell_error(shell, "Item %d is not a search server", atoi(argv[1]));
         return -EINVAL;
     }
     
     /* Construct search selector: selector<TAB>search_string */
-    snprintf(search_selector, sizeof(search_selector), "%s\t%s", 
-             client.items[index].selector, argv[2]);
+    job = browse_job_new(shell, NULL);
+    snprintf(job->selector, sizeof(job->selector), "%s\t%s", 
+             item.selector, argv[2]);
+    strncpy(job->query, argv[2], sizeof(job->query) - 1);
+    job->title = "Search Results";
+    job->error_msg = "Failed to get search results";
+    job->empty_msg = "No search results found or error parsing results";
+    
+    /* Parse search results as directory listing, they are never cached */
+    job->allow_document = false;
+    job->store = false;
     
     /* Check if this item is on a different server */
-    if (strcmp(client.items[index].hostname, client.hostname) != 0 || 
-        client.items[index].port != client.port) {
-        
+    if (strcmp(item.hostname, client.hostname) != 0 || item.port != client.port) {
         shell_print(shell, "Search server is on %s:%d. Connecting...", 
-                    client.items[index].hostname, client.items[index].port);
-        
-        /* Reset client state before connecting to a different server */
-        /* Keep history intact but reset other state */
-        char history_backup[10][GOPHER_MAX_SELECTOR_LEN];
-        int history_pos_backup = client.history_pos;
-        int history_count_backup = client.history_count;
-        
-        /* Backup navigation history */
-        memcpy(history_backup, client.history, sizeof(client.history));
+                    item.hostname, item.port);
         
-        /* Reset client state */
-        memset(&client, 0, sizeof(struct gopher_client));
-        client.port = GOPHER_DEFAULT_PORT;
-        client.connected = false;
-        client.item_count = 0;
-        
-        /* Restore navigation history */
-        memcpy(client.history, history_backup, sizeof(client.history));
-        client.history_pos = history_pos_backup;
-        client.history_count = history_count_backup;
+        strncpy(job->hostname, item.hostname, sizeof(job->hostname) - 1);
+        job->port = item.port;
+    }
+    
+    shell_print(shell, "Searching for '%s'...", argv[2]);
+    
+    return browse_submit(shell, job);
+}
+
+/* Cancel the request in progress */
+static int cmd_gopher_cancel(const struct shell *shell, size_t argc, char **argv)
+{
+    size_t received = 0;
+    int handle;
+    int ret;
+    
+    gopher_prefetch_stop();
+    handle = gopher_request_active(&received);
+    
+    if (handle == 0) {
+        shell_print(shell, "No request in progress");
+        return 0;
+    }
+    
+    /* The request reports the cancellation itself once it has stopped */
+    ret = gopher_request_cancel(handle, K_MSEC(GOPHER_IO_TIMEOUT_MS));
+    if (ret == -EAGAIN) {
+        shell_error(shell, "Request %d is still finishing (%zu bytes received)",
+                    handle, received);
+        return ret;
+    }
+    
+    return 0;
+}
+
+/* Show what is known about the connection behaviour of recent servers */
+static int cmd_gopher_conn(const struct shell *shell, size_t argc, char **argv)
+{
+    int64_t now = k_uptime_get();
+    
+    if (ensure_client_initialized(shell) != 0) {
+        return -EFAULT;
+    }
+    
+    shell_print(shell, "Server                                   Connect  Warm hits  Pre-open");
+    shell_print(shell, "-----------------------------------------------------------------------");
+    
+    for (int i = 0; i < GOPHER_MAX_SERVER_CAPS; i++) {
+        const struct gopher_server_caps *caps = &client.conn.servers[i];
         
-        /* Clear buffer */
-        memset(gopher_buffer, 0, sizeof(gopher_buffer));
+        if (caps->hostname[0] == '\0') {
+            continue;
+        }
         
-        ret = gopher_connect(&client, client.items[index].hostname, 
-                           client.items[index].port);
-        if (ret < 0) {
-            shell_error(shell, "Failed to connect to server: %d", ret);
-            return ret;
+        shell_print(shell, "%-34s:%-5u %5u ms  %9u  %s", caps->hostname, caps->port,
+                    caps->connect_ms, caps->warm_hits,
+                    caps->warm_disabled ? "off" : "on");
+    }
+    
+    if (client.conn.warm.state != GOPHER_CONN_NONE) {
+        shell_print(shell, "Pre-opened connection to %s:%u (%lld ms old)",
+                    client.conn.warm.hostname, client.conn.warm.port,
+                    (long long)(now - client.conn.warm.opened_at));
+    }
+    
+    return 0;
+}
+
+/* Print one resolved-address cache entry */
+static void print_dns_entry(const char *hostname, const struct in_addr *addr,
+                            int status, int64_t ttl_ms, void *user_data)
+{
+    const struct shell *shell = user_data;
+    char addr_str[NET_IPV4_ADDR_LEN];
+    
+    if (addr != NULL) {
+        net_addr_ntop(AF_INET, addr, addr_str, sizeof(addr_str));
+    } else if (status == -EINPROGRESS) {
+        strcpy(addr_str, "(resolving)");
+    } else {
+        strcpy(addr_str, "(failed)");
+    }
+    
+    shell_print(shell, "%-40s %-16s %6lld s", hostname, addr_str, (long long)(ttl_ms / 1000));
+}
+
+/* Show or flush the resolved-address cache */
+static int cmd_gopher_dns(const struct shell *shell, size_t argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "flush") == 0) {
+        gopher_dns_flush();
+        shell_print(shell, "DNS cache flushed");
+        return 0;
+    }
+    
+    shell_print(shell, "Hostname                                 Address          TTL");
+    shell_print(shell, "-------------------------------------------------------------------");
+    gopher_dns_foreach(print_dns_entry, (void *)shell);
+    
+    return 0;
+}
+
+/* Print one response cache entry */
+static void print_cache_entry(const char *hostname, uint16_t port, const char *selector,
+                              enum gopher_cache_kind kind, size_t size, int64_t age_ms,
+                              void *user_data)
+{
+    const struct shell *shell = user_data;
+    
+    shell_print(shell, "%-4s %6zu %5lld s  %s:%u %s", 
+                kind == GOPHER_CACHE_MENU ? "DIR" : "DOC", size,
+                (long long)(age_ms / 1000), hostname, port,
+                selector[0] ? selector : "(root)");
+}
+
+/* Show or flush the response cache */
+static int cmd_gopher_cache(const struct shell *shell, size_t argc, char **argv)
+{
+    struct gopher_cache_stats stats;
+    uint32_t lookups;
+    size_t fs_used;
+    int fs_entries;
+    
+    if (argc >= 2 && strcmp(argv[1], "flush") == 0) {
+        gopher_cache_flush();
+        shell_print(shell, "Response cache flushed");
+        return 0;
+    }
+    
+    gopher_cache_get_stats(&stats);
+    lookups = stats.hits + stats.misses;
+    
+    shell_print(shell, "Hits: %u  Misses: %u  Hit rate: %u%%  Evictions: %u",
+                stats.hits, stats.misses, lookups ? stats.hits * 100 / lookups : 0,
+                stats.evictions);
+    shell_print(shell, "Entries: %u  Used: %zu of %zu bytes",
+                stats.entries, stats.used, stats.size);
+    
+    if (gopher_fs_cache_usage(&fs_entries, &fs_used) == 0) {
+        shell_print(shell, "Persistent: %d entries, %zu of %d bytes, %u hits",
+                    fs_entries, fs_used, GOPHER_FS_CACHE_SIZE, stats.fs_hits);
+    }
+    shell_print(shell, "");
+    shell_print(shell, "Kind   Size    Age   Response");
+    shell_print(shell, "-------------------------------------------------------------------");
+    gopher_cache_foreach(print_cache_entry, (void *)shell);
+    
+    return 0;
+}
+
+/* Show prefetch statistics or turn prefetching on or off */
+static int cmd_gopher_prefetch(const struct shell *shell, size_t argc, char **argv)
+{
+    struct gopher_prefetch_stats stats;
+    
+    if (argc >= 2) {
+        if (strcmp(argv[1], "on") == 0) {
+            gopher_prefetch_enable(true);
+        } else if (strcmp(argv[1], "off") == 0) {
+            gopher_prefetch_enable(false);
+        } else {
+            shell_error(shell, "Usage: gopher prefetch [on|off]");
+            return -EINVAL;
         }
     }
     
-    shell_print(shell, "Searching for '%s'...", argv[2]);
+    gopher_prefetch_get_stats(&stats);
     
-    ret = gopher_send_selector(&client, search_selector, gopher_buffer, sizeof(gopher_buffer));
-    if (ret < 0) {
-        shell_error(shell, "Failed to get search results: %d", ret);
-        return ret;
+    shell_print(shell, "Prefetch: %s (first %d directory/text items, %d KB per menu)",
+                gopher_prefetch_enabled() ? "on" : "off",
+                GOPHER_PREFETCH_MAX_ITEMS, GOPHER_PREFETCH_MAX_BYTES / 1024);
+    shell_print(shell, "Fetched: %u  Cancelled: %u  Dropped: %u  Downloaded: %zu bytes",
+                stats.fetched, stats.cancelled, stats.dropped, stats.bytes);
+    
+    return 0;
+}
+
+/* Show or set the colour mode used for images */
+static int cmd_gopher_color(const struct shell *shell, size_t argc, char **argv)
+{
+    if (argc >= 2) {
+        if (strcmp(argv[1], "8") == 0) {
+            image_color_mode = GOPHER_COLOR_MODE_8;
+        } else if (strcmp(argv[1], "256") == 0) {
+            image_color_mode = GOPHER_COLOR_MODE_256;
+        } else if (strcmp(argv[1], "true") == 0) {
+            image_color_mode = GOPHER_COLOR_MODE_TRUE;
+        } else {
+            shell_error(shell, "Usage: gopher color [8|256|true]");
+            return -EINVAL;
+        }
     }
     
-    /* Parse search results as directory listing */
-    ret = gopher_parse_directory(&client, gopher_buffer);
-    if (ret > 0) {
-        /* Display search results header */
-        shell_fprintf(shell, SHELL_NORMAL, "Search Results: %s%s%s\n", 
-                    COLOR_BLUE, client.hostname, COLOR_RESET);
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        shell_fprintf(shell, SHELL_NORMAL, "%sSearch query: %s%s\n\n", 
-                    COLOR_GREEN, argv[2], COLOR_RESET);
+    shell_print(shell, "Image colours: %s", gopher_color_mode_name(image_color_mode));
+    
+    return 0;
+}
+
+/* Show or set the dithering of 8-colour images */
+static int cmd_gopher_dither(const struct shell *shell, size_t argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int dither;
+    } methods[] = {
+        { "fs", GOPHER_DITHER_FLOYD_STEINBERG },
+        { "atkinson", GOPHER_DITHER_ATKINSON },
+        { "sierra", GOPHER_DITHER_SIERRA_LITE },
+        { "bayer", GOPHER_DITHER_BAYER },
+    };
+    
+    if (argc >= 2) {
+        int i;
         
-        /* Display all items in their original order */
-        int item_index = 0;
-        for (int i = 0; i < client.item_count; i++) {
-            /* Choose color based on item type */
-            const char *color;
-            const char *type_str;
-            
-            /* Special handling for info items */
-            if (client.items[i].type == 'i') {
-                /* Align with text after the type indicator with 10-char offset */
-                shell_fprintf(shell, SHELL_NORMAL, "          %s%s%s\n", 
-                             COLOR_GREEN, client.items[i].display_string, COLOR_RESET);
-                continue;
+        for (i = 0; i < ARRAY_SIZE(methods); i++) {
+            if (strcmp(argv[1], methods[i].name) == 0) {
+                break;
             }
-            
-            /* For selectable items, increment the item index */
-            item_index++;
-            
-            switch (client.items[i].type) {
-                case GOPHER_TYPE_DIRECTORY:
-                    color = COLOR_BLUE;
-                    type_str = "DIR";
-                    break;
-                case GOPHER_TYPE_TEXT:
-                    color = COLOR_WHITE;
-                    type_str = "TXT";
-                    break;
-                case GOPHER_TYPE_SEARCH:
-                    color = COLOR_GREEN;
-                    type_str = "SRC";
-                    break;
-                case GOPHER_TYPE_IMAGE:
-                case GOPHER_TYPE_GIF:
-                    color = COLOR_MAGENTA;
-                    type_str = "IMG";
-                    break;
-                case GOPHER_TYPE_BINARY:
-                    color = COLOR_YELLOW;
-                    type_str = "BIN";
-                    break;
-                case GOPHER_TYPE_ERROR:
-                    color = COLOR_RED;
-                    type_str = "ERR";
-                    break;
-                default:
-                    color = COLOR_CYAN;
-                    type_str = "UNK";
-                    break;
+        }
+        
+        if (i < ARRAY_SIZE(methods)) {
+            image_dithering = true;
+            image_dither = methods[i].dither;
+        } else if (strcmp(argv[1], "off") == 0) {
+            image_dithering = false;
+        } else {
+            shell_error(shell, "Usage: gopher dither [off|fs|atkinson|sierra|bayer]");
+            return -EINVAL;
+        }
+    }
+    
+    shell_print(shell, "Dithering: %s (8-colour mode only)",
+                image_dithering ? gopher_dither_name(image_dither) : "off");
+    
+    return 0;
+}
+
+/* Show or set whether animated GIFs are played */
+static int cmd_gopher_animate(const struct shell *shell, size_t argc, char **argv)
+{
+    if (argc >= 2) {
+        if (strcmp(argv[1], "on") == 0) {
+            image_animate = true;
+        } else if (strcmp(argv[1], "off") == 0) {
+            image_animate = false;
+        } else {
+            shell_error(shell, "Usage: gopher animate [on|off]");
+            return -EINVAL;
+        }
+    }
+    
+    shell_print(shell, "Animation: %s (%s)", image_animate ? "on" : "off",
+                image_animate ? "GIFs play until the next command" : "GIFs show their first frame");
+    
+    return 0;
+}
+
+/* Show memory use per pool, or forget the peaks ('gopher mem reset') */
+static int cmd_gopher_mem(const struct shell *shell, size_t argc, char **argv)
+{
+    struct gopher_mem_stats stats;
+    char budget[12];
+    
+    if (argc >= 2) {
+        if (strcmp(argv[1], "reset") != 0) {
+            shell_error(shell, "Usage: gopher mem [reset]");
+            return -EINVAL;
+        }
+        gopher_mem_reset_peaks();
+        shell_print(shell, "Memory peaks reset");
+        return 0;
+    }
+    
+    shell_print(shell, "Pool    Budget KB  Used KB  Peak KB  PSRAM KB  Allocs  Failed");
+    shell_print(shell, "--------------------------------------------------------------");
+    for (int i = 0; i < GOPHER_MEM_POOLS; i++) {
+        gopher_mem_stats(i, &stats);
+        if (stats.budget > 0) {
+            snprintf(budget, sizeof(budget), "%zu", stats.budget / 1024);
+        } else {
+            strcpy(budget, "-");
+        }
+        shell_print(shell, "%-7s %9s %8zu %8zu %9zu %7u %7u", gopher_mem_pool_name(i), budget,
+                    stats.used / 1024, stats.peak / 1024, stats.external / 1024,
+                    stats.allocs, stats.failures);
+    }
+    shell_print(shell, "");
+    shell_print(shell, "Image arena: peak %zu of %d KB", gopher_image_arena_peak() / 1024,
+                GOPHER_IMAGE_ARENA_SIZE / 1024);
+    shell_print(shell, "Static: menu %zu KB, document buffer %d KB",
+                sizeof(client.menu) / 1024, GOPHER_BUFFER_SIZE / 1024);
+    
+    return 0;
+}
+
+/* Show the terminal size, ask the terminal again or set it by hand */
+static int cmd_gopher_term(const struct shell *shell, size_t argc, char **argv)
+{
+    struct gopher_term_size term;
+    struct gopher_out_stats out;
+    char *end;
+    int columns, lines;
+    
+    if (argc >= 2) {
+        if (strcmp(argv[1], "query") == 0) {
+            if (gopher_term_query(shell) < 0) {
+                shell_error(shell, "A size query is already in progress");
+                return -EBUSY;
             }
-            
-            /* Display item with line number and type */
-            shell_fprintf(shell, SHELL_NORMAL, "%2d: %s[%s]%s %s\n", 
-                         item_index, /* Starting from 1 for more intuitive numbering */
-                         color, type_str, COLOR_RESET,
-                         client.items[i].display_string);
+            term_queried = true;
+            return 0;
         }
         
-        shell_fprintf(shell, SHELL_NORMAL, "---------------------------------------------\n");
-        shell_print(shell, "Use 'gopher view <index>' to view a result");
-    } else {
-        shell_error(shell, "No search results found or error parsing results");
+        columns = strtol(argv[1], &end, 10);
+        if (*end != 'x' || columns <= 0) {
+            shell_error(shell, "Usage: gopher term [query|<columns>x<lines>]");
+            return -EINVAL;
+        }
+        lines = strtol(end + 1, &end, 10);
+        if (*end != '\0' || lines <= 0) {
+            shell_error(shell, "Usage: gopher term [query|<columns>x<lines>]");
+            return -EINVAL;
+        }
+        gopher_term_set(columns, lines);
+        term_queried = true;
     }
     
+    gopher_term_get(&term);
+    shell_print(shell, "Terminal: %dx%d (%s)", term.columns, term.lines,
+                term.measured ? "measured" : "assumed, 'gopher term query' asks the terminal");
+    
+    gopher_out_get_stats(&out);
+    shell_print(shell, "Output: %u bytes in %u shell writes, from %u pieces of text",
+                out.bytes, out.writes, out.requests);
+    
     return 0;
 }
 
+/* Show or set whether images are drawn with half blocks */
+static int cmd_gopher_blocks(const struct shell *shell, size_t argc, char **argv)
+{
+    if (argc >= 2) {
+        if (strcmp(argv[1], "on") == 0) {
+            image_half_blocks = true;
+        } else if (strcmp(argv[1], "off") == 0) {
+            image_half_blocks = false;
+        } else {
+            shell_error(shell, "Usage: gopher blocks [on|off]");
+            return -EINVAL;
+        }
+    }
+    
+    shell_print(shell, "Half blocks: %s (%s)", image_half_blocks ? "on" : "off",
+                image_half_blocks ? "two pixels per character cell, needs a Unicode terminal" :
+                "each pixel is two ASCII characters");
+    
+    return 0;
+}
+
+#ifdef CONFIG_GOPHER_BENCH
+/* Run the benchmarks against the built-in loopback server */
+static int cmd_gopher_bench(const struct shell *shell, size_t argc, char **argv)
+{
+    const char *suite = argc >= 2 ? argv[1] : "all";
+    int iterations = argc >= 3 ? atoi(argv[2]) : GOPHER_BENCH_ITERATIONS;
+    int ret;
+    
+    /* Nothing else may use the network while measuring */
+    ret = cancel_active_request(shell);
+    if (ret < 0) {
+        return ret;
+    }
+    
+    return gopher_bench_run(shell, suite, iterations);
+}
+#endif
+
 /* These helper functions are now defined at the top of the file */
 
 /* Display help information */
@@ -1158,7 +1646,22 @@ static int cmd_gopher_help(const struct shell *shell, size_t argc, char **argv)
     shell_print(shell, "gopher get [selector] - Request a document or directory");
     shell_print(shell, "gopher view <index> - View an item from the directory");
     shell_print(shell, "gopher back - Navigate back to previous item");
+    shell_print(shell, "gopher more [back|top|all|<line>] - Page through the last text document");
     shell_print(shell, "gopher search <index> <search_string> - Search using a search server");
+    shell_print(shell, "gopher cancel - Cancel the request in progress");
+    shell_print(shell, "gopher conn - Show connection statistics for recent servers");
+    shell_print(shell, "gopher dns [flush] - Show or flush the DNS cache");
+    shell_print(shell, "gopher cache [flush] - Show or flush the response cache");
+    shell_print(shell, "gopher prefetch [on|off] - Prefetch the first items of each menu");
+    shell_print(shell, "gopher color [8|256|true] - Show or set the colours used for images");
+    shell_print(shell, "gopher blocks [on|off] - Draw images with Unicode half blocks");
+    shell_print(shell, "gopher dither [off|fs|atkinson|sierra|bayer] - Show or set image dithering");
+    shell_print(shell, "gopher animate [on|off] - Play animated GIFs");
+    shell_print(shell, "gopher mem [reset] - Show memory use and budgets");
+    shell_print(shell, "gopher term [query|<columns>x<lines>] - Show, measure or set the terminal size");
+#ifdef CONFIG_GOPHER_BENCH
+    shell_print(shell, "gopher bench [menu|text|image|all] [iterations] - Run the benchmarks");
+#endif
     shell_print(shell, "gopher help - Display this help message");
     shell_print(shell, "");
     shell_print(shell, "Examples:");
@@ -1178,7 +1681,22 @@ SHELL_STATIC_SUBCMD_SET_CREATE(sub_gopher,
     SHELL_CMD(get, NULL, "Request a document or directory", cmd_gopher_get),
     SHELL_CMD(view, NULL, "View an item from the directory (use item number)", cmd_gopher_view),
     SHELL_CMD(back, NULL, "Navigate back to previous item", cmd_gopher_back),
+    SHELL_CMD(more, NULL, "Page through the last text document ('gopher more back|top|all|<line>')", cmd_gopher_more),
     SHELL_CMD(search, NULL, "Search using a search server", cmd_gopher_search),
+    SHELL_CMD(cancel, NULL, "Cancel the request in progress", cmd_gopher_cancel),
+    SHELL_CMD(conn, NULL, "Show connection statistics for recent servers", cmd_gopher_conn),
+    SHELL_CMD(dns, NULL, "Show or flush the DNS cache ('gopher dns flush')", cmd_gopher_dns),
+    SHELL_CMD(cache, NULL, "Show or flush the response cache ('gopher cache flush')", cmd_gopher_cache),
+    SHELL_CMD(prefetch, NULL, "Prefetch the first items of each menu ('gopher prefetch on|off')", cmd_gopher_prefetch),
+    SHELL_CMD(color, NULL, "Show or set the image colour mode ('gopher color 8|256|true')", cmd_gopher_color),
+    SHELL_CMD(blocks, NULL, "Draw images with Unicode half blocks ('gopher blocks on|off')", cmd_gopher_blocks),
+    SHELL_CMD(dither, NULL, "Show or set image dithering ('gopher dither off|fs|atkinson|sierra|bayer')", cmd_gopher_dither),
+    SHELL_CMD(animate, NULL, "Play animated GIFs ('gopher animate on|off')", cmd_gopher_animate),
+    SHELL_CMD(mem, NULL, "Show memory use and budgets ('gopher mem reset')", cmd_gopher_mem),
+    SHELL_CMD(term, NULL, "Show, measure or set the terminal size ('gopher term query|<columns>x<lines>')", cmd_gopher_term),
+#ifdef CONFIG_GOPHER_BENCH
+    SHELL_CMD(bench, NULL, "Run the benchmarks ('gopher bench [menu|text|image|all] [iterations]')", cmd_gopher_bench),
+#endif
     SHELL_CMD(help, NULL, "Display help information", cmd_gopher_help),
     SHELL_SUBCMD_SET_END
 );
@@ -1210,8 +1728,36 @@ static int cmd_g_handler(const struct shell *shell, size_t argc, char **argv)
         return cmd_gopher_view(shell, argc - 1, &argv[1]);
     } else if (strcmp(argv[1], "back") == 0) {
         return cmd_gopher_back(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "more") == 0) {
+        return cmd_gopher_more(shell, argc - 1, &argv[1]);
     } else if (strcmp(argv[1], "search") == 0) {
         return cmd_gopher_search(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "cancel") == 0) {
+        return cmd_gopher_cancel(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "conn") == 0) {
+        return cmd_gopher_conn(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "dns") == 0) {
+        return cmd_gopher_dns(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "cache") == 0) {
+        return cmd_gopher_cache(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "prefetch") == 0) {
+        return cmd_gopher_prefetch(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "color") == 0) {
+        return cmd_gopher_color(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "blocks") == 0) {
+        return cmd_gopher_blocks(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "dither") == 0) {
+        return cmd_gopher_dither(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "animate") == 0) {
+        return cmd_gopher_animate(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "mem") == 0) {
+        return cmd_gopher_mem(shell, argc - 1, &argv[1]);
+    } else if (strcmp(argv[1], "term") == 0) {
+        return cmd_gopher_term(shell, argc - 1, &argv[1]);
+#ifdef CONFIG_GOPHER_BENCH
+    } else if (strcmp(argv[1], "bench") == 0) {
+        return cmd_gopher_bench(shell, argc - 1, &argv[1]);
+#endif
     } else if (strcmp(argv[1], "help") == 0) {
         return cmd_gopher_help(shell, argc - 1, &argv[1]);
     } else {
@@ -1232,6 +1778,7 @@ static int gopher_shell_init(void)
     if (ret == 0) {
         client_initialized = true;
     }
+    gopher_image_init();
     return ret;
 }
 
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "gopher_term.h"
+
+LOG_MODULE_REGISTER(gopher_term, LOG_LEVEL_ERR);
+
+/* Columns and lines packed in one word, so readers never see half an update */
+#define TERM_PACK(columns, lines) (((atomic_val_t)(columns) << 16) | (lines))
+
+static atomic_t term_size = ATOMIC_INIT(TERM_PACK(GOPHER_TERM_COLUMNS, GOPHER_TERM_LINES));
+static atomic_t term_measured;
+
+/* Query in progress: the shell whose input is taken over, and the reply
+ * collected so far, ESC [ lines ; columns R */
+static const struct shell *query_shell;
+static char reply[16];
+static size_t reply_len;
+static atomic_t querying;
+
+static void term_query_timeout(struct k_work *work);
+
+static K_WORK_DELAYABLE_DEFINE(query_timeout, term_query_timeout);
+
+/* Give the shell its input back; false if the query had already ended */
+static bool term_query_end(void)
+{
+    if (!atomic_cas(&querying, 1, 0)) {
+        return false;
+    }
+    shell_set_bypass(query_shell, NULL, NULL);
+    
+    return true;
+}
+
+static void term_query_timeout(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    
+    if (term_query_end()) {
+        LOG_WRN("Terminal did not report its size");
+    }
+}
+
+/* Parse a cursor position report; returns false if it is not one */
+static bool term_parse_reply(int *columns, int *lines)
+{
+    char *end;
+    
+    if (reply_len < 6 || reply[0] != '\033' || reply[1] != '[') {
+        return false;
+    }
+    
+    *lines = strtol(&reply[2], &end, 10);
+    if (*end != ';') {
+        return false;
+    }
+    *columns = strtol(end + 1, &end, 10);
+    
+    return *end == 'R';
+}
+
+/* Takes the shell's input while a query is in progress. Anything before
+ * the reply is typed-ahead input and is dropped. */
+static void term_bypass(const struct shell *shell, uint8_t *data, size_t len, void *user_data)
+{
+    int columns, lines;
+    
+    ARG_UNUSED(shell);
+    ARG_UNUSED(user_data);
+    
+    for (size_t i = 0; i < len; i++) {
+        if (reply_len == 0 && data[i] != '\033') {
+            continue;
+        }
+        
+        reply[reply_len++] = data[i];
+        if (data[i] == 'R') {
+            reply[reply_len] = '\0';
+            if (term_parse_reply(&columns, &lines)) {
+                k_work_cancel_delayable(&query_timeout);
+                gopher_term_set(columns, lines);
+                term_query_end();
+                return;
+            }
+            reply_len = 0;
+        } else if (reply_len == sizeof(reply) - 1) {
+            reply_len = 0;
+        }
+    }
+}
+
+int gopher_term_query(const struct shell *shell)
+{
+    if (!atomic_cas(&querying, 0, 1)) {
+        return -EBUSY;
+    }
+    
+    query_shell = shell;
+    reply_len = 0;
+    shell_set_bypass(shell, term_bypass, NULL);
+    k_work_reschedule(&query_timeout, K_MSEC(GOPHER_TERM_QUERY_TIMEOUT_MS));
+    
+    /* Save the cursor, go as far right and down as the terminal allows,
+       ask where that is and come back */
+    shell_fprintf(shell, SHELL_NORMAL, "\0337\033[999;999H\033[6n\0338");
+    
+    return 0;
+}
+
+void gopher_term_get(struct gopher_term_size *size)
+{
+    atomic_val_t packed = atomic_get(&term_size);
+    
+    size->columns = packed >> 16;
+    size->lines = packed & 0xFFFF;
+    size->measured = atomic_get(&term_measured) != 0;
+}
+
+void gopher_term_set(int columns, int lines)
+{
+    columns = CLAMP(columns, GOPHER_TERM_MIN_COLUMNS, GOPHER_TERM_MAX_COLUMNS);
+    lines = CLAMP(lines, GOPHER_TERM_MIN_LINES, GOPHER_TERM_MAX_LINES);
+    
+    atomic_set(&term_size, TERM_PACK(columns, lines));
+    atomic_set(&term_measured, 1);
+    LOG_INF("Terminal is %dx%d", columns, lines);
+}
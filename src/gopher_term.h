@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_TERM_H_
+#define GOPHER_TERM_H_
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+/* Size assumed until the terminal has answered */
+#define GOPHER_TERM_COLUMNS 80
+#define GOPHER_TERM_LINES 24
+
+/* Sizes outside these limits are clamped */
+#define GOPHER_TERM_MIN_COLUMNS 20
+#define GOPHER_TERM_MIN_LINES 8
+#define GOPHER_TERM_MAX_COLUMNS 320
+#define GOPHER_TERM_MAX_LINES 200
+
+/* Time the terminal gets to report its size; keys typed meanwhile are lost */
+#define GOPHER_TERM_QUERY_TIMEOUT_MS 500
+
+/* Size of the terminal the shell runs on */
+struct gopher_term_size {
+    int columns;
+    int lines;
+    bool measured;              /* Reported by the terminal or set by hand */
+};
+
+/**
+ * @brief Ask the terminal for its size
+ *
+ * The cursor is moved to the bottom right corner and its position reported
+ * (VT100 DSR), then put back. The reply comes in through the shell's input
+ * after the calling command has returned, and updates the cached size; a
+ * terminal that does not answer within GOPHER_TERM_QUERY_TIMEOUT_MS leaves
+ * it as it was.
+ *
+ * @param shell Shell whose terminal to query
+ * @return 0 if the query was sent, -EBUSY if one is already in progress
+ */
+int gopher_term_query(const struct shell *shell);
+
+/**
+ * @brief Get the cached terminal size
+ *
+ * @param size Filled with the size; safe to call from any thread
+ */
+void gopher_term_get(struct gopher_term_size *size);
+
+/**
+ * @brief Set the terminal size by hand
+ *
+ * @param columns Terminal width in characters
+ * @param lines Terminal height in lines
+ */
+void gopher_term_set(int columns, int lines);
+
+#endif /* GOPHER_TERM_H_ */
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+#include <string.h>
+#include "gopher_text.h"
+#include "gopher_out.h"
+
+/* Columns taken by a byte at a column: UTF-8 continuation bytes share the
+ * column of their lead byte, control characters other than tab take none */
+static int text_width(uint8_t c, int column)
+{
+    if (c == '\t') {
+        return GOPHER_TEXT_TAB - column % GOPHER_TEXT_TAB;
+    }
+    
+    return ((c & 0xC0) == 0x80 || c < 0x20) ? 0 : 1;
+}
+
+/* Whether the line being read falls in the window */
+static bool pager_visible(const struct gopher_pager *pager)
+{
+    return pager->line >= pager->first &&
+           (pager->count == 0 || pager->line < pager->first + pager->count);
+}
+
+/* Print a slice of the current line if it is in the window */
+static void pager_print(struct gopher_pager *pager, const uint8_t *start, const uint8_t *end)
+{
+    if (end > start && pager_visible(pager)) {
+        gopher_out_write(pager->out, (const char *)start, end - start);
+    }
+}
+
+static void pager_next_line(struct gopher_pager *pager)
+{
+    pager->line++;
+    pager->column = 0;
+}
+
+void gopher_pager_init(struct gopher_pager *pager, struct gopher_out *out,
+                       int width, int first, int count)
+{
+    memset(pager, 0, sizeof(*pager));
+    pager->out = out;
+    pager->width = MAX(width, GOPHER_TEXT_TAB);
+    pager->first = MAX(first, 0);
+    pager->count = MAX(count, 0);
+}
+
+int gopher_pager_feed(struct gopher_pager *pager, const uint8_t *data, size_t len)
+{
+    const uint8_t *start = data;
+    const uint8_t *end = data + len;
+    
+    /* Runs of the same line are printed in one go; the buffer is only cut
+       where a line ends, wraps or carries a carriage return */
+    for (const uint8_t *p = data; p < end; p++) {
+        int width;
+        
+        if (*p == '\n') {
+            pager_print(pager, start, p + 1);
+            start = p + 1;
+            pager_next_line(pager);
+            continue;
+        }
+        
+        if (*p == '\r') {
+            pager_print(pager, start, p);
+            start = p + 1;
+            continue;
+        }
+        
+        width = text_width(*p, pager->column);
+        if (width == 0) {
+            continue;
+        }
+        if (pager->column > 0 && pager->column + width > pager->width) {
+            pager_print(pager, start, p);
+            if (pager_visible(pager)) {
+                gopher_out_write(pager->out, "\n", 1);
+            }
+            start = p;
+            pager_next_line(pager);
+            if (*p == '\t') {
+                width = GOPHER_TEXT_TAB;
+            }
+        }
+        pager->column += width;
+    }
+    
+    pager_print(pager, start, end);
+    
+    return (pager->count > 0 && pager->line >= pager->first + pager->count) ? 1 : 0;
+}
+
+int gopher_pager_end(struct gopher_pager *pager, bool complete)
+{
+    if (pager->column > 0 && pager_visible(pager)) {
+        gopher_out_write(pager->out, "\n", 1);
+    }
+    
+    if (complete) {
+        if (pager->column > 0) {
+            pager_next_line(pager);
+        }
+        pager->ended = true;
+    }
+    
+    return pager->line;
+}
+
+int gopher_pager_shown(const struct gopher_pager *pager)
+{
+    int last = pager->line + (pager->column > 0 ? 1 : 0);
+    
+    if (pager->count > 0) {
+        last = MIN(last, pager->first + pager->count);
+    }
+    
+    return MAX(last - pager->first, 0);
+}
+
+size_t gopher_text_fit(const char *text, int columns)
+{
+    const char *p;
+    int column = 0;
+    
+    for (p = text; *p != '\0'; p++) {
+        int width = text_width(*p, column);
+        
+        if (column + width > columns) {
+            break;
+        }
+        column += width;
+    }
+    
+    return p - text;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef GOPHER_TEXT_H_
+#define GOPHER_TEXT_H_
+
+#include <zephyr/kernel.h>
+#include "gopher_out.h"
+
+/* Terminal lines of a page not taken by the document: the status line and
+ * the prompt */
+#define GOPHER_PAGER_RESERVED_LINES 2
+
+/* Width of a tab stop */
+#define GOPHER_TEXT_TAB 8
+
+/* Prints one window of a text document as it streams through, straight from
+ * the buffers it arrives in. Lines are counted after wrapping, so the line
+ * numbers match what is on screen. */
+struct gopher_pager {
+    struct gopher_out *out;     /* Where the window is written */
+    int width;                  /* Columns to wrap at */
+    int first;                  /* First line to print */
+    int count;                  /* Lines to print, 0 for all from first */
+    int line;                   /* Line being read */
+    int column;                 /* Column reached in that line */
+    bool ended;                 /* Whole document fed, line is the total */
+};
+
+/**
+ * @brief Start paging a document
+ *
+ * @param pager Pager state
+ * @param out Writer to print through; the caller flushes it
+ * @param width Columns to wrap at
+ * @param first First line to print, counting from 0
+ * @param count Lines to print, 0 for the rest of the document
+ */
+void gopher_pager_init(struct gopher_pager *pager, struct gopher_out *out,
+                       int width, int first, int count);
+
+/**
+ * @brief Take the next part of the document
+ *
+ * Bytes outside the window are only counted. Carriage returns are dropped.
+ *
+ * @param pager Pager state
+ * @param data Document bytes, only read during the call
+ * @param len Number of bytes in data
+ * @return 0 while lines of the window are still to come, 1 once it is full
+ */
+int gopher_pager_feed(struct gopher_pager *pager, const uint8_t *data, size_t len);
+
+/**
+ * @brief Finish printing the window
+ *
+ * Ends a partly printed line. Once the whole document has been fed, the
+ * line count is made final.
+ *
+ * @param pager Pager state
+ * @param complete true if the whole document was fed
+ * @return Number of lines read, the total if complete
+ */
+int gopher_pager_end(struct gopher_pager *pager, bool complete);
+
+/**
+ * @brief Get the number of lines printed so far
+ *
+ * @param pager Pager state
+ * @return Lines of the window that have been printed, a partial last one
+ *         included
+ */
+int gopher_pager_shown(const struct gopher_pager *pager);
+
+/**
+ * @brief Find how much of a string fits in a number of columns
+ *
+ * Columns are counted the way the pager wraps lines.
+ *
+ * @param text NUL-terminated string
+ * @param columns Columns available
+ * @return Length in bytes of the longest start of text that fits
+ */
+size_t gopher_text_fit(const char *text, int columns);
+
+#endif /* GOPHER_TEXT_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2023 Gopher Client
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Host clock for the benchmarks on native_sim. Built into the native
+ * simulator runner, so it uses the host C library: simulated time does not
+ * advance while code runs, which would make every CPU-bound step take zero.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+uint64_t gopher_bench_host_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -423,6 +423,29 @@ typedef struct
 STBIDEF stbi_uc *stbi_load_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels);
 
+// Row-by-row decoding (gophyr addition). Baseline JPEGs are decoded one MCU
+// row at a time, so the full image is never held in memory; other formats are
+// decoded whole and then handed out a row at a time. 'row' holds 'width' pixels
+// of desired_channels bytes and is only valid during the call. Return nonzero
+// from the callback to stop decoding.
+//
+// 'scale' (1, 2, 4 or 8) shrinks the image to ceil(w/scale) x ceil(h/scale)
+// pixels. Baseline JPEGs are reduced in the DCT domain: each 8x8 block is
+// turned into 8/scale x 8/scale pixels from its low-frequency coefficients
+// only, which also shrinks the band buffers. Other formats are box-averaged
+// after decoding. *x and *y report the reduced size.
+typedef int (*stbi_row_callback)(void *user, int y, const stbi_uc *row, int width);
+STBIDEF int      stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels, int scale, stbi_row_callback cb, void *user);
+
+// Previews of partly received PNGs (gophyr addition). While set, a PNG that
+// stops early is decoded as far as its data goes instead of failing.
+// Interlaced images come out once their first Adam7 pass is complete, the
+// pixels of the missing passes copied from decoded ones above and to the
+// left. stbi_png_passes() tells how many passes the last PNG decoded had
+// complete, 7 for a whole image. Non-interlaced images still need all rows.
+STBIDEF void     stbi_set_png_partial(int flag_true_if_partial);
+STBIDEF int      stbi_png_passes(void);
+
 #ifndef STBI_NO_STDIO
 STBIDEF stbi_uc *stbi_load            (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels);
 STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in_file, int desired_channels);
@@ -431,6 +454,17 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// Animated GIFs one frame at a time (gophyr addition). Each stbi_gif_next()
+// composes the next frame over the previous one in a single RGBA buffer of
+// *x by *y pixels, owned by the decoder and valid until the next call, and
+// reports its delay in milliseconds. It returns NULL after the last frame or
+// on an error. "Restore to previous" disposal is treated as "restore to
+// background", since no older frame is kept.
+typedef struct stbi_gif_frames stbi_gif_frames;
+STBIDEF stbi_gif_frames *stbi_gif_open(stbi_uc const *buffer, int len);
+STBIDEF stbi_uc *stbi_gif_next(stbi_gif_frames *f, int *x, int *y, int *delay_ms);
+STBIDEF void     stbi_gif_close(stbi_gif_frames *f);
 #endif
 
 #ifdef STBI_WINDOWS_UTF8
@@ -1998,6 +2032,20 @@ typedef struct
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+
+// row streaming (gophyr): the component buffers hold one band of rows (an
+// MCU row, or a block row for single-component scans), which is converted
+// and handed to row_cb as soon as it is decoded
+   stbi_row_callback row_cb;
+   void *row_user;
+   stbi_uc *row_out;
+   int row_n, row_decode_n, row_is_rgb;
+   int stream_band_h;   // output rows per band
+   int stream_band;     // band being decoded
+   int stream_next;     // next band to hand out
+   int stream_scans;
+   int row_shift;       // log2 of the scale, blocks decode to 8>>row_shift pixels
+   int row_w, row_h;    // size of the handed out image
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -2523,6 +2571,61 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced-size IDCTs for scaled streaming (gophyr): an N-point IDCT of the
+// N lowest frequencies of each row and column gives an N x N picture of the
+// block, with the same DC level as the full 8x8 IDCT. 12-bit fixed point
+// c(u)/2 * cos((2x+1)u*pi/2N), indexed [x][u]
+static const short stbi__idct_4x4_coef[4][4] = {
+   { 1448,  1892,  1448,   784 },
+   { 1448,   784, -1448, -1892 },
+   { 1448,  -784, -1448,  1892 },
+   { 1448, -1892,  1448,  -784 },
+};
+static const short stbi__idct_2x2_coef[2][2] = {
+   { 1448,  1448 },
+   { 1448, -1448 },
+};
+
+static void stbi__idct_reduced(stbi_uc *out, int out_stride, short data[64], const short *coef, int n)
+{
+   int x,y,u,val[16];
+   // columns: the low n coefficients of each of the low n columns
+   for (u=0; u < n; ++u) {
+      for (y=0; y < n; ++y) {
+         int t = 0, v;
+         for (v=0; v < n; ++v)
+            t += coef[y*n + v] * data[v*8 + u];
+         val[y*n + u] = (t + (1 << 11)) >> 12;
+      }
+   }
+   // rows, plus the +128 level shift
+   for (y=0; y < n; ++y, out += out_stride) {
+      for (x=0; x < n; ++x) {
+         int t = 0;
+         for (u=0; u < n; ++u)
+            t += coef[x*n + u] * val[y*n + u];
+         out[x] = stbi__clamp(((t + (1 << 11)) >> 12) + 128);
+      }
+   }
+}
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, &stbi__idct_4x4_coef[0][0], 4);
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   stbi__idct_reduced(out, out_stride, data, &stbi__idct_2x2_coef[0][0], 2);
+}
+
+// DC only: the block average
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2946,9 +3049,18 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+static int stbi__jpeg_stream_band(stbi__jpeg *z, int band);
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
    stbi__jpeg_reset(z);
+   if (z->row_cb) {
+      // bands are handed out as they complete, so all components must
+      // arrive together in a single scan
+      if (z->scan_n != z->s->img_n || z->stream_scans++ > 0)
+         return stbi__err("multi-scan", "JPEG scan layout cannot be streamed");
+      z->stream_band_h = (z->scan_n == 1 ? 8 : z->img_mcu_h) >> z->row_shift;
+   }
    if (!z->progressive) {
       if (z->scan_n == 1) {
          int i,j;
@@ -2961,10 +3073,13 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
          int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
          for (j=0; j < h; ++j) {
+            z->stream_band = j;
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
+               int y2 = z->row_cb ? 0 : j*8;
+               int x2 = (i*8) >> z->row_shift;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2974,12 +3089,14 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->row_cb && !stbi__jpeg_stream_band(z, j)) return 0;
          }
          return 1;
       } else { // interleaved
          int i,j,k,x,y;
          STBI_SIMD_ALIGN(short, data[64]);
          for (j=0; j < z->img_mcu_y; ++j) {
+            z->stream_band = j;
             for (i=0; i < z->img_mcu_x; ++i) {
                // scan an interleaved mcu... process scan_n components in order
                for (k=0; k < z->scan_n; ++k) {
@@ -2988,8 +3105,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = ((i*z->img_comp[n].h + x)*8) >> z->row_shift;
+                        int y2 = (((z->row_cb ? 0 : j*z->img_comp[n].v) + y)*8) >> z->row_shift;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -3004,6 +3121,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->row_cb && !stbi__jpeg_stream_band(z, j)) return 0;
          }
          return 1;
       }
@@ -3318,6 +3436,11 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
    z->img_mcu_x = (s->img_x + z->img_mcu_w-1) / z->img_mcu_w;
    z->img_mcu_y = (s->img_y + z->img_mcu_h-1) / z->img_mcu_h;
 
+   if (z->row_cb) {
+      z->row_w = (s->img_x + (1 << z->row_shift) - 1) >> z->row_shift;
+      z->row_h = (s->img_y + (1 << z->row_shift) - 1) >> z->row_shift;
+   }
+
    for (i=0; i < s->img_n; ++i) {
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
@@ -3331,6 +3454,14 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // so these muls can't overflow with 32-bit ints (which we require)
       z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
       z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      if (z->row_cb) {
+         // streaming keeps a single MCU row; progressive scans refine the
+         // whole image, so they cannot be streamed
+         if (z->progressive)
+            return stbi__free_jpeg_components(z, i, stbi__err("progressive", "Progressive JPEG cannot be streamed"));
+         z->img_comp[i].w2 >>= z->row_shift;
+         z->img_comp[i].h2 = (z->img_comp[i].v * 8) >> z->row_shift;
+      }
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3423,6 +3554,10 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
          if (!stbi__parse_entropy_coded_data(j)) return 0;
+         // a scan cut short by a missing restart marker still has its
+         // last band decoded
+         if (j->row_cb && j->stream_next <= j->stream_band)
+            if (!stbi__jpeg_stream_band(j, j->stream_band)) return 0;
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -3862,6 +3997,148 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+static resample_row_func stbi__jpeg_resampler(stbi__jpeg *z, int hs, int vs)
+{
+   if      (hs == 1 && vs == 1) return resample_row_1;
+   else if (hs == 1 && vs == 2) return stbi__resample_row_v_2;
+   else if (hs == 2 && vs == 1) return stbi__resample_row_h_2;
+   else if (hs == 2 && vs == 2) return z->resample_row_hv_2_kernel;
+   else                         return stbi__resample_row_generic;
+}
+
+// color-convert one row of resampled components to n channels
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi_uc *out, stbi_uc *coutput[4], unsigned int w, int n, int is_rgb)
+{
+   unsigned int i;
+   if (n >= 3) {
+      stbi_uc *y = coutput[0];
+      if (z->s->img_n == 3) {
+         if (is_rgb) {
+            for (i=0; i < w; ++i) {
+               out[0] = y[i];
+               out[1] = coutput[1][i];
+               out[2] = coutput[2][i];
+               out[3] = 255;
+               out += n;
+            }
+         } else {
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], w, n);
+         }
+      } else if (z->s->img_n == 4) {
+         if (z->app14_color_transform == 0) { // CMYK
+            for (i=0; i < w; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(coutput[0][i], m);
+               out[1] = stbi__blinn_8x8(coutput[1][i], m);
+               out[2] = stbi__blinn_8x8(coutput[2][i], m);
+               out[3] = 255;
+               out += n;
+            }
+         } else if (z->app14_color_transform == 2) { // YCCK
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], w, n);
+            for (i=0; i < w; ++i) {
+               stbi_uc m = coutput[3][i];
+               out[0] = stbi__blinn_8x8(255 - out[0], m);
+               out[1] = stbi__blinn_8x8(255 - out[1], m);
+               out[2] = stbi__blinn_8x8(255 - out[2], m);
+               out += n;
+            }
+         } else { // YCbCr + alpha?  Ignore the fourth channel for now
+            z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], w, n);
+         }
+      } else
+         for (i=0; i < w; ++i) {
+            out[0] = out[1] = out[2] = y[i];
+            out[3] = 255; // not used if n==3
+            out += n;
+         }
+   } else {
+      if (is_rgb) {
+         if (n == 1)
+            for (i=0; i < w; ++i)
+               *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+         else {
+            for (i=0; i < w; ++i, out += 2) {
+               out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+               out[1] = 255;
+            }
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+         for (i=0; i < w; ++i) {
+            stbi_uc m = coutput[3][i];
+            stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+            stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+            stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+            out[0] = stbi__compute_y(r, g, b);
+            out[1] = 255;
+            out += n;
+         }
+      } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+         for (i=0; i < w; ++i) {
+            out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+            out[1] = 255;
+            out += n;
+         }
+      } else {
+         stbi_uc *y = coutput[0];
+         if (n == 1)
+            for (i=0; i < w; ++i) out[i] = y[i];
+         else
+            for (i=0; i < w; ++i) { *out++ = y[i]; *out++ = 255; }
+      }
+   }
+}
+
+// resample, convert and hand out the rows of a decoded band
+static int stbi__jpeg_stream_band(stbi__jpeg *z, int band)
+{
+   int k, r;
+   int y0 = band * z->stream_band_h;
+   int rows = z->row_h - y0;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+
+   if (rows > z->stream_band_h) rows = z->stream_band_h;
+   z->stream_next = band + 1;
+
+   if (!z->row_out) {
+      int n = z->row_n;
+      z->row_is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+      z->row_decode_n = (z->s->img_n == 3 && n < 3 && !z->row_is_rgb) ? 1 : z->s->img_n;
+      for (k=0; k < z->row_decode_n; ++k) {
+         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->row_w + 3);
+         if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+      }
+      // +1 as the converters write a fourth byte after each pixel
+      z->row_out = (stbi_uc *) stbi__malloc_mad2(n, z->row_w, 1);
+      if (!z->row_out) return stbi__err("outofmem", "Out of memory");
+   }
+
+   for (r=0; r < rows; ++r) {
+      for (k=0; k < z->row_decode_n; ++k) {
+         int hs = z->img_h_max / z->img_comp[k].h;
+         int vs = z->img_v_max / z->img_comp[k].v;
+         int last = (rows + vs-1) / vs - 1;
+         int near = r / vs, far = near;
+         stbi_uc *data = z->img_comp[k].data;
+         // vertical 2x upsampling blends in the neighbouring row, which is
+         // clamped to this band
+         if (vs == 2) {
+            far = near + ((r & 1) ? 1 : -1);
+            if (far < 0) far = 0;
+            if (far > last) far = last;
+         }
+         coutput[k] = stbi__jpeg_resampler(z, hs, vs)(z->img_comp[k].linebuf,
+                                                      data + near * z->img_comp[k].w2,
+                                                      data + far * z->img_comp[k].w2,
+                                                      (z->row_w + hs-1) / hs, hs);
+      }
+      stbi__jpeg_convert_row(z, z->row_out, coutput, z->row_w, z->row_n, z->row_is_rgb);
+      if (z->row_cb(z->row_user, y0 + r, z->row_out, z->row_w))
+         return stbi__err("aborted", "Decoding stopped by the row callback");
+   }
+   return 1;
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3890,7 +4167,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // resample and color-convert
    {
       int k;
-      unsigned int i,j;
+      unsigned int j;
       stbi_uc *output;
       stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
 
@@ -3910,12 +4187,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
          r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
          r->ypos    = 0;
          r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
+         r->resample = stbi__jpeg_resampler(z, r->hs, r->vs);
       }
 
       // can't error after this so, this is safe
@@ -3939,83 +4211,7 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
                   r->line1 += z->img_comp[k].w2;
             }
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
-         }
+         stbi__jpeg_convert_row(z, out, coutput, z->s->img_x, n, is_rgb);
       }
       stbi__cleanup_jpeg(z);
       *out_x = z->s->img_x;
@@ -4039,6 +4235,38 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    return result;
 }
 
+// decode a baseline JPEG band by band; *emitted tells whether any rows were
+// handed out before a failure
+static int stbi__jpeg_load_rows(stbi__context *s, int *x, int *y, int *comp, int req_comp, int shift,
+                                stbi_row_callback cb, void *user, int *emitted)
+{
+   int result;
+   stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+   if (!j) return stbi__err("outofmem", "Out of memory");
+   memset(j, 0, sizeof(stbi__jpeg));
+   j->s = s;
+   j->row_cb = cb;
+   j->row_user = user;
+   j->row_n = req_comp;
+   j->row_shift = shift;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+   stbi__setup_jpeg(j);
+   if (shift == 1) j->idct_block_kernel = stbi__idct_block_4x4;
+   if (shift == 2) j->idct_block_kernel = stbi__idct_block_2x2;
+   if (shift == 3) j->idct_block_kernel = stbi__idct_block_1x1;
+   result = stbi__decode_jpeg_image(j);
+   *emitted = j->stream_next > 0;
+   if (result) {
+      *x = j->row_w;
+      *y = j->row_h;
+      if (comp) *comp = s->img_n >= 3 ? 3 : 1;
+   }
+   stbi__cleanup_jpeg(j);
+   STBI_FREE(j->row_out);
+   STBI_FREE(j);
+   return result;
+}
+
 static int stbi__jpeg_test(stbi__context *s)
 {
    int r;
@@ -4078,6 +4306,68 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 }
 #endif
 
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale, stbi_row_callback cb, void *user)
+{
+   stbi_uc *data, *row = NULL;
+   unsigned int *sum = NULL;
+   int shift, w, h, i, j, r = 1;
+
+   if (req_comp < 1 || req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   for (shift=0; shift < 4 && (1 << shift) != scale; ++shift);
+   if (shift == 4) return stbi__err("bad scale", "Internal error");
+
+#ifndef STBI_NO_JPEG
+   {
+      stbi__context s;
+      int emitted = 0;
+      stbi__start_mem(&s,buffer,len);
+      if (stbi__jpeg_test(&s)) {
+         r = stbi__jpeg_load_rows(&s, x, y, comp, req_comp, shift, cb, user, &emitted);
+         if (r || emitted) return r;
+         // progressive or split scans: fall back to decoding the whole image
+         r = 1;
+      }
+   }
+#endif
+
+   data = stbi_load_from_memory(buffer, len, x, y, comp, req_comp);
+   if (!data) return 0;
+   w = (*x + scale-1) >> shift;
+   h = (*y + scale-1) >> shift;
+   if (shift) {
+      // box-average scale x scale blocks, clipped at the right and bottom
+      row = (stbi_uc *) stbi__malloc_mad2(w, req_comp, 0);
+      sum = (unsigned int *) stbi__malloc_mad2(w * req_comp, sizeof(unsigned int), 0);
+      if (!row || !sum) r = stbi__err("outofmem", "Out of memory");
+   }
+   for (j=0; r && j < h; ++j) {
+      stbi_uc *out = data + (size_t) j * *x * req_comp;
+      if (shift) {
+         int y0 = j << shift, y1 = y0 + scale < *y ? y0 + scale : *y, yy;
+         memset(sum, 0, w * req_comp * sizeof(unsigned int));
+         for (yy=y0; yy < y1; ++yy) {
+            stbi_uc *in = data + (size_t) yy * *x * req_comp;
+            for (i=0; i < *x * req_comp; ++i)
+               sum[(i / req_comp >> shift) * req_comp + i % req_comp] += in[i];
+         }
+         for (i=0; i < w * req_comp; ++i) {
+            int x0 = (i / req_comp) << shift;
+            int n = ((x0 + scale < *x ? x0 + scale : *x) - x0) * (y1 - y0);
+            row[i] = (stbi_uc) ((sum[i] + n/2) / n);
+         }
+         out = row;
+      }
+      if (cb(user, j, out, w))
+         r = stbi__err("aborted", "Decoding stopped by the row callback");
+   }
+   STBI_FREE(row);
+   STBI_FREE(sum);
+   stbi_image_free(data);
+   *x = w;
+   *y = h;
+   return r;
+}
+
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
 //    simple implementation
 //      - all input must be provided in an upfront buffer
@@ -4306,11 +4596,18 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
+// gophyr: set by stbi_set_png_partial(), read by the zlib decoder too
+static int stbi__png_partial;
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
    char *zout = a->zout;
    for(;;) {
-      int z = stbi__zhuffman_decode(a, &a->z_length);
+      int z;
+      // gophyr: a->zout covers the output that used none of the padding bits
+      // past the end, which is what a truncated stream decodes to
+      if (stbi__png_partial && (!a->hit_zeof_once || a->num_bits >= 16)) a->zout = zout;
+      z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
          if (z < 0) return stbi__err("bad huffman code","Corrupt PNG"); // error in huffman codes
          if (zout >= a->zout_end) {
@@ -4554,6 +4851,24 @@ STBIDEF char *stbi_zlib_decode_malloc_guesssize_headerflag(const char *buffer, i
    }
 }
 
+// gophyr: like stbi_zlib_decode_malloc_guesssize_headerflag(), but a stream
+// that stops early returns what it decoded to so far
+static char *stbi__zlib_decode_partial(const char *buffer, int len, int initial_size, int *outlen, int parse_header)
+{
+   stbi__zbuf a;
+   char *p = (char *) stbi__malloc(initial_size);
+   if (p == NULL) return NULL;
+   a.zbuffer = (stbi_uc *) buffer;
+   a.zbuffer_end = (stbi_uc *) buffer + len;
+   if (stbi__do_zlib(&a, p, initial_size, 1, parse_header) || a.zout > a.zout_start) {
+      if (outlen) *outlen = (int) (a.zout - a.zout_start);
+      return a.zout_start;
+   } else {
+      STBI_FREE(a.zout_start);
+      return NULL;
+   }
+}
+
 STBIDEF int stbi_zlib_decode_buffer(char *obuffer, int olen, char const *ibuffer, int ilen)
 {
    stbi__zbuf a;
@@ -4858,12 +5173,47 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    return 1;
 }
 
+// gophyr: partial PNG decoding, see stbi_set_png_partial()
+static int stbi__png_passes;
+
+STBIDEF void stbi_set_png_partial(int flag_true_if_partial)
+{
+   stbi__png_partial = flag_true_if_partial;
+}
+
+STBIDEF int stbi_png_passes(void)
+{
+   return stbi__png_passes;
+}
+
+// gophyr: once the first 'passes' Adam7 passes are in, the decoded pixels
+// form a grid; give every other pixel the value of the grid point above and
+// to the left of it
+static void stbi__png_fill_passes(stbi_uc *img, stbi__uint32 w, stbi__uint32 h, int out_bytes, int passes)
+{
+   static const int xstep[7] = { 8,4,4,2,2,1,1 };
+   static const int ystep[7] = { 8,8,4,4,2,2,1 };
+   stbi__uint32 sx = xstep[passes-1], sy = ystep[passes-1], i, j;
+   size_t stride = (size_t) w * out_bytes;
+   for (j=0; j < h; ++j) {
+      stbi_uc *row = img + j * stride;
+      if (j % sy) {
+         memcpy(row, img + (j - j % sy) * stride, stride);
+         continue;
+      }
+      for (i=0; i < w; ++i)
+         if (i % sx)
+            memcpy(row + i*out_bytes, row + (i - i % sx)*out_bytes, out_bytes);
+   }
+}
+
 static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint32 image_data_len, int out_n, int depth, int color, int interlaced)
 {
    int bytes = (depth == 16 ? 2 : 1);
    int out_bytes = out_n * bytes;
    stbi_uc *final;
    int p;
+   stbi__png_passes = 7;
    if (!interlaced)
       return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
 
@@ -4881,6 +5231,13 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
+         if (stbi__png_partial && image_data_len < img_len) {
+            // gophyr: the rest has not arrived yet
+            if (p == 0) break;
+            stbi__png_passes = p;
+            stbi__png_fill_passes(final, a->s->img_x, a->s->img_y, out_bytes, p);
+            break;
+         }
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
             STBI_FREE(final);
             return 0;
@@ -4898,6 +5255,10 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
          image_data_len -= img_len;
       }
    }
+   if (p == 0) {
+      STBI_FREE(final);
+      return stbi__err("not enough pixels","Corrupt PNG");
+   }
    a->out = final;
 
    return 1;
@@ -5093,7 +5454,14 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
    if (scan == STBI__SCAN_type) return 1;
 
    for (;;) {
-      stbi__pngchunk c = stbi__get_chunk_header(s);
+      stbi__pngchunk c;
+      if (stbi__png_partial && z->idata && s->img_buffer_end - s->img_buffer < 8) {
+         // gophyr: a partial image ends where its data does
+         c.length = 0;
+         c.type = STBI__PNG_TYPE('I','E','N','D');
+      } else {
+         c = stbi__get_chunk_header(s);
+      }
       switch (c.type) {
          case STBI__PNG_TYPE('C','g','B','I'):
             is_iphone = 1;
@@ -5180,6 +5548,8 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
                return 1;
             }
             if (c.length > (1u << 30)) return stbi__err("IDAT size limit", "IDAT section larger than 2^30 bytes");
+            if (stbi__png_partial && c.length > (stbi__uint32) (s->img_buffer_end - s->img_buffer))
+               c.length = (stbi__uint32) (s->img_buffer_end - s->img_buffer); // gophyr: take what has arrived
             if ((int)(ioff + c.length) < (int)ioff) return 0;
             if (ioff + c.length > idata_limit) {
                stbi__uint32 idata_limit_old = idata_limit;
@@ -5204,7 +5574,10 @@ static int stbi__parse_png_file(stbi__png *z, int scan, int req_comp)
             // initial guess for decoded data size to avoid unnecessary reallocs
             bpl = (s->img_x * z->depth + 7) / 8; // bytes per line, per component
             raw_len = bpl * s->img_y * s->img_n /* pixels */ + s->img_y /* filter mode per row */;
-            z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            if (stbi__png_partial)
+               z->expanded = (stbi_uc *) stbi__zlib_decode_partial((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
+            else
+               z->expanded = (stbi_uc *) stbi_zlib_decode_malloc_guesssize_headerflag((char *) z->idata, ioff, raw_len, (int *) &raw_len, !is_iphone);
             if (z->expanded == NULL) return 0; // zlib should set error
             STBI_FREE(z->idata); z->idata = NULL;
             if ((req_comp == s->img_n+1 && req_comp != 3 && !pal_img_n) || has_trans)
@@ -7078,6 +7451,58 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+// gophyr: frame by frame decoding, see stbi_gif_open()
+struct stbi_gif_frames
+{
+   stbi__context s;
+   stbi__gif g;
+   int ended;
+};
+
+STBIDEF stbi_gif_frames *stbi_gif_open(stbi_uc const *buffer, int len)
+{
+   stbi_gif_frames *f;
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   if (!stbi__gif_test(&s)) {
+      stbi__err("not GIF", "Image was not as a gif type.");
+      return NULL;
+   }
+   f = (stbi_gif_frames *) stbi__malloc(sizeof(*f));
+   if (!f) {
+      stbi__err("outofmem", "Out of memory");
+      return NULL;
+   }
+   memset(f, 0, sizeof(*f));
+   stbi__start_mem(&f->s,buffer,len);
+   return f;
+}
+
+STBIDEF stbi_uc *stbi_gif_next(stbi_gif_frames *f, int *x, int *y, int *delay_ms)
+{
+   int comp;
+   stbi_uc *u;
+   if (f->ended) return NULL;
+   u = stbi__gif_load_next(&f->s, &f->g, &comp, 4, 0);
+   if (u == (stbi_uc *) &f->s || !u) {
+      f->ended = 1;
+      return NULL;
+   }
+   *x = f->g.w;
+   *y = f->g.h;
+   *delay_ms = f->g.delay;
+   return u;
+}
+
+STBIDEF void stbi_gif_close(stbi_gif_frames *f)
+{
+   if (!f) return;
+   STBI_FREE(f->g.out);
+   STBI_FREE(f->g.history);
+   STBI_FREE(f->g.background);
+   STBI_FREE(f);
+}
 #endif
 
 // *************************************************************************************************